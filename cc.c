@@ -0,0 +1,239 @@
+#include <string.h>
+
+#include "cc.h"
+
+/* ---------- fixed：窗口 = W，不 pacing ---------- */
+
+static void fixed_init(cc_t *cc, uint64_t now_us)
+{
+    (void)now_us;
+    cc->cwnd = cc->max_cwnd;
+    cc->pacing_rate = 0;
+}
+
+static void fixed_on_ack(cc_t *cc, const cc_sample_t *rs)
+{
+    (void)cc; (void)rs;
+}
+
+/* ---------- bbr ---------- */
+
+#define BBR_HIGH_GAIN      2.885            // 2/ln2：STARTUP 每轮速率翻倍
+#define BBR_CWND_GAIN      2.0
+#define BBR_INIT_CWND      32u
+#define BBR_MIN_CWND       4u
+#define BBR_INIT_RTT_US    1000u            // 还没有 RTT 样本时假定 1 ms，只影响初始 pacing
+#define BBR_MIN_RTT_WIN_US (10u * 1000000u) // min_rtt 过期时间，过期后进 PROBE_RTT
+#define BBR_PROBE_RTT_US   (200u * 1000u)
+#define BBR_QUANTUM_US     1000u            // 与 ncp 的 pacing 突发量一致，cwnd 要给它留余量
+
+static const double bbr_cycle_gain[8] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+static uint64_t bbr_rtt_us(const bbr_t *b)
+{
+    return b->min_rtt_us ? b->min_rtt_us : BBR_INIT_RTT_US;
+}
+
+// 目标在途量 = gain * BDP + pacing 突发余量
+static uint32_t bbr_target_cwnd(const bbr_t *b, double gain)
+{
+    if (b->btl_bw == 0) return BBR_INIT_CWND;
+    double bdp   = b->btl_bw * (double)bbr_rtt_us(b) / 1e6;
+    double burst = b->btl_bw * BBR_QUANTUM_US / 1e6;
+    double t = gain * bdp + 2 * (burst < 2 ? 2 : burst);
+    return t < BBR_MIN_CWND ? BBR_MIN_CWND : (uint32_t)(t + 0.5);
+}
+
+static void bbr_enter(bbr_t *b, bbr_mode_t mode, uint64_t now_us)
+{
+    b->mode = mode;
+    switch (mode) {
+    case BBR_STARTUP:
+        // cwnd 只给 2 倍 BDP（同 BBRv2）：带宽估到顶后还要三轮才判满，
+        // 这期间 2.885 倍的 cwnd 会让在途量超过 BDP + 瓶颈队列，队列比 BDP 大也照样溢出
+        b->pacing_gain = BBR_HIGH_GAIN; b->cwnd_gain = BBR_CWND_GAIN; break;
+    case BBR_DRAIN:
+        b->pacing_gain = 1.0 / BBR_HIGH_GAIN; b->cwnd_gain = BBR_CWND_GAIN; break;
+    case BBR_PROBE_BW:
+        b->cycle_idx = 2;                    // 从巡航相位开始，下一轮再探测
+        b->cycle_stamp_us = now_us;
+        b->pacing_gain = bbr_cycle_gain[b->cycle_idx]; b->cwnd_gain = BBR_CWND_GAIN; break;
+    case BBR_PROBE_RTT:
+        b->pacing_gain = 1.0; b->cwnd_gain = 1.0;
+        b->probe_rtt_done_us = 0;
+        break;
+    }
+}
+
+static void bbr_init(cc_t *cc, uint64_t now_us)
+{
+    bbr_t *b = &cc->bbr;
+    memset(b, 0, sizeof(*b));
+    b->min_rtt_stamp_us = now_us;
+    bbr_enter(b, BBR_STARTUP, now_us);
+    cc->cwnd = BBR_INIT_CWND < cc->max_cwnd ? BBR_INIT_CWND : cc->max_cwnd;
+    cc->pacing_rate = BBR_HIGH_GAIN * cc->cwnd * 1e6 / BBR_INIT_RTT_US;
+}
+
+// 一“轮” = 本轮开始时发出的数据被确认所需的时间
+static void bbr_update_round(bbr_t *b, const cc_sample_t *rs)
+{
+    b->round_start = 0;
+    if (rs->prior_delivered >= b->next_round_delivered) {
+        b->next_round_delivered = rs->delivered;
+        b->round_count++;
+        b->round_start = 1;
+        b->bw_round[b->round_count % BBR_BW_ROUNDS] = 0;
+    }
+}
+
+// 窗口最大值滤波：app_limited 的样本只在比当前估计大时才采用
+static void bbr_update_bw(bbr_t *b, const cc_sample_t *rs)
+{
+    if (rs->delivery_rate <= 0) return;
+    if (rs->app_limited && rs->delivery_rate < b->btl_bw) return;
+    double *slot = &b->bw_round[b->round_count % BBR_BW_ROUNDS];
+    if (rs->delivery_rate > *slot) *slot = rs->delivery_rate;
+    b->btl_bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; ++i)
+        if (b->bw_round[i] > b->btl_bw) b->btl_bw = b->bw_round[i];
+}
+
+static void bbr_check_full_pipe(bbr_t *b, const cc_sample_t *rs)
+{
+    if (b->filled_pipe || !b->round_start || rs->app_limited) return;
+    if (b->btl_bw >= b->full_bw * 1.25) {
+        b->full_bw = b->btl_bw;
+        b->full_bw_cnt = 0;
+        return;
+    }
+    if (++b->full_bw_cnt >= 3) b->filled_pipe = 1;
+}
+
+static void bbr_update_cycle(bbr_t *b, const cc_sample_t *rs)
+{
+    if (b->mode != BBR_PROBE_BW) return;
+    int full_len = rs->now_us - b->cycle_stamp_us > bbr_rtt_us(b);
+    // 减速相位排空到 BDP 就可以提前结束
+    if (full_len || (b->pacing_gain < 1 && rs->inflight <= bbr_target_cwnd(b, 1.0))) {
+        b->cycle_idx = (b->cycle_idx + 1) % 8;
+        b->cycle_stamp_us = rs->now_us;
+        b->pacing_gain = bbr_cycle_gain[b->cycle_idx];
+    }
+}
+
+static void bbr_update_min_rtt(cc_t *cc, const cc_sample_t *rs)
+{
+    bbr_t *b = &cc->bbr;
+    int expired = rs->now_us > b->min_rtt_stamp_us + BBR_MIN_RTT_WIN_US;
+    if (rs->rtt_us && (b->min_rtt_us == 0 || rs->rtt_us <= b->min_rtt_us || expired)) {
+        b->min_rtt_us = rs->rtt_us;
+        b->min_rtt_stamp_us = rs->now_us;
+    }
+    if (expired && b->mode != BBR_PROBE_RTT) {
+        b->prior_cwnd = cc->cwnd;
+        bbr_enter(b, BBR_PROBE_RTT, rs->now_us);
+    }
+    if (b->mode != BBR_PROBE_RTT) return;
+    // 在途降到最小窗口后保持 200 ms 且至少一轮，量到的就是无排队的 RTT
+    if (b->probe_rtt_done_us == 0 && rs->inflight <= BBR_MIN_CWND) {
+        b->probe_rtt_done_us = rs->now_us + BBR_PROBE_RTT_US;
+        b->probe_rtt_round_done = 0;
+        b->next_round_delivered = rs->delivered;
+    } else if (b->probe_rtt_done_us) {
+        if (b->round_start) b->probe_rtt_round_done = 1;
+        if (b->probe_rtt_round_done && rs->now_us > b->probe_rtt_done_us) {
+            b->min_rtt_stamp_us = rs->now_us;
+            if (cc->cwnd < b->prior_cwnd) cc->cwnd = b->prior_cwnd;
+            bbr_enter(b, b->filled_pipe ? BBR_PROBE_BW : BBR_STARTUP, rs->now_us);
+        }
+    }
+}
+
+static void bbr_on_ack(cc_t *cc, const cc_sample_t *rs)
+{
+    bbr_t *b = &cc->bbr;
+    bbr_update_round(b, rs);
+    bbr_update_bw(b, rs);
+    bbr_check_full_pipe(b, rs);
+    if (b->mode == BBR_STARTUP && b->filled_pipe) bbr_enter(b, BBR_DRAIN, rs->now_us);
+    if (b->mode == BBR_DRAIN && rs->inflight <= bbr_target_cwnd(b, 1.0)) bbr_enter(b, BBR_PROBE_BW, rs->now_us);
+    bbr_update_cycle(b, rs);
+    bbr_update_min_rtt(cc, rs);
+
+    // pacing：STARTUP 里估计还没稳定，只升不降
+    if (b->btl_bw > 0) {
+        double rate = b->pacing_gain * b->btl_bw;
+        if (b->filled_pipe || rate > cc->pacing_rate) cc->pacing_rate = rate;
+    }
+
+    // cwnd：管道填满前随确认量增长，之后收敛到目标
+    uint32_t target = bbr_target_cwnd(b, b->cwnd_gain);
+    uint32_t cwnd = cc->cwnd;
+    if (b->filled_pipe) {
+        cwnd += rs->acked;
+        if (cwnd > target) cwnd = target;
+    } else if (cwnd < target || rs->delivered < BBR_INIT_CWND) {
+        cwnd += rs->acked;
+    }
+    if (cwnd < BBR_MIN_CWND) cwnd = BBR_MIN_CWND;
+    if (b->mode == BBR_PROBE_RTT && cwnd > BBR_MIN_CWND) cwnd = BBR_MIN_CWND;
+    cc->cwnd = cwnd < cc->max_cwnd ? cwnd : cc->max_cwnd;
+}
+
+// 探测结果只定起步：min_rtt 直接采用（10 秒后照常过期重测），
+// 带宽不进 btl_bw 滤波，只把起步 pacing 和 cwnd 定在一个 BDP，STARTUP 仍按 ACK 实测往上找
+static void bbr_seed(cc_t *cc, double bw, uint64_t rtt_us, uint64_t now_us)
+{
+    bbr_t *b = &cc->bbr;
+    if (rtt_us) {
+        b->min_rtt_us = rtt_us;
+        b->min_rtt_stamp_us = now_us;
+    }
+    uint32_t cwnd = cc->cwnd;
+    if (bw > 0) {
+        double bdp = bw * (double)bbr_rtt_us(b) / 1e6;
+        if (bdp > cwnd) cwnd = (uint32_t)bdp;
+        cc->cwnd = cwnd < cc->max_cwnd ? cwnd : cc->max_cwnd;
+        cc->pacing_rate = bw;
+    } else {
+        cc->pacing_rate = BBR_HIGH_GAIN * cc->cwnd * 1e6 / bbr_rtt_us(b);
+    }
+}
+
+/* ---------- 注册表 ---------- */
+
+static const cc_ops_t cc_fixed = { "fixed", fixed_init, fixed_on_ack, NULL     };
+static const cc_ops_t cc_bbr   = { "bbr",   bbr_init,   bbr_on_ack,   bbr_seed };
+
+static const cc_ops_t *const cc_table[] = { &cc_bbr, &cc_fixed };
+
+const cc_ops_t *cc_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(cc_table) / sizeof(cc_table[0]); ++i)
+        if (strcmp(cc_table[i]->name, name) == 0) return cc_table[i];
+    return NULL;
+}
+
+void cc_init(cc_t *cc, const cc_ops_t *ops, uint32_t max_cwnd, uint64_t now_us)
+{
+    memset(cc, 0, sizeof(*cc));
+    cc->ops = ops;
+    cc->max_cwnd = max_cwnd;
+    ops->init(cc, now_us);
+}
+
+void cc_seed(cc_t *cc, double bw, uint64_t rtt_us, uint64_t now_us)
+{
+    if (cc->ops->seed) cc->ops->seed(cc, bw, rtt_us, now_us);
+}
+
+double cc_btl_bw(const cc_t *cc)
+{
+    return cc->ops == &cc_bbr ? cc->bbr.btl_bw : 0;
+}
+
+uint64_t cc_min_rtt_us(const cc_t *cc)
+{
+    return cc->ops == &cc_bbr ? cc->bbr.min_rtt_us : 0;
+}
@@ -0,0 +1,83 @@
+#ifndef CS2520_CC
+#define CS2520_CC
+
+#include <stdint.h>
+
+/*
+ * 发送端拥塞控制：可插拔。ncp 每收到推进 send_base 的 ACK 就交给 on_ack 一个速率样本，
+ * 算法只输出两个量：
+ *   cwnd         在途上限（分片数，再与本端 W、接收端 rwnd 取小）
+ *   pacing_rate  发送速率（分片/秒），0 = 不限速，按窗口突发
+ * 单位都是分片（MAX_PAYLOAD 字节）和微秒。
+ *
+ *   fixed  旧行为：窗口 = W，不 pacing（LAN/WAN 写死的窗口，用来对比）
+ *   bbr    默认：由 ACK 的交付速率估瓶颈带宽 btl_bw、由 RTT 估 min_rtt，
+ *          pacing_rate = gain * btl_bw，cwnd = cwnd_gain * BDP；
+ *          随机丢包（sendto_dbg）不当作拥塞信号
+ */
+
+// 一个 ACK 的速率样本（BBR 的 delivery rate 估计，见 ncp_snd.c 的 sender_rate_sample）
+typedef struct {
+    uint64_t now_us;
+    uint64_t rtt_us;            // 0 = 无效（样本分片被重传过，或 ACK 被前面的洞拖住）
+    double   delivery_rate;     // 分片/秒，0 = 无效
+    uint64_t delivered;         // 累计已确认分片数（含本次）
+    uint64_t prior_delivered;   // 样本分片发出时的 delivered，用于划分“轮”
+    uint32_t acked;             // 本次新确认的分片数
+    uint32_t inflight;          // 处理本 ACK 后的在途分片数
+    int      app_limited;       // 样本分片发出时发送端无数据可发（速率偏低，不可信）
+} cc_sample_t;
+
+enum { BBR_BW_ROUNDS = 10 };
+
+typedef enum { BBR_STARTUP, BBR_DRAIN, BBR_PROBE_BW, BBR_PROBE_RTT } bbr_mode_t;
+
+typedef struct {
+    bbr_mode_t mode;
+    double   bw_round[BBR_BW_ROUNDS];  // 每轮最大交付速率；btl_bw = 最近 10 轮最大值
+    double   btl_bw;                   // 分片/秒
+    uint64_t round_count;
+    uint64_t next_round_delivered;
+    int      round_start;
+    double   full_bw;                  // STARTUP 判满：连续 3 轮增长不到 25%
+    int      full_bw_cnt;
+    int      filled_pipe;
+    uint64_t min_rtt_us;               // 10 秒窗口内最小 RTT
+    uint64_t min_rtt_stamp_us;
+    uint64_t probe_rtt_done_us;
+    int      probe_rtt_round_done;
+    uint32_t prior_cwnd;
+    int      cycle_idx;                // PROBE_BW 增益循环
+    uint64_t cycle_stamp_us;
+    double   pacing_gain, cwnd_gain;
+} bbr_t;
+
+struct cc;
+
+typedef struct {
+    const char *name;
+    void (*init)(struct cc *cc, uint64_t now_us);
+    void (*on_ack)(struct cc *cc, const cc_sample_t *rs);
+    // 可选：数据阶段开始前用链路探测的结果起步（bw 分片/秒、rtt 微秒，未知为 0）
+    void (*seed)(struct cc *cc, double bw, uint64_t rtt_us, uint64_t now_us);
+} cc_ops_t;
+
+typedef struct cc {
+    const cc_ops_t *ops;
+    uint32_t max_cwnd;          // 本端窗口 W（环形表大小），cwnd 不超过它
+    uint32_t cwnd;
+    double   pacing_rate;
+    bbr_t    bbr;               // 仅 bbr 使用
+} cc_t;
+
+// 按名字找算法（"bbr" / "fixed"），找不到返回 NULL
+const cc_ops_t *cc_find(const char *name);
+
+void cc_init(cc_t *cc, const cc_ops_t *ops, uint32_t max_cwnd, uint64_t now_us);
+void cc_seed(cc_t *cc, double bw, uint64_t rtt_us, uint64_t now_us);
+
+// 估计的瓶颈带宽（分片/秒）与最小 RTT，仅用于打印；未知返回 0
+double   cc_btl_bw(const cc_t *cc);
+uint64_t cc_min_rtt_us(const cc_t *cc);
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef CS2520_LIBNCP
+#define CS2520_LIBNCP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "cc.h"
+
+/*
+ * libncp：ncp / rcv 的协议引擎（发送端、接收端状态机），可嵌入任意事件循环。
+ *
+ *   - 不碰 socket：收到的报文由调用方喂给 *_on_packet，发包走 ncp_transport_t
+ *   - 不碰文件：发送端从 ncp_source_t 取数据，接收端把按序数据交给 ncp_sink_t
+ *   - 不读时钟：时间由调用方传入（单调时钟，微秒）；*_next_deadline 告诉调用方
+ *     下一次该在什么时候调 *_on_timer
+ *   - 不阻塞、不退出进程：出错时状态变成 NCP_FAILED，*_error 给出原因
+ *
+ * ncp.c / rcv.c 用 UDP socket + epoll 驱动它；mem_transport.h 提供内存里的有损传输，
+ * 可以在一个循环里把两端直接对接（ncp_bench）。
+ */
+
+#define NCP_MAX_PEERS 64
+#define NCP_AUTO_WINDOW_MAX 131072  // 按探测结果定窗口时的上限（分片数）
+
+typedef enum { NCP_RUNNING, NCP_DONE, NCP_FAILED } ncp_state_t;
+
+// 发包：不阻塞，发不出去（丢包）也直接返回，由协议重传
+typedef struct {
+    void *ctx;
+    void (*send)(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr *to, socklen_t tolen);
+} ncp_transport_t;
+
+// 发送端数据来源。size 已知时按偏移随机读（重传要回读）；
+// size = UINT64_MAX 为流式输入，只能顺序读一次，引擎自己缓存未确认的窗口。
+// seek_data 可选（稀疏文件）：给出 off 之后第一段数据 [*data, *hole)，没有数据时两者都是 size；
+// 落在空洞里的分片不用读就知道是全零
+typedef struct {
+    void    *ctx;
+    uint64_t size;
+    ssize_t (*read_at)(void *ctx, void *buf, size_t len, uint64_t off);
+    ssize_t (*read)(void *ctx, void *buf, size_t len);   // 0 = EOF；-1 且 errno = EAGAIN 表示暂时没有
+    int     (*seek_data)(void *ctx, uint64_t off, uint64_t *data, uint64_t *hole);   // 0 = 成功
+} ncp_source_t;
+
+// 接收端数据去向：每个会话 open 一次，按序 write，结束（或被清理）时 close。
+// zero 可选：接着写 len 个零字节（文件 sink 留成空洞），NULL 时引擎用 write 写零。
+// backlog 可选：write 收下但还没交给下游的字节数（流式输出），从通告窗口里扣掉
+typedef struct {
+    void *ctx;
+    void *(*open)(void *ctx, const char *name, uint64_t size);   // 返回会话句柄，NULL = 拒绝
+    int   (*write)(void *session, const void *buf, size_t len);  // 0 = 成功
+    void  (*close)(void *session, int complete);
+    int   (*zero)(void *session, size_t len);                    // 0 = 成功
+    size_t (*backlog)(void *session);
+} ncp_sink_t;
+
+/* ---------------- 发送端 ---------------- */
+
+typedef struct ncp_sender ncp_sender_t;
+
+typedef struct {
+    const char     *dst_name;       // 接收端写入的文件名（最多 255 字节）
+    uint32_t        window;         // 本端窗口 W（分片数，也是环形表大小），0 = 按探测结果定
+    uint32_t        rto_min_ms;     // RTO 下限，0 = 按探测的 RTT 定
+    const cc_ops_t *cc;             // NULL = bbr
+    int             zero_rtt;       // START 后不等 START_OK 直接发第一窗（扇出时忽略）
+    int             probe;          // 会话确认后先发 PROBE 包对/包串测 RTT、带宽、丢包，
+                                    // 据此起步 RTO 和拥塞控制（0-RTT 时不探测）
+    // 接收端：npeers 个单播地址（>1 即扇出）；mcast 时 peers[0] 是组播组，
+    // 等 expect 个接收端回 START_OK
+    struct sockaddr_storage peers[NCP_MAX_PEERS];
+    socklen_t       peer_lens[NCP_MAX_PEERS];
+    int             npeers;
+    int             mcast;
+    int             expect;
+    FILE           *log;            // 过程信息（排队、接收端加入等），NULL = 不输出
+} ncp_sender_cfg_t;
+
+// 链路探测结果（扇出时取最慢的 RTT、最窄的带宽）
+typedef struct {
+    int      done;                  // 0 = 没有探测（未开启 / 对端不支持 / 0-RTT）
+    uint64_t rtt_us;                // 0 = 没有报告
+    double   bw;                    // 瓶颈带宽（分片/秒），0 = 测不出
+    double   loss;                  // 探测包的丢失率（没报告的串算全丢），< 0 = 没有一串有报告，不知道
+} ncp_probe_t;
+
+typedef struct {
+    uint64_t bytes_sent;            // 负载字节，含重传；单播列表扇出按份数计
+    uint64_t zero_bytes;            // 作为全零区间（ZERO）发出、没有上线的字节
+    uint64_t file_size;             // 流式输入读到 EOF 后才确定
+    uint64_t segments;
+    uint64_t srtt_us;
+    double   btl_bw;                // 拥塞控制模型的瓶颈带宽（分片/秒），未知为 0
+    uint64_t min_rtt_us;
+    int      npeers;
+    int      confirmed;             // 用 FIN_ACK 确认收齐的接收端数
+    ncp_probe_t probe;
+    uint32_t window;                // 实际用的窗口 W 和 RTO 下限（可能由探测定）
+    uint64_t rto_min_us;
+    // 重传次数按触发原因：NACK、RACK 判丢、重复 ACK 快速重传、尾部探测、超时
+    uint64_t retx_nack, retx_rack, retx_fast, retx_tlp, retx_rto;
+    uint64_t detect_us;             // 丢的分片平均多久被发现（原始发送到第一次重传），0 = 没有重传
+} ncp_snd_stats_t;
+
+// 创建并发出 START。失败（参数不对 / 内存不足）返回 NULL
+ncp_sender_t *ncp_sender_new(const ncp_sender_cfg_t *cfg, const ncp_transport_t *tp,
+                             const ncp_source_t *src, uint64_t now_us);
+void ncp_sender_free(ncp_sender_t *sn);
+
+void ncp_sender_on_packet(ncp_sender_t *sn, const uint8_t *buf, size_t len,
+                          const struct sockaddr_storage *from, socklen_t flen, uint64_t now_us);
+// 处理到期事件（重传、START 重发、探测、FIN 重发），再尽量填满窗口。
+// 全部确认后发 FIN，接收端回 FIN_ACK（或 FIN 重发次数用完）才变成 NCP_DONE。
+// 收完一批包、输入可读、定时器到期后都调用它
+void ncp_sender_on_timer(ncp_sender_t *sn, uint64_t now_us);
+uint64_t ncp_sender_next_deadline(const ncp_sender_t *sn, uint64_t now_us);   // 0 = 无定时任务
+int  ncp_sender_wants_input(const ncp_sender_t *sn, uint64_t now_us);         // 流式输入：窗口有空位
+ncp_state_t ncp_sender_state(const ncp_sender_t *sn);
+const char *ncp_sender_error(const ncp_sender_t *sn);
+void ncp_sender_stats(const ncp_sender_t *sn, ncp_snd_stats_t *st);
+// 传输结束后的统计（发送量、冗余度、探测、重传、拥塞控制模型），ncp 和 ncp_sim 打印的就是这些。
+// elapsed_s：从 START 到结束的时间（ncp_sim 里是虚拟时间）
+void ncp_sender_report(const ncp_sender_t *sn, FILE *out, double elapsed_s);
+
+/* ---------------- 接收端 ---------------- */
+
+typedef struct ncp_receiver ncp_receiver_t;
+
+#define NCP_RCV_WINDOW 4096         // 默认接收窗口（分片数）
+
+typedef struct {
+    FILE    *log;                   // 会话开始/结束、进度、排队信息，NULL = 不输出
+    uint32_t window;                // 接收窗口（分片数，通告给发送端），0 = NCP_RCV_WINDOW。
+                                    // 只有乱序分片占缓冲，缓冲池按需增长
+} ncp_receiver_cfg_t;
+
+typedef struct {
+    uint64_t sessions;              // 完成的会话数
+    uint64_t bytes;                 // 完成的会话共写入的字节数
+} ncp_rcv_stats_t;
+
+ncp_receiver_t *ncp_receiver_new(const ncp_receiver_cfg_t *cfg, const ncp_transport_t *tp,
+                                 const ncp_sink_t *sink);
+void ncp_receiver_free(ncp_receiver_t *rv);
+
+void ncp_receiver_on_packet(ncp_receiver_t *rv, const uint8_t *buf, size_t len,
+                            const struct sockaddr_storage *from, socklen_t flen, uint64_t now_us);
+// 清理空闲超时的会话。调用方按 next_deadline 定时调用，不要只在收到包时调
+void ncp_receiver_on_timer(ncp_receiver_t *rv, uint64_t now_us);
+uint64_t ncp_receiver_next_deadline(const ncp_receiver_t *rv);   // 0 = 无会话
+// sink 的积压减少后调用：窗口比上次通告的大出 W/4 以上就主动发窗口更新，
+// 不用等发送端的零窗口探测
+void ncp_receiver_on_output(ncp_receiver_t *rv, uint64_t now_us);
+void ncp_receiver_stats(const ncp_receiver_t *rv, ncp_rcv_stats_t *st);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_include.h"
+#include "mem_transport.h"
+
+#include <arpa/inet.h>
+
+typedef struct {
+    uint64_t due_us;
+    int      src, dst;
+    uint32_t len;
+    uint8_t  data[MAX_MESS_LEN];
+} mem_pkt_t;
+
+typedef struct {
+    mem_net_t *net;
+    int        id;
+} mem_ep_t;
+
+struct mem_net {
+    mem_pkt_t *q;                   // 环形 FIFO：时延固定，入队顺序就是到期顺序
+    size_t     cap, head, count;
+    int        loss;
+    unsigned   seed;
+    uint64_t   delay_us;
+    uint64_t   now_us;
+    mem_ep_t   ep[MEM_NET_MAX_EP];
+    mem_net_stats_t st;
+};
+
+void mem_net_addr(int id, struct sockaddr_storage *addr, socklen_t *alen)
+{
+    struct sockaddr_in *in = (struct sockaddr_in*)addr;
+    memset(addr, 0, sizeof(*addr));
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)(MEM_NET_PORT0 + id));
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *alen = sizeof(*in);
+}
+
+static void mem_send(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr *to, socklen_t tolen)
+{
+    const mem_ep_t *ep = (const mem_ep_t*)ctx;
+    mem_net_t *net = ep->net;
+    const struct sockaddr_in *in = (const struct sockaddr_in*)to;
+    int dst = (int)ntohs(in->sin_port) - MEM_NET_PORT0;
+    (void)tolen;
+
+    net->st.sent++;
+    if (dst < 0 || dst >= MEM_NET_MAX_EP || len > MAX_MESS_LEN) { net->st.lost++; return; }
+    // 与 sendto_dbg 一样按百分比随机丢
+    if (net->loss > 0 && (int)(rand_r(&net->seed) % 100) < net->loss) { net->st.lost++; return; }
+    if (net->count == net->cap) { net->st.overflow++; return; }
+
+    mem_pkt_t *p = &net->q[(net->head + net->count) % net->cap];
+    p->due_us = net->now_us + net->delay_us;
+    p->src = ep->id;
+    p->dst = dst;
+    p->len = (uint32_t)len;
+    memcpy(p->data, buf, len);
+    net->count++;
+}
+
+mem_net_t *mem_net_new(int loss_percent, unsigned seed, uint64_t delay_us, size_t cap)
+{
+    if (cap == 0) return NULL;
+    mem_net_t *net = (mem_net_t*)calloc(1, sizeof(*net));
+    if (!net) return NULL;
+    net->q = (mem_pkt_t*)malloc(cap * sizeof(mem_pkt_t));
+    if (!net->q) { free(net); return NULL; }
+    net->cap = cap;
+    net->loss = loss_percent;
+    net->seed = seed;
+    net->delay_us = delay_us;
+    for (int i = 0; i < MEM_NET_MAX_EP; ++i) {
+        net->ep[i].net = net;
+        net->ep[i].id = i;
+    }
+    return net;
+}
+
+void mem_net_free(mem_net_t *net)
+{
+    if (!net) return;
+    free(net->q);
+    free(net);
+}
+
+ncp_transport_t mem_net_transport(mem_net_t *net, int id)
+{
+    ncp_transport_t tp = { &net->ep[id], mem_send };
+    return tp;
+}
+
+void mem_net_set_time(mem_net_t *net, uint64_t now_us)
+{
+    net->now_us = now_us;
+}
+
+int mem_net_pop(mem_net_t *net, uint64_t now_us, uint8_t *buf, size_t *len,
+                struct sockaddr_storage *from, socklen_t *flen)
+{
+    if (net->count == 0) return -1;
+    const mem_pkt_t *p = &net->q[net->head];
+    if (p->due_us > now_us) return -1;
+    memcpy(buf, p->data, p->len);
+    *len = p->len;
+    mem_net_addr(p->src, from, flen);
+    int dst = p->dst;
+    net->head = (net->head + 1) % net->cap;
+    net->count--;
+    net->st.delivered++;
+    return dst;
+}
+
+uint64_t mem_net_next_due(const mem_net_t *net)
+{
+    return net->count ? net->q[net->head].due_us : 0;
+}
+
+void mem_net_stats(const mem_net_t *net, mem_net_stats_t *st)
+{
+    *st = net->st;
+}
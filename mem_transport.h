@@ -0,0 +1,50 @@
+#ifndef CS2520_MEM_TRANSPORT
+#define CS2520_MEM_TRANSPORT
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "libncp.h"
+
+/*
+ * 内存里的有损网络：给 libncp 两端对接用（ncp_bench），不经过内核。
+ *
+ * 每个端点有一个编号 id，对外地址是 127.0.0.1:(MEM_NET_PORT0 + id)，发包时按目的端口找端点。
+ * 所有报文进一个 FIFO，固定单向时延 delay_us 后才能取出；按 loss% 随机丢包，
+ * 队列满时尾丢。时间由调用方传入（与 libncp 一致，微秒）。
+ */
+
+#define MEM_NET_PORT0   10000
+#define MEM_NET_MAX_EP  (NCP_MAX_PEERS + 1)
+
+typedef struct mem_net mem_net_t;
+
+typedef struct {
+    uint64_t sent;                  // 交给网络的报文数
+    uint64_t lost;                  // 随机丢掉的
+    uint64_t overflow;              // 队列满被尾丢的
+    uint64_t delivered;
+} mem_net_stats_t;
+
+// cap：队列最多容纳的报文数
+mem_net_t *mem_net_new(int loss_percent, unsigned seed, uint64_t delay_us, size_t cap);
+void mem_net_free(mem_net_t *net);
+
+// 端点 id 的地址与发送接口（ctx 指向网络内部，随网络一起释放）
+void mem_net_addr(int id, struct sockaddr_storage *addr, socklen_t *alen);
+ncp_transport_t mem_net_transport(mem_net_t *net, int id);
+
+// 设定下一批 send 的时间戳（调用 libncp 入口前设成同一个 now）
+void mem_net_set_time(mem_net_t *net, uint64_t now_us);
+
+// 取出一个到期（发出时间 + delay <= now）的报文：返回目的端点 id，没有则返回 -1。
+// buf 至少 MAX_MESS_LEN 字节
+int mem_net_pop(mem_net_t *net, uint64_t now_us, uint8_t *buf, size_t *len,
+                struct sockaddr_storage *from, socklen_t *flen);
+
+// 队头报文的到期时间，队列空返回 0
+uint64_t mem_net_next_due(const mem_net_t *net);
+
+void mem_net_stats(const mem_net_t *net, mem_net_stats_t *st);
+
+#endif
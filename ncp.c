@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,76 +6,134 @@
 
 #include "sendto_dbg.h"
 #include "net_include.h"
+#include "cc.h"
+#include "libncp.h"
+#include "prof.h"
+#include "trace.h"
+#include "snd_pipe.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>     // ← 这里提供 struct addrinfo, getaddrinfo
 #include <arpa/inet.h> // ← 提供 htons, inet_pton 等
+#include <netinet/in.h>
 #include <unistd.h>  
 #include <sys/stat.h>
-#include <arpa/inet.h>
-#include <sys/types.h>
-#include <netdb.h>
-#include <arpa/inet.h>
-#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
 
 static void Usage(int argc, char *argv[]);
 static void Print_help(void);
 static void die(const char* msg){ perror(msg); exit(1); }
+#define MAX_PEERS NCP_MAX_PEERS   // 扇出接收端上限（补发请求用 64 位位图记录）
+
 /* Global configuration parameters (from command line) */
 static int Loss_rate;
 static int Mode;
-static char *Port_Str;
 static char *Src_filename;
 static char *Dst_filename;
-static char *Hostname;
+static char *Hosts[MAX_PEERS];    // 目标 host:port；逗号分隔多个时扇出
+static char *Ports[MAX_PEERS];
+static int Ntargets;
+static int Zero_rtt;        // -z：START 后不等 START_OK，直接发第一窗数据
+static const cc_ops_t *Cc_ops;  // -c：拥塞控制算法（默认 bbr）
+static int Mcast_count = 1;     // -n：组播扇出时等待的接收端个数
+static uint32_t Window;         // -w：窗口上限（分片数），0 = 按 env（不给 env 时按探测结果）
+static int Profile;             // -P：按阶段统计 CPU 周期 / 指令 / cache miss / 上下文切换，结束时打印
+static char *Trace_file;        // -T：报文事件写进二进制跟踪文件（ncp_trace 解码）
+static int Pipeline;            // -M：发送端拆成预读 / ACK / 发送三个线程（snd_pipe.h）
 
 // 窗口与超时参数（可按 LAN/WAN 调整）
 enum { W_LAN = 512, W_WAN = 2000 };
-static const uint32_t RTO_LAN_MS = 60;
+static const uint32_t RTO_LAN_MS = 60;    // RTO 下限；有 RTT 样本后 RTO = max(下限, srtt + 4*rttvar)
 static const uint32_t RTO_WAN_MS = 200;
 
-typedef struct {
-    uint32_t len;          // 该分片长度
-    uint64_t last_tx_ms;   // 最近一次(重)发时间戳
-    int      acked;        // 是否已被累积 ACK 覆盖
-    long     file_off;     // 源文件偏移（便于重传时重新读取）
-} seg_t;
-// 分片元数据
-
-// 函数原型（声明）
-static void send_one_segment(int s,
-                             const struct sockaddr *to, socklen_t tolen,
-                             FILE* fp, uint32_t seq,
-                             seg_t *segs,               // ← 把 segs 作为参数传入
-                             uint64_t *sent_bytes_counter);
-
 static void run_sender(const char* src,
-                       const char* dst_name,
-                       const char* ip,
-                       const char* port_str);
-                       static void send_one_segment(int s,
-                             const struct sockaddr *to, socklen_t tolen,
-                             FILE* fp, uint32_t seq,
-                             seg_t *segs,
-                             uint64_t *sent_bytes_counter)
+                       const char* dst_name);
+
+// libncp 的传输：UDP socket，经 sendto_dbg 模拟丢包
+static void udp_send(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr *to, socklen_t tolen)
+{
+    prof_enter(PROF_SEND);
+    sendto_dbg(*(int*)ctx, (const char*)buf, (int)len, 0, to, tolen);
+    prof_exit();
+}
+
+// 数据来源：普通文件按偏移回读；流式输入（stdin/管道）非阻塞顺序读
+static ssize_t file_read_at(void *ctx, void *buf, size_t len, uint64_t off)
+{
+    FILE *fp = (FILE*)ctx;
+    prof_enter(PROF_READ);
+    size_t n = fseeko(fp, (off_t)off, SEEK_SET) == 0 ? fread(buf, 1, len, fp) : 0;
+    prof_exit();
+    return n == len ? (ssize_t)n : -1;
+}
+
+// 稀疏文件：SEEK_DATA/SEEK_HOLE 找下一段数据，空洞里的分片不用读
+static int fd_seek_data(int fd, uint64_t off, uint64_t *data, uint64_t *hole)
+{
+    off_t d = lseek(fd, (off_t)off, SEEK_DATA);
+    if (d < 0) {
+        if (errno != ENXIO) return -1;         // 不支持
+        struct stat st;                        // ENXIO：off 之后全是空洞
+        if (fstat(fd, &st) != 0) return -1;
+        *data = *hole = (uint64_t)st.st_size;
+        return 0;
+    }
+    off_t h = lseek(fd, d, SEEK_HOLE);
+    if (h < 0) return -1;
+    *data = (uint64_t)d;
+    *hole = (uint64_t)h;
+    return 0;
+}
+
+static int file_seek_data(void *ctx, uint64_t off, uint64_t *data, uint64_t *hole)
+{
+    return fd_seek_data(fileno((FILE*)ctx), off, data, hole);
+}
+
+static int pipe_seek_data(void *ctx, uint64_t off, uint64_t *data, uint64_t *hole)
+{
+    return fd_seek_data(snd_pipe_fd((snd_pipe_t*)ctx), off, data, hole);
+}
+
+static ssize_t fd_read(void *ctx, void *buf, size_t len)
+{
+    prof_enter(PROF_READ);
+    ssize_t r = read(*(int*)ctx, buf, len);
+    prof_exit();
+    return r;
+}
+
+// 读空 socket：一次就绪把排队的控制包全部交给引擎
+static void sender_drain(int s, ncp_sender_t *sn)
 {
-    hdr_t h = {0};
-    h.type = PKT_DATA;
-    h.seq  = seq;
-    h.len  = segs[seq].len;
-
-    uint8_t frame[sizeof(hdr_t) + MAX_PAYLOAD];
-    memcpy(frame, &h, sizeof(hdr_t));
-
-    // 读该分片数据
-    if (fseek(fp, segs[seq].file_off, SEEK_SET) != 0) die("fseek");
-    size_t n = fread(frame + sizeof(hdr_t), 1, segs[seq].len, fp);
-    if (n != segs[seq].len) die("fread");
-
-    sendto_dbg(s, (const char*)frame, sizeof(hdr_t) + (int)segs[seq].len, 0, to, tolen);
-    segs[seq].last_tx_ms = now_ms();
-    if (sent_bytes_counter) *sent_bytes_counter += segs[seq].len;
+    for (;;) {
+        uint8_t rbuf[MAX_MESS_LEN];
+        struct sockaddr_storage from; socklen_t flen = sizeof(from);
+        prof_enter(PROF_RECV);
+        ssize_t rcvd = recvfrom(s, rbuf, sizeof(rbuf), MSG_DONTWAIT,
+                                (struct sockaddr*)&from, &flen);
+        prof_exit();
+        if (rcvd < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            die("recvfrom");
+        }
+        ncp_sender_on_packet(sn, rbuf, (size_t)rcvd, &from, flen, now_us());
+    }
+}
+
+static void arm_timer(int tfd, uint64_t deadline_us)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));   // 全 0 即解除定时
+    if (deadline_us) {
+        its.it_value.tv_sec  = (time_t)(deadline_us / 1000000);
+        its.it_value.tv_nsec = (long)(deadline_us % 1000000) * 1000L;
+    }
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) die("timerfd_settime");
 }
 
 int main(int argc, char *argv[]) {
@@ -86,62 +145,136 @@ int main(int argc, char *argv[]) {
     printf("\tLoss rate = %d\n", Loss_rate);
     printf("\tSource filename = %s\n", Src_filename);
     printf("\tDestination filename = %s\n", Dst_filename);
-    printf("\tHostname = %s\n", Hostname);
-    printf("\tPort = %s\n", Port_Str);
+    for (int i = 0; i < Ntargets; ++i) {
+        printf("\tHostname = %s\n", Hosts[i]);
+        printf("\tPort = %s\n", Ports[i]);
+    }
     if (Mode == MODE_LAN) {
         printf("\tMode = LAN\n");
-    } else { /*(Mode == WAN)*/
+    } else if (Mode == MODE_WAN) {
         printf("\tMode = WAN\n");
+    } else {
+        printf("\tMode = AUTO (window and RTO from link probing)\n");
     }
+    if (Window) printf("\tWindow = %u segments\n", Window);
+    if (Zero_rtt) printf("\t0-RTT start = on\n");
+    printf("\tCongestion control = %s\n", Cc_ops->name);
+    if (Ntargets > 1) printf("\tFan-out = %d unicast receivers\n", Ntargets);
+    if (Pipeline) printf("\tSender pipeline = reader / ACK / transmit threads\n");
 
 
     // slice
-    run_sender(Src_filename, Dst_filename, Hostname, Port_Str);
+    run_sender(Src_filename, Dst_filename);
 }
 
 /* Read commandline arguments */
 static void Usage(int argc, char *argv[]) {
 
-    if (argc != 5) {
+    int opt;
+    Cc_ops = cc_find("bbr");
+    while ((opt = getopt(argc, argv, "+zc:n:w:PT:M")) != -1) {
+        switch (opt) {
+        case 'z': Zero_rtt = 1; break;
+        case 'P': Profile = 1; break;
+        case 'T': Trace_file = optarg; break;
+        case 'M': Pipeline = 1; break;
+        case 'w':
+            Window = (uint32_t)strtoul(optarg, NULL, 10);
+            if (Window == 0) Print_help();
+            break;
+        case 'n':
+            Mcast_count = atoi(optarg);
+            if (Mcast_count < 1 || Mcast_count > MAX_PEERS) Print_help();
+            break;
+        case 'c':
+            Cc_ops = cc_find(optarg);
+            if (!Cc_ops) {
+                printf("Error: unknown congestion control %s\n", optarg);
+                Print_help();
+            }
+            break;
+        default:  Print_help();
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (Pipeline && Profile) {
+        // 阶段统计是进程里一份、按单线程记的，多线程时没有意义；流水线自己按线程报 CPU 占用
+        printf("Error: -P cannot be combined with -M (the pipeline reports per-thread CPU itself)\n");
         Print_help();
     }
 
-    if (sscanf(argv[1], "%d", &Loss_rate) != 1) {
+    // env 可省略（= AUTO）
+    if (argc != 4 && argc != 5) {
         Print_help();
     }
 
-    if (!strncmp(argv[2], "WAN", 4)) {
-        Mode = MODE_WAN;
-    } else if (!strncmp(argv[2], "LAN", 4)) {
-        Mode = MODE_LAN;
-    } else {
+    if (sscanf(argv[1], "%d", &Loss_rate) != 1) {
         Print_help();
     }
 
-    Src_filename = argv[3];
-    Dst_filename = strtok(argv[4], "@");
-    Hostname = strtok(NULL, ":");
-    if (Hostname == NULL) {
+    Mode = MODE_AUTO;
+    if (argc == 5) {
+        if (!strncmp(argv[2], "WAN", 4)) {
+            Mode = MODE_WAN;
+        } else if (!strncmp(argv[2], "LAN", 4)) {
+            Mode = MODE_LAN;
+        } else if (strncmp(argv[2], "AUTO", 5)) {
+            Print_help();
+        }
+        argc--;
+        argv++;
+    }
+
+    Src_filename = argv[2];
+    Dst_filename = strtok(argv[3], "@");
+    char *list = strtok(NULL, "");
+    if (list == NULL) {
         printf("Error: no hostname provided\n");
         Print_help();
     }
-    Port_Str = strtok(NULL, ":");
-    if (Port_Str == NULL) {
-        printf("Error: no port provided\n");
+    // host:port[,host:port...]
+    char *save = NULL;
+    for (char *t = strtok_r(list, ",", &save); t; t = strtok_r(NULL, ",", &save)) {
+        if (Ntargets == MAX_PEERS) {
+            printf("Error: at most %d receivers\n", MAX_PEERS);
+            Print_help();
+        }
+        char *colon = strrchr(t, ':');
+        if (colon == NULL || colon[1] == '\0') {
+            printf("Error: no port provided\n");
+            Print_help();
+        }
+        *colon = '\0';
+        Hosts[Ntargets] = t;
+        Ports[Ntargets] = colon + 1;
+        Ntargets++;
+    }
+    if (Ntargets == 0) {
+        printf("Error: no hostname provided\n");
         Print_help();
     }
 }
 
 static void Print_help(void) {
-    printf("Usage: ncp <loss_rate_percent> <env> <source_file_name> <dest_file_name>@<ip_addr>:<port>\n");
+    printf("Usage: ncp [-z] [-P | -M] [-T trace_file] [-c bbr|fixed] [-n receivers] [-w window] <loss_rate_percent> [<env>] <source_file_name> <dest_file_name>@<ip_addr>:<port>[,<ip_addr>:<port>...]\n");
+    printf("       env LAN or WAN fixes the window and minimum RTO; AUTO (or no env) probes the link after the handshake\n");
+    printf("       -z  0-RTT start: send the first window with START instead of waiting for START_OK\n");
+    printf("       -P  profile: per-phase time, cycles, instructions, cache misses and context switches (perf_event_open)\n");
+    printf("       -M  pipeline: file reader, ACK processing and transmit run in separate threads (pinned when 3+ CPUs)\n");
+    printf("       -T  write a binary trace of every packet event to trace_file (decode with ncp_trace)\n");
+    printf("       -c  congestion control: bbr (default, paced, model-based) or fixed (window = env size)\n");
+    printf("       -n  fan-out to a multicast group: number of receivers to wait for (default 1)\n");
+    printf("       -w  window limit in segments (default 512 for LAN, 2000 for WAN, probed for AUTO); use 100000+ for 10 Gb/s x 100 ms paths\n");
+    printf("       several comma-separated receivers fan the file out to each of them\n");
+    printf("       source_file_name \"-\" reads from stdin (pipes/FIFOs are streamed, size sent in FIN)\n");
     exit(0);
 }
 
 
 
 //slice
-static void run_sender(const char* src, const char* dst_name,
-                       const char* ip, const char* port_str)
+static void run_sender(const char* src, const char* dst_name)
 {
     
     int s;
@@ -149,265 +282,221 @@ static void run_sender(const char* src, const char* dst_name,
     memset(&hints, 0, sizeof(hints));
     hints.ai_family   = AF_INET;
     hints.ai_socktype = SOCK_DGRAM;
-    if (getaddrinfo(ip, port_str, &hints, &servinfo) != 0) die("getaddrinfo");
+    if (getaddrinfo(Hosts[0], Ports[0], &hints, &servinfo) != 0) die("getaddrinfo");
     s = socket(servinfo->ai_family, servinfo->ai_socktype, 0);
     if (s < 0) die("socket");
 
-    // 打开文件并取大小
-    FILE* fp = fopen(src, "rb");
-    if (!fp) die("fopen");
-    struct stat st; if (stat(src, &st) != 0) die("stat");
-    uint64_t fsz = (uint64_t)st.st_size;
-
-
-    //读文件时顺便记录每个分片元数据 在 run_sender() 内，打开文件、得到 fsz 后，先算分片总数并建表：
-    uint32_t total_segs = (uint32_t)((fsz + MAX_PAYLOAD - 1) / MAX_PAYLOAD);
-    seg_t *segs = (seg_t*)calloc(total_segs, sizeof(seg_t));
-    if (!segs) die("calloc");
+    ncp_sender_cfg_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.dst_name = dst_name;
+    cfg.log      = stdout;
+
+    // 接收端：目标是组播地址 → 组播扇出（接收端由 START_OK 登记）；多个目标 → 单播列表扇出
+    const struct sockaddr_in *to4 = (const struct sockaddr_in*)servinfo->ai_addr;
+    if (IN_MULTICAST(ntohl(to4->sin_addr.s_addr))) {
+        if (Ntargets > 1) {
+            printf("Error: a multicast group must be the only destination\n");
+            exit(1);
+        }
+        memcpy(&cfg.peers[0], servinfo->ai_addr, servinfo->ai_addrlen);
+        cfg.peer_lens[0] = servinfo->ai_addrlen;
+        cfg.npeers = 1;
+        cfg.mcast  = 1;
+        cfg.expect = Mcast_count;
+        unsigned char loop = 1;   // 同机的接收端也要收到（回环测试）
+        if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) die("setsockopt IP_MULTICAST_LOOP");
+    } else {
+        for (int i = 0; i < Ntargets; ++i) {
+            struct addrinfo *ai;
+            if (getaddrinfo(Hosts[i], Ports[i], &hints, &ai) != 0) die("getaddrinfo");
+            memcpy(&cfg.peers[i], ai->ai_addr, ai->ai_addrlen);
+            cfg.peer_lens[i] = ai->ai_addrlen;
+            freeaddrinfo(ai);
+        }
+        cfg.npeers = Ntargets;
+    }
+    int fanout = cfg.mcast || cfg.npeers > 1;
+    if (fanout && Zero_rtt) {
+        printf("0-RTT start is not used when fanning out\n");
+        Zero_rtt = 0;
+    }
+    cfg.zero_rtt = Zero_rtt;
+    cfg.cc       = Cc_ops;
+    // 窗口大小与RTO；env 给出窗口上限和 RTO 下限，实际在途量由拥塞控制决定。
+    // 没有 env 时两者都填 0，由握手后的链路探测来定；env 只是覆盖
+    cfg.window     = Window ? Window : (Mode == MODE_LAN) ? W_LAN : (Mode == MODE_WAN) ? W_WAN : 0;
+    cfg.rto_min_ms = (Mode == MODE_LAN) ? RTO_LAN_MS : (Mode == MODE_WAN) ? RTO_WAN_MS : 0;
+    cfg.probe      = 1;
+
+    // 内核缓冲要装得下一整窗：发送缓冲放 DATA 突发，接收缓冲放每片一个的 ACK。
+    // 窗口待探测时按上限放（只是上限，不预占内存）
+    uint64_t wbytes = (uint64_t)(cfg.window ? cfg.window : NCP_AUTO_WINDOW_MAX) * MAX_MESS_LEN;
+    int sndbuf = sock_buf_size(s, 0, wbytes);
+    int rcvbuf = sock_buf_size(s, 1, wbytes);
+    printf("\tSocket buffers = snd %d KB, rcv %d KB\n", sndbuf / 1024, rcvbuf / 1024);
+    if (cfg.window && (uint64_t)sndbuf < wbytes && wbytes <= SOCK_BUF_MAX) {
+        printf("\t(window needs %lu KB: raise net.core.wmem_max/rmem_max)\n", (unsigned long)(wbytes / 1024));
+    }
 
-    for (uint32_t i = 0; i < total_segs; ++i) {
-        long off = (long)i * MAX_PAYLOAD;
-        uint32_t this_len = (uint32_t)((off + MAX_PAYLOAD <= fsz) ? MAX_PAYLOAD : (fsz - off));
-        segs[i].len = this_len;
-        segs[i].file_off = off;
+    // 打开文件并取大小；"-" 或管道/FIFO 走流式输入（长度未知）
+    FILE* fp = NULL;
+    int stream = 0, in_fd = -1;
+    struct stat st;
+    if (strcmp(src, "-") == 0) {
+        if (fstat(STDIN_FILENO, &st) != 0) die("fstat");
+        if (S_ISREG(st.st_mode)) {          // "< file" 重定向：仍可随机读
+            fp = fdopen(STDIN_FILENO, "rb");
+            if (!fp) die("fdopen");
+        } else {
+            stream = 1;
+            in_fd  = STDIN_FILENO;
+        }
+    } else {
+        if (stat(src, &st) != 0) die("stat");
+        if (S_ISREG(st.st_mode)) {
+            fp = fopen(src, "rb");
+            if (!fp) die("fopen");
+        } else {
+            stream = 1;
+            in_fd  = open(src, O_RDONLY);
+            if (in_fd < 0) die("open");
+        }
+    }
+    int in_flags = 0;
+    ncp_source_t source;
+    memset(&source, 0, sizeof(source));
+    if (stream) {
+        in_flags = fcntl(in_fd, F_GETFL);
+        if (in_flags < 0 || fcntl(in_fd, F_SETFL, in_flags | O_NONBLOCK) < 0) die("fcntl");
+        source.ctx  = &in_fd;
+        source.size = UINT64_MAX;          // 读到 EOF 才确定，总长度在 FIN 里给出
+        source.read = fd_read;
+    } else {
+        source.ctx     = fp;
+        source.size    = (uint64_t)st.st_size;
+        source.read_at = file_read_at;
+        source.seek_data = file_seek_data;
+    }
+    ncp_transport_t tp = { &s, udp_send };
+    snd_pipe_t *pp = NULL;
+    if (Pipeline) {
+        // 引擎的发送进队列、读文件先查预读缓存；socket 由 ACK 线程收，不进 epoll
+        pp = snd_pipe_new(s, stream ? -1 : fileno(fp), stream ? 0 : source.size);
+        if (!pp) die("snd_pipe_new");
+        tp = snd_pipe_transport(pp);
+        if (!stream) {
+            source.ctx       = pp;
+            source.read_at   = snd_pipe_read_at;
+            source.seek_data = pipe_seek_data;
+        }
     }
 
-    // 1) START
-    struct {
-        hdr_t h;
-        char  name[256];   // 简单起见，携带目标文件名（不超 255）
-    } start_pkt;
-    memset(&start_pkt, 0, sizeof(start_pkt));
-    start_pkt.h.type = PKT_START;
-    start_pkt.h.seq  = 0;
-    start_pkt.h.len  = (uint32_t)snprintf(start_pkt.name, sizeof(start_pkt.name), "%s", dst_name);
-    start_pkt.h.file_size = fsz;
-
-    sendto_dbg(s, (char*)&start_pkt, sizeof(hdr_t)+start_pkt.h.len, 0,
-               servinfo->ai_addr, servinfo->ai_addrlen);
-
-    // 窗口大小与RTO
-    uint32_t W   = (Mode == MODE_LAN) ? W_LAN : W_WAN;
-    uint32_t RTO = (Mode == MODE_LAN) ? RTO_LAN_MS : RTO_WAN_MS;
-
-    uint32_t send_base = 0;      // 最早未确认的分片号
-    uint32_t next_seq  = 0;      // 下一个可发分片号
-    uint64_t total_sent_bytes = 0; // 包含重传的计数(用于报告)
-
-    fd_set rfds;
-    struct timeval tv;
-    int nfds = 0;
-
-    // 把 socket 记下（用于 select）
-    if (servinfo->ai_family == AF_INET || servinfo->ai_family == AF_INET6) {
-        nfds = s + 1;
+    // 事件循环：socket 可读 + timerfd（下一个 RTO / START 重发 / pacing 时刻）
+    int ep  = epoll_create1(0);
+    if (ep < 0) die("epoll_create1");
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (tfd < 0) die("timerfd_create");
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    int efd = pp ? snd_pipe_event_fd(pp) : s;   // 流水线：ACK 线程处理完一批写 eventfd
+    ev.events = EPOLLIN; ev.data.fd = efd;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev) < 0) die("epoll_ctl");
+    ev.events = EPOLLIN; ev.data.fd = tfd;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev) < 0) die("epoll_ctl");
+    int in_watched = 0;
+    if (stream) {
+        ev.events = 0; ev.data.fd = in_fd;   // 先不关心，数据阶段窗口有空位再打开
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, in_fd, &ev) < 0) die("epoll_ctl stdin");
     }
+
+    if (Profile) prof_init();
+    if (Trace_file && trace_open(Trace_file, 'S') < 0) die("trace_open");
+
     // >>> 在这里记录发送起始时间 <<<
     uint64_t snd_start_ms = now_ms();
 
-    /* ---- Handshake: wait START_OK or BUSY (queue if busy) ---- */
-    int start_ok = 0;
-    uint32_t backoff_ms = 100;            // 初始退避
-    const uint32_t backoff_max = 2000;    // 最大退避 2s
-    uint64_t last_start_tx = 0;
-    /* 新增：记录本次 START 的发送时间，供超时重发用 */
-    last_start_tx = now_ms();
-        
-    for (;;) {
-        // 等待接收端响应（START_OK / BUSY），最多 300ms
-        fd_set hs_rfds; FD_ZERO(&hs_rfds); FD_SET(s, &hs_rfds);
-        struct timeval hs_tv = {.tv_sec=0, .tv_usec=300*1000};
-        int hs_rv = select(s+1, &hs_rfds, NULL, NULL, &hs_tv);
-        if (hs_rv > 0 && FD_ISSET(s, &hs_rfds)) {
-            uint8_t rbuf[sizeof(hdr_t) + 64];
-            struct sockaddr_storage from; socklen_t flen = sizeof(from);
-            ssize_t rcvd = recvfrom(s, rbuf, sizeof(rbuf), 0, (struct sockaddr*)&from, &flen);
-            if (rcvd >= (ssize_t)sizeof(hdr_t)) {
-                hdr_t *rh = (hdr_t*)rbuf;
-                if (rh->type == PKT_START_OK) {    // 接收端就绪
-                    start_ok = 1;
-                    break;
-                } else if (rh->type == PKT_BUSY) { // 排队：指数退避 + 重发 START
-                    // 等 backoff
-                    usleep(backoff_ms * 1000);
-                    // 重发 START（复用你已有的 START 发送逻辑/缓冲）
-                    // 如果你有封装函数，直接调用；否则把你发 START 的两行黏贴到这里
-                    // 例：sendto_dbg(s, (char*)&start_pkt, sizeof(hdr_t)+start_pkt.h.len, 0, servinfo->ai_addr, servinfo->ai_addrlen);
-                    sendto_dbg(s, (char*)&start_pkt, sizeof(hdr_t)+start_pkt.h.len, 0,
-                            servinfo->ai_addr, servinfo->ai_addrlen);
-                    // 指数退避（上限 2s）
-                    backoff_ms = (backoff_ms < backoff_max) ? (backoff_ms * 2) : backoff_max;
-                    last_start_tx = now_ms();
-                    continue; // 继续排队
-                }
-            }
-        } else {
-       // 超时：保活重发 START（不放行，继续排队等待 START_OK）
-               // 超时：保活重发 START（不放行，继续排队等待 START_OK）
-            if (now_ms() - last_start_tx > 500) {
-            sendto_dbg(s, (char*)&start_pkt, sizeof(hdr_t)+start_pkt.h.len, 0,
-                        servinfo->ai_addr, servinfo->ai_addrlen);
-                last_start_tx = now_ms();
-            }
-            continue;
-        }
+    // 发出 START（0-RTT 时紧跟着第一窗数据）
+    ncp_sender_t *sn = ncp_sender_new(&cfg, &tp, &source, now_us());
+    if (!sn) die("ncp_sender_new");
+    if (pp) {
+        snd_pipe_transmit(pp);
+        snd_pipe_start(pp, sn);
     }
-    
-    while (send_base < total_segs) {
- 
 
-        // 1) 尽量填满窗口
-        while (next_seq < total_segs && next_seq < send_base + W) {
-            if (!segs[next_seq].acked) {
-                send_one_segment(s, servinfo->ai_addr, servinfo->ai_addrlen, fp, next_seq, segs,&total_sent_bytes);
-            }
-            next_seq++;
+    for (;;) {
+        // 流水线时 ACK 线程也在调引擎：引擎调用都在锁里，发送在锁外
+        if (pp) snd_pipe_lock(pp);
+        uint64_t now = now_us();
+        ncp_sender_on_timer(sn, now);
+        int running = ncp_sender_state(sn) == NCP_RUNNING;
+        int wants = stream && ncp_sender_wants_input(sn, now);
+        uint64_t deadline = ncp_sender_next_deadline(sn, now);
+        if (pp) {
+            snd_pipe_unlock(pp);
+            snd_pipe_transmit(pp);
         }
+        if (!running) break;
 
-        // 2) 等待 ACK（带超时，用于定时器）
-        FD_ZERO(&rfds);
-        FD_SET(s, &rfds);
-        tv.tv_sec  = 0;
-        tv.tv_usec = 10000; // 10ms tick
-        int rv = select(nfds, &rfds, NULL, NULL, &tv);
-
-        uint64_t now = now_ms();
-
-        if (rv > 0 && FD_ISSET(s, &rfds)) {
-            // 收包（ACK 或其他控制）
-            uint8_t rbuf[sizeof(hdr_t) + 64];
-            struct sockaddr_storage from; socklen_t flen = sizeof(from);
-            ssize_t rcvd = recvfrom(s, rbuf, sizeof(rbuf), 0, (struct sockaddr*)&from, &flen);
-            if (rcvd >= (ssize_t)sizeof(hdr_t)) {
-                hdr_t *rh = (hdr_t*)rbuf;
-                if (rh->type == PKT_ACK) {
-                    // 累积 ACK：确认 [send_base .. rh->seq]
-                    if (rh->seq + 1 > send_base) {
-                        uint32_t old_base = send_base;
-                        send_base = rh->seq + 1;
-                        for (uint32_t i = old_base; i < send_base && i < total_segs; ++i) {
-                            segs[i].acked = 1;
-                        }
-                    }
-                }else if (rh->type == PKT_NACK) {
-                        uint32_t want = rh->seq;  // 接收端告诉我们缺这个分片
-                        if (want < total_segs && !segs[want].acked) {
-                            // 立即重传这个分片
-                            send_one_segment(s, servinfo->ai_addr, servinfo->ai_addrlen,
-                                            fp, want, segs, &total_sent_bytes);
-                            // 可选：记录一下 NACK 命中次数/日志
-                            // printf("[SND] NACK->rexmit %u\n", want);
-                        }
-                    }else if (rh->type == PKT_BUSY) {
-                        // 接收端忙，说明它正服务别人——我也得排队
-                            // 正在服务别人 → 暂停发送，进入排队：退避 + 重发 START，直到放行
-                        uint32_t backoff_ms2 = 100;
-                        const uint32_t backoff_max2 = 2000;
-                        for (;;) {
-                            usleep(backoff_ms2 * 1000);
-                            // 重发 START（同上）
-                            sendto_dbg(s, (char*)&start_pkt, sizeof(hdr_t)+start_pkt.h.len, 0,
-                                    servinfo->ai_addr, servinfo->ai_addrlen);
-
-                            // 等一小会看看是否仍 BUSY 或已就绪
-                            fd_set q_rfds; FD_ZERO(&q_rfds); FD_SET(s, &q_rfds);
-                            struct timeval q_tv = {.tv_sec=0, .tv_usec=300*1000};
-                            int q_rv = select(s+1, &q_rfds, NULL, NULL, &q_tv);
-                            if (q_rv > 0 && FD_ISSET(s, &q_rfds)) {
-                                uint8_t qbuf[sizeof(hdr_t) + 64];
-                                struct sockaddr_storage qfrom; socklen_t qlen = sizeof(qfrom);
-                                ssize_t qn = recvfrom(s, qbuf, sizeof(qbuf), 0, (struct sockaddr*)&qfrom, &qlen);
-                                if (qn >= (ssize_t)sizeof(hdr_t)) {
-                                    hdr_t *qh = (hdr_t*)qbuf;
-                                    if (qh->type == PKT_START_OK) {
-                                        // 放行，退出排队循环，继续数据阶段
-                                        break;
-                                    } else if (qh->type == PKT_BUSY) {
-                                        // 继续排队（指数退避）
-                                        backoff_ms2 = (backoff_ms2 < backoff_max2) ? (backoff_ms2 * 2) : backoff_max2;
-                                        continue;
-                                    }
-                                }
-                            } else {
-                                // 没有响应：也视为放行（兼容 rcv 不发 START_OK 的情况）
-                                break;
-                            }
-                        }
-
-                            printf("[SND] Receiver is busy, I was blocked.\n");
-                            // 可以选择重试，或者直接退出
-                        }
-
-                // （后续可处理 BUSY/START_OK/NACK 等）
-            }
+        if (stream && wants != in_watched) {
+            in_watched = !in_watched;
+            ev.events = in_watched ? EPOLLIN : 0; ev.data.fd = in_fd;
+            if (epoll_ctl(ep, EPOLL_CTL_MOD, in_fd, &ev) < 0) die("epoll_ctl stdin");
         }
-
-        // 3) 超时重传（Selective Repeat：对窗口内未确认的分片检查 RTO）
-        for (uint32_t i = send_base; i < next_seq; ++i) {
-            if (!segs[i].acked) {
-                if (now - segs[i].last_tx_ms > RTO) {
-                    send_one_segment(s, servinfo->ai_addr, servinfo->ai_addrlen, fp, i, segs,&total_sent_bytes);
-                }
+        arm_timer(tfd, deadline);
+        struct epoll_event evs[3];
+        prof_enter(PROF_WAIT);
+        int nev = epoll_wait(ep, evs, 3, -1);
+        prof_exit();
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            die("epoll_wait");
+        }
+        for (int i = 0; i < nev; ++i) {
+            if (evs[i].data.fd == efd && pp) {
+                uint64_t batches;
+                if (read(efd, &batches, sizeof(batches)) < 0 && errno != EAGAIN) die("read eventfd");
+            } else if (evs[i].data.fd == s) {
+                sender_drain(s, sn);
+            } else if (evs[i].data.fd == tfd) {
+                uint64_t expirations;
+                if (read(tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) die("read timerfd");
             }
         }
     }
-    //    在这里记录结束时间
+    //    在这里记录结束时间（接收端已用 FIN_ACK 确认收齐）
     uint64_t snd_end_ms = now_ms();
-    // 窗口内全确认 → 发 FIN
-
-
-
-    // // 2) 循环 DATA
-
-    // while ((n = fread(buf, 1, MAX_PAYLOAD, fp)) > 0) {
-    //     h.len = (uint32_t)n;
-
-    //     // 组帧：头+负载
-    //     uint8_t frame[sizeof(hdr_t) + MAX_PAYLOAD];
-    //     memcpy(frame, &h, sizeof(hdr_t));
-    //     memcpy(frame + sizeof(hdr_t), buf, n);
-
-    //     // 发送（注意必须用 sendto_dbg）
-    //     sendto_dbg(s, (const char*)frame, sizeof(hdr_t) + (int)n, 0,
-    //                servinfo->ai_addr, servinfo->ai_addrlen);
-
-    //     h.seq++; // 下一片序号
-    // }
-
-    // 3) FIN
-    uint8_t  buf[MAX_PAYLOAD];
-    hdr_t    h;
-    memset(&h, 0, sizeof(h));
-    h.type = PKT_DATA;
-    h.seq  = 0;
-    h.file_size = fsz;
-
-    size_t n;
-    hdr_t fin = {0};
-    fin.type = PKT_FIN;
-    fin.seq  = (total_segs > 0) ? (total_segs - 1) : 0;
-    fin.len  = 0;
-    fin.file_size = fsz;
-
-    sendto_dbg(s, (const char*)&fin, sizeof(fin), 0,
-               servinfo->ai_addr, servinfo->ai_addrlen);
-
-    //发完 FIN 后打印统计
-    double snd_elapsed_s = (snd_end_ms - snd_start_ms) / 1000.0;
-    double over_wire_MB  = total_sent_bytes / (1024.0*1024.0);
-    double over_wire_mbps = (total_sent_bytes * 8.0) / (snd_elapsed_s * 1e6);
-
-    // 若你有文件大小 fsz，可计算冗余度（含重传的发送量 / 实际文件大小）
-    double redundancy = (fsz > 0) ? ((double)total_sent_bytes / (double)fsz) : 0.0;
-
-    printf("[SND] SENT(total incl. retrans): %.2f MB in %.2f s, avg send rate: %.2f Mb/s\n",
-        over_wire_MB, snd_elapsed_s, over_wire_mbps);
-    printf("[SND] Redundancy (bytes_sent/file_size): %.2fx\n", redundancy);
+    if (pp) snd_pipe_stop(pp);
+    close(tfd);
+    close(ep);
+    uint64_t trace_lost = trace_close();
+    if (trace_lost > 0) printf("[SND] Trace: %lu records dropped (ring full)\n", (unsigned long)trace_lost);
+    if (ncp_sender_state(sn) == NCP_FAILED) {
+        fprintf(stderr, "ncp: %s\n", ncp_sender_error(sn));
+        exit(1);
+    }
+    ncp_snd_stats_t ss;
+    ncp_sender_stats(sn, &ss);
+    uint64_t fsz = ss.file_size;
+
+    //FIN 被确认后打印统计
+    ncp_sender_report(sn, stdout, (snd_end_ms - snd_start_ms) / 1000.0);
+    prof_report(stdout, "SND");
+    if (pp) snd_pipe_report(pp, stdout, (snd_end_ms - snd_start_ms) / 1000.0);
     fflush(stdout);
 
 
-    fclose(fp);
+    ncp_sender_free(sn);
+    snd_pipe_free(pp);
+    if (fp) fclose(fp);
+    if (stream) {
+        fcntl(in_fd, F_SETFL, in_flags);
+        if (in_fd != STDIN_FILENO) close(in_fd);
+    }
     freeaddrinfo(servinfo);
     close(s);
-    printf("Sender done: %s (%lu bytes) → %s:%s\n", src, (unsigned long)fsz, ip, port_str);
+    if (fanout) {
+        printf("Sender done: %s (%lu bytes) → %d receivers\n", src, (unsigned long)fsz, ss.npeers);
+    } else {
+        printf("Sender done: %s (%lu bytes) → %s:%s\n", src, (unsigned long)fsz, Hosts[0], Ports[0]);
+    }
 }
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_include.h"
+#include "libncp.h"
+#include "mem_transport.h"
+#include "cc.h"
+#include "prof.h"
+
+#include <unistd.h>
+
+/*
+ * ncp_bench：libncp 两端经内存有损网络对接，在一个循环里跑完一次传输，
+ * 测协议本身每个报文花多少 CPU（没有系统调用、没有磁盘）。
+ * 时间是虚拟的：网络空闲时直接跳到下一个定时器/到期时刻。
+ */
+
+static void Usage(int argc, char *argv[]);
+static void Print_help(void);
+static void die(const char* msg){ perror(msg); exit(1); }
+
+static int      Loss_rate;
+static uint64_t Size_bytes  = 100ULL * 1024 * 1024;
+static uint32_t Window      = 2000;
+static uint64_t Delay_us    = 100;      // 单向时延
+static size_t   Queue_cap   = 4096;
+static unsigned Seed        = 1;
+static const cc_ops_t *Cc_ops;
+static int      Verbose;
+static int      Auto;                   // -a：先探测链路，窗口（发送端）和 RTO 下限由探测定
+static int      Profile;                // -P：两端引擎按阶段统计（同一线程，合在一份报告里）
+
+#define PATTERN_LEN (64 * 1024)
+static uint8_t Pattern[PATTERN_LEN + MAX_PAYLOAD];
+
+// 数据来源：内存里循环的图样，不碰磁盘
+static ssize_t pattern_read_at(void *ctx, void *buf, size_t len, uint64_t off)
+{
+    (void)ctx;
+    memcpy(buf, Pattern + off % PATTERN_LEN, len);
+    return (ssize_t)len;
+}
+
+// sink：只计数
+static uint64_t Sink_bytes;
+static int      Sink_complete;
+
+static void *count_open(void *ctx, const char *name, uint64_t size)
+{
+    (void)name; (void)size;
+    Sink_bytes = 0;
+    return ctx;
+}
+
+static int count_write(void *session, const void *buf, size_t len)
+{
+    (void)session; (void)buf;
+    Sink_bytes += len;
+    return 0;
+}
+
+static void count_close(void *session, int complete)
+{
+    (void)session;
+    Sink_complete = complete;
+}
+
+static uint64_t cpu_ns(void)
+{
+    struct timespec ts; clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t min_deadline(uint64_t a, uint64_t b)
+{
+    if (a == 0) return b;
+    if (b == 0) return a;
+    return a < b ? a : b;
+}
+
+int main(int argc, char *argv[])
+{
+    Usage(argc, argv);
+    for (size_t i = 0; i < sizeof(Pattern); ++i) Pattern[i] = (uint8_t)(i * 131 + 7);
+
+    mem_net_t *net = mem_net_new(Loss_rate, Seed, Delay_us, Queue_cap);
+    if (!net) die("mem_net_new");
+    FILE *log = Verbose ? stdout : NULL;
+
+    // 端点 0 = 发送端，1 = 接收端
+    ncp_transport_t snd_tp = mem_net_transport(net, 0);
+    ncp_transport_t rcv_tp = mem_net_transport(net, 1);
+    ncp_receiver_cfg_t rcfg = { log, Window };
+    ncp_sink_t sink = { &Sink_bytes, count_open, count_write, count_close };
+    ncp_receiver_t *rv = ncp_receiver_new(&rcfg, &rcv_tp, &sink);
+    if (!rv) die("ncp_receiver_new");
+
+    ncp_sender_cfg_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.dst_name   = "bench.out";
+    cfg.window     = Auto ? 0 : Window;
+    // RTO 下限同 ncp 的 LAN，但要高于往返时延：否则还没有 RTT 样本时整窗都会被误判超时
+    cfg.rto_min_ms = Delay_us * 4 / 1000 > 60 ? (uint32_t)(Delay_us * 4 / 1000) : 60;
+    if (Auto) cfg.rto_min_ms = 0;
+    cfg.probe      = Auto;
+    cfg.cc         = Cc_ops;
+    cfg.npeers     = 1;
+    cfg.log        = log;
+    mem_net_addr(1, &cfg.peers[0], &cfg.peer_lens[0]);
+    ncp_source_t src = { NULL, Size_bytes, pattern_read_at, NULL };
+
+    uint64_t start_us = 1000000, now = start_us;   // 虚拟时钟；0 在 libncp 里表示“无定时”
+    if (Profile) prof_init();
+    uint64_t cpu0 = cpu_ns();
+    mem_net_set_time(net, now);
+    ncp_sender_t *sn = ncp_sender_new(&cfg, &snd_tp, &src, now);
+    if (!sn) die("ncp_sender_new");
+
+    uint8_t buf[MAX_MESS_LEN];
+    int stuck = 0;
+    for (;;) {
+        mem_net_set_time(net, now);
+        ncp_sender_on_timer(sn, now);
+        ncp_receiver_on_timer(rv, now);
+        if (ncp_sender_state(sn) != NCP_RUNNING) break;
+
+        int moved = 0;
+        size_t len;
+        struct sockaddr_storage from; socklen_t flen;
+        int dst;
+        while ((dst = mem_net_pop(net, now, buf, &len, &from, &flen)) >= 0) {
+            if (dst == 0) ncp_sender_on_packet(sn, buf, len, &from, flen, now);
+            else          ncp_receiver_on_packet(rv, buf, len, &from, flen, now);
+            moved = 1;
+        }
+        if (moved) continue;
+
+        // 网络里没有到期的包：跳到最近的事件
+        uint64_t next = min_deadline(ncp_sender_next_deadline(sn, now), mem_net_next_due(net));
+        next = min_deadline(next, ncp_receiver_next_deadline(rv));
+        if (next == 0) { stuck = 1; break; }
+        now = next > now ? next : now + 1;   // 已到期却没有进展时也要让时间前进
+    }
+    uint64_t cpu = cpu_ns() - cpu0;
+
+    if (stuck || ncp_sender_state(sn) == NCP_FAILED) {
+        fprintf(stderr, "ncp_bench: transfer did not finish: %s\n",
+                stuck ? "no pending events" : ncp_sender_error(sn));
+        exit(1);
+    }
+    ncp_snd_stats_t ss;
+    mem_net_stats_t ns;
+    ncp_sender_stats(sn, &ss);
+    mem_net_stats(net, &ns);
+    double vt_s = (now - start_us) / 1e6;
+    printf("[BENCH] %lu packets (%lu lost, %lu overflow) in %.3f s CPU: %.0f ns/packet, %.2f Mpkt/s\n",
+           (unsigned long)ns.sent, (unsigned long)ns.lost, (unsigned long)ns.overflow,
+           cpu / 1e9, (double)cpu / (double)(ns.sent ? ns.sent : 1),
+           ns.sent * 1e3 / (double)(cpu ? cpu : 1));
+    printf("[BENCH] payload %.2f MB, redundancy %.2fx, virtual time %.3f s (%.2f Mb/s)\n",
+           Size_bytes / (1024.0 * 1024.0), Size_bytes ? (double)ss.bytes_sent / (double)Size_bytes : 0.0,
+           vt_s, vt_s > 0 ? Size_bytes * 8.0 / vt_s / 1e6 : 0.0);
+    printf("[BENCH] retransmits: nack %lu, rack %lu, dupack %lu, tlp %lu, rto %lu; loss detected after %.3f ms\n",
+           (unsigned long)ss.retx_nack, (unsigned long)ss.retx_rack, (unsigned long)ss.retx_fast,
+           (unsigned long)ss.retx_tlp, (unsigned long)ss.retx_rto, ss.detect_us / 1000.0);
+    prof_report(stdout, "BENCH");
+    printf("[BENCH] receiver got %lu bytes%s\n", (unsigned long)Sink_bytes,
+           Sink_bytes == Size_bytes ? "" : " (INCOMPLETE)");
+
+    ncp_sender_free(sn);
+    ncp_receiver_free(rv);
+    mem_net_free(net);
+    return Sink_bytes == Size_bytes ? 0 : 1;
+}
+
+/* Read commandline arguments */
+static void Usage(int argc, char *argv[])
+{
+    int opt;
+    Cc_ops = cc_find("bbr");
+    while ((opt = getopt(argc, argv, "l:s:w:d:q:r:c:vaP")) != -1) {
+        switch (opt) {
+        case 'l': Loss_rate = atoi(optarg); if (Loss_rate < 0 || Loss_rate > 100) Print_help(); break;
+        case 's': Size_bytes = strtoull(optarg, NULL, 10) * 1024 * 1024; break;
+        case 'w': Window = (uint32_t)atoi(optarg); if (Window == 0) Print_help(); break;
+        case 'd': Delay_us = strtoull(optarg, NULL, 10); break;
+        case 'q': Queue_cap = (size_t)atoi(optarg); if (Queue_cap == 0) Print_help(); break;
+        case 'r': Seed = (unsigned)atoi(optarg); break;
+        case 'c':
+            Cc_ops = cc_find(optarg);
+            if (!Cc_ops) {
+                printf("Error: unknown congestion control %s\n", optarg);
+                Print_help();
+            }
+            break;
+        case 'v': Verbose = 1; break;
+        case 'a': Auto = 1; break;
+        case 'P': Profile = 1; break;
+        default:  Print_help();
+        }
+    }
+    if (optind != argc) Print_help();
+}
+
+static void Print_help(void)
+{
+    printf("Usage: ncp_bench [-l loss%%] [-s MB] [-w window] [-d one_way_delay_us] [-q queue_pkts] [-r seed] [-c bbr|fixed] [-a] [-P] [-v]\n");
+    printf("       -P  per-phase profile of both engines (perf_event_open counters)\n");
+    printf("       -a  probe the link first; the probe picks the sender window and RTO (-w then sets the receiver window only)\n");
+    printf("       runs one ncp transfer through an in-memory lossy network and reports protocol CPU per packet\n");
+    exit(0);
+}
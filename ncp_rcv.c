@@ -0,0 +1,813 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_include.h"
+#include "wire.h"
+#include "libncp.h"
+#include "prof.h"
+#include "trace.h"
+
+#include <arpa/inet.h>
+
+// 接收端状态机（libncp）：会话、准入队列、0-RTT 早到数据、按序写出与 ACK/NACK
+
+// 乱序分片的负载缓冲：按块从堆上要，按需增长，用完挂回空闲链表
+typedef union pbuf {
+    union pbuf *next;
+    uint8_t     data[MAX_PAYLOAD];
+} pbuf_t;
+
+#define POOL_CHUNK 256     // 每次增长的缓冲个数
+typedef struct pchunk {
+    struct pchunk *next;
+    pbuf_t         bufs[POOL_CHUNK];
+} pchunk_t;
+
+// 接收窗口：环形表，seq 放在 buf[seq % W]，只记元数据；
+// 按序到达的分片直接写出，只有洞后面的乱序分片才借缓冲
+typedef struct {
+    uint8_t  present;      // 是否已收到
+    uint8_t  zero;         // 由 ZERO 收到：全零，没有 data
+    uint32_t len;          // 该分片长度
+    pbuf_t  *data;
+} slot_t;
+#define TEN_MB (10u * 1024u * 1024u)
+
+#define LOG(rv, ...) do { if ((rv)->log) fprintf((rv)->log, __VA_ARGS__); } while (0)
+
+static const uint64_t SESSION_IDLE_TIMEOUT_MS = 5000; // 5s，可按需调
+static const uint64_t NACK_GAP_MS = 50;               // NACK最小间隔
+
+// 本端支持的能力位；START_OK 回 (对端 caps & RCV_CAPS)
+#define RCV_CAPS (CAP_STREAM | CAP_EARLY_DATA | CAP_ZERO | CAP_FIN_ACK | CAP_PROBE)
+
+// 准入队列：接收端忙时按 FIFO 记下等待的 sender，当前会话一结束就主动推 START_OK
+#define ADMIT_QUEUE_MAX 64
+static const uint64_t QUEUE_STALE_MS = 2000;          // 排队者 2s 没有保活 START 就视为已离开
+
+// 探测包串末尾几个丢了时，最后一个到达后等这么久（再加串已展开时长的两倍）就报告
+static const uint64_t PROBE_HOLD_US = 5000;
+
+typedef struct {
+    struct sockaddr_storage peer;
+    socklen_t plen;
+    char      name[256];          // 它 START 里的目标文件名
+    uint64_t  file_size;
+    uint16_t  caps;
+    uint64_t  last_seen_ms;       // 最近一次收到它的 START
+} waiter_t;
+
+struct ncp_receiver {
+    ncp_transport_t tp;          // 回复走这里（rcv 组播时是单独的单播 socket）
+    ncp_sink_t sink;
+    FILE    *log;
+    uint64_t now_ms;              // 当前入口传进来的时间
+    uint64_t now_us;
+    ncp_rcv_stats_t stats;
+    slot_t  *buf;                 // 接收窗口：W 个槽位
+    uint32_t W;
+    pbuf_t  *free_bufs;           // 负载缓冲池
+    pchunk_t *chunks;
+    uint64_t pool_bufs;           // 池里缓冲总数（只增不减，会话间复用）
+
+    // 当前会话
+    int      busy;                // 当前是否在接收一个会话
+    struct sockaddr_storage cur_peer;
+    socklen_t cur_plen;
+    void    *out;                 // sink 的会话句柄
+    char     dst_name[256];
+    uint64_t file_size;
+    uint16_t caps;                // 本会话协商出的能力位
+    uint64_t next_write_seq;      // 64 位，线上序号按它还原
+    uint64_t high_seq;            // 收到过的最大分片号 + 1（> next_write_seq 说明有洞）
+    uint64_t run_lo;              // 最上面一段连续区间的起点：[max(run_lo, next_write_seq), high_seq) 都在缓冲里
+    uint64_t bytes_in_order;
+    uint32_t adv_wnd;             // 上次通告的窗口（sink 积压消化后据此决定要不要主动发窗口更新）
+    int      fin_seen;            // 收到 FIN
+    uint64_t fin_seq;             // 最后一个分片号（来自 FIN）
+    uint64_t last_activity_ms;    // 会话活跃时间（用于超时清理）
+    uint64_t last_nack_ms;        // 上次发NACK时间（节流）
+    //Statistics
+    uint64_t start_ms;            // 本次会话开始时间（收到 START 后）
+    uint64_t last_mark_ms;        // 上一个 10MB 报告时间
+    uint64_t last_mark_bytes;     // 上一个 10MB 报告时的有序字节数
+
+    // 链路探测：正在收的 PROBE 串（报告后关闭）
+    int      train_open;
+    uint32_t train_id;
+    uint16_t train_got, train_first, train_last;
+    uint64_t train_first_us, train_last_us;
+
+    // 0-RTT：空闲时先于 START 到达的数据，记下来自哪个 peer，START 解析后接着用
+    struct sockaddr_storage early_peer;
+    socklen_t early_plen;
+    uint64_t  early_ms;           // 0 = 没有缓存的早到数据
+
+    // 上一个完成的会话：它的 FIN_ACK 丢了会重发 FIN，凭这里再答一次（接收端可能已在服务别人）
+    struct sockaddr_storage done_peer;
+    socklen_t done_plen;          // 0 = 没有
+    uint32_t  done_seq;           // 它 FIN 里的 seq
+    uint64_t  done_bytes;
+    uint32_t  done_ms;
+
+    waiter_t queue[ADMIT_QUEUE_MAX];
+    int      qlen;
+};
+
+typedef struct ncp_receiver receiver_t;
+
+static int same_peer(const struct sockaddr_storage* a, socklen_t alen,
+                     const struct sockaddr_storage* b, socklen_t blen)
+{
+    if (a->ss_family != b->ss_family || alen != blen) return 0;
+    if (a->ss_family == AF_INET) {
+        const struct sockaddr_in *pa=(const struct sockaddr_in*)a, *pb=(const struct sockaddr_in*)b;
+        return pa->sin_port==pb->sin_port &&
+               memcmp(&pa->sin_addr,&pb->sin_addr,sizeof(struct in_addr))==0;
+    } else if (a->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *pa=(const struct sockaddr_in6*)a, *pb=(const struct sockaddr_in6*)b;
+        return pa->sin6_port==pb->sin6_port &&
+               memcmp(&pa->sin6_addr,&pb->sin6_addr,sizeof(struct in6_addr))==0;
+    }
+    return 0;
+}
+
+// 控制包编码后交给传输层发出
+static void send_ctl(receiver_t *rv, const pkt_t *p, const struct sockaddr *to, socklen_t tolen)
+{
+    uint8_t out[MAX_MESS_LEN];
+    size_t n = wire_encode(out, sizeof(out), p);
+    if (n) rv->tp.send(rv->tp.ctx, out, n, to, tolen);
+}
+
+static void send_start_ok(receiver_t *rv, const struct sockaddr *to, socklen_t tolen, uint16_t caps, uint32_t wnd){
+    pkt_t h = {0};
+    h.type = PKT_START_OK;
+    h.caps = caps;
+    h.wnd  = wnd;                 // 初始通告窗口
+    rv->adv_wnd = wnd;
+    send_ctl(rv, &h, to, tolen);
+}
+
+// position：在准入队列中的位置（1 = 下一个），0 = 未入队（队列满或只是发来了数据）
+static void send_busy(receiver_t *rv, const struct sockaddr *to, socklen_t tolen, uint32_t position)
+{
+    pkt_t h = {0};
+    h.type = PKT_BUSY;
+    h.seq  = position;
+    send_ctl(rv, &h, to, tolen);
+}
+
+// 窗口 [base, base+W) 内的分片对应的槽位，窗口外返回 NULL
+static inline slot_t *slot_at(const receiver_t *rv, uint64_t base, uint64_t seq)
+{
+    if (seq < base || seq - base >= rv->W) return NULL;
+    return &rv->buf[seq % rv->W];
+}
+
+static pbuf_t *pool_get(receiver_t *rv)
+{
+    if (!rv->free_bufs) {
+        pchunk_t *c = (pchunk_t*)malloc(sizeof(*c));
+        if (!c) return NULL;          // 内存不够：当作没收到，等重传
+        c->next = rv->chunks;
+        rv->chunks = c;
+        for (int i = 0; i < POOL_CHUNK; ++i) {
+            c->bufs[i].next = rv->free_bufs;
+            rv->free_bufs = &c->bufs[i];
+        }
+        rv->pool_bufs += POOL_CHUNK;
+    }
+    pbuf_t *b = rv->free_bufs;
+    rv->free_bufs = b->next;
+    return b;
+}
+
+static void slot_clear(receiver_t *rv, slot_t *sl)
+{
+    if (sl->data) {
+        sl->data->next = rv->free_bufs;
+        rv->free_bufs = sl->data;
+    }
+    memset(sl, 0, sizeof(*sl));
+}
+
+// 丢掉窗口里缓存的分片（[next_write_seq, high_seq) 之外没有占用的槽）
+static void window_clear(receiver_t *rv)
+{
+    uint64_t end = rv->high_seq;
+    if (end < rv->next_write_seq) end = rv->next_write_seq;
+    if (end - rv->next_write_seq > rv->W) end = rv->next_write_seq + rv->W;
+    for (uint64_t seq = rv->next_write_seq; seq < end; ++seq) slot_clear(rv, &rv->buf[seq % rv->W]);
+    rv->high_seq = rv->run_lo = rv->next_write_seq;
+}
+
+// seq 已收到：推进 high_seq。跳过了洞就开始新的一段连续区间
+static void note_high(receiver_t *rv, uint64_t seq)
+{
+    if (seq > rv->high_seq) rv->run_lo = seq;
+    if (seq + 1 > rv->high_seq) rv->high_seq = seq + 1;
+}
+
+// 把一个分片放进窗口；data 为 NULL 表示全零。返回 0 = 放入或已有，-1 = 没有缓冲
+static int slot_store(receiver_t *rv, slot_t *sl, const uint8_t *data, uint32_t len)
+{
+    if (sl->present) return 0;
+    if (data) {
+        sl->data = pool_get(rv);
+        if (!sl->data) return -1;
+        memcpy(sl->data->data, data, len);
+    }
+    sl->present = 1;
+    sl->zero = data == NULL;
+    sl->len = len;
+    return 0;
+}
+
+// 全零分片：sink 能留空洞就不写
+static int sink_zero(receiver_t *rv, size_t len)
+{
+    static const uint8_t zeros[MAX_PAYLOAD];
+    if (rv->sink.zero) return rv->sink.zero(rv->out, len);
+    return rv->sink.write(rv->out, zeros, len);
+}
+
+// 交给 sink 一个按序分片（data 为 NULL 表示全零）
+static int deliver(receiver_t *rv, const uint8_t *data, uint32_t len)
+{
+    int rc = data ? rv->sink.write(rv->out, data, len) : sink_zero(rv, len);
+    if (rc != 0) return -1;
+    rv->bytes_in_order += len;
+    rv->next_write_seq++;
+    return 0;
+}
+
+// 按序写出：先写刚到的 head（就是 next_write_seq，不进缓冲），再写窗口里接着的连续分片，
+// 槽位和缓冲随即归还。写失败返回 -1
+static int flush_in_order(receiver_t *rv, const pkt_t *head)
+{
+    if (head && deliver(rv, head->payload, head->len) != 0) return -1;
+    for (;;) {
+        slot_t *sl = &rv->buf[rv->next_write_seq % rv->W];
+        if (!sl->present) break;
+        if (deliver(rv, sl->zero ? NULL : sl->data->data, sl->len) != 0) return -1;
+        slot_clear(rv, sl);
+    }
+    return 0;
+}
+
+// sack_n > 0：顺带报告刚收进缓冲的乱序区间 [sack, sack+sack_n)
+static void send_ack(receiver_t *rv, const struct sockaddr *peer, socklen_t plen, uint64_t ack_seq, uint32_t wnd,
+                     uint64_t sack, uint32_t sack_n) {
+    pkt_t ack = {0};
+    ack.type = PKT_ACK;
+    ack.seq  = (uint32_t)ack_seq;   // Last in-order sequence number received (low 32 bits)
+    ack.wnd  = wnd;                 // 还能收多少个分片（从 ack_seq+1 起）
+    if (sack_n > 0) {
+        ack.flags = WIRE_ACK_SACK;
+        ack.sack  = (uint32_t)sack;
+        ack.nseg  = (uint16_t)(sack_n < UINT16_MAX ? sack_n : UINT16_MAX);
+    }
+    trace_rec(rv->now_us, TR_ACK_OUT, 0, ack_seq + 1, wnd, ack.nseg, ack.sack);
+    rv->adv_wnd = wnd;
+    send_ctl(rv, &ack, peer, plen);
+}
+// NACK 带洞列表：从 next_write_seq（一定缺）扫到 high_seq，报告前 WIRE_MAX_BLOCKS 个缺口
+// 区间偏移/长度线上只有 16 位：大窗口时只报前 64K 个分片里的洞
+static void send_nack(receiver_t *rv, const struct sockaddr *peer, socklen_t plen,
+                      uint64_t next_write_seq, uint64_t high_seq) {
+    pkt_t nack = {0};
+    nack.type = PKT_NACK;
+    nack.seq  = (uint32_t)next_write_seq;
+    uint64_t span = high_seq - next_write_seq;
+    uint32_t missing = 0;
+    if (span > rv->W) span = rv->W;
+    if (span > UINT16_MAX) span = UINT16_MAX;
+    const slot_t *buf = rv->buf;
+#define PRESENT(i) (buf[(next_write_seq + (i)) % rv->W].present)
+    for (uint32_t i = 0; i < span && nack.nblk < WIRE_MAX_BLOCKS; ) {
+        if (PRESENT(i)) { ++i; continue; }
+        uint32_t j = i;
+        while (j < span && !PRESENT(j)) ++j;
+        nack.blk[nack.nblk].off = (uint16_t)i;
+        nack.blk[nack.nblk].len = (uint16_t)(j - i);
+        nack.nblk++;
+        missing += j - i;
+        i = j;
+    }
+#undef PRESENT
+    trace_rec(rv->now_us, TR_NACK_OUT, 0, next_write_seq, nack.nblk, missing, 0);
+    send_ctl(rv, &nack, peer, plen);
+}
+
+// 通告窗口：从 next_write_seq 起缓冲里还能放下的分片数，超出的包会被 slot_at 丢掉。
+// 乱序分片本就落在这段范围里（发送端已把它们算作在途），不额外扣减；按序数据当场写盘，不占缓冲。
+// sink 有积压（流式输出，下游读得慢）时扣掉积压的分片数：下游的反压一直传到发送端
+static uint32_t rcv_window(const receiver_t *rv)
+{
+    if (!rv->sink.backlog || !rv->out) return rv->W;
+    uint64_t held = (rv->sink.backlog(rv->out) + MAX_PAYLOAD - 1) / MAX_PAYLOAD;
+    return held < rv->W ? rv->W - (uint32_t)held : 0;
+}
+
+// 给当前 sender 发累积 ACK（带通告窗口）。next_write_seq == 0 时 ack 为 -1（线上 0xffffffff）。
+static void ack_current(receiver_t *rv)
+{
+    send_ack(rv, (const struct sockaddr*)&rv->cur_peer, rv->cur_plen,
+             rv->next_write_seq - 1, rcv_window(rv), 0, 0);
+}
+
+static const char *peer_str(const struct sockaddr_storage *p, char *out, size_t n)
+{
+    const struct sockaddr_in *in = (const struct sockaddr_in*)p;
+    char ip[INET_ADDRSTRLEN] = "?";
+    inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+    snprintf(out, n, "%s:%u", ip, (unsigned)ntohs(in->sin_port));
+    return out;
+}
+
+// 复位为“空闲”，接受下一次 START（会话结束 / 超时清理共用）；complete = 文件已完整收到
+static void session_reset(receiver_t *rv, int complete)
+{
+    if (rv->out) { rv->sink.close(rv->out, complete); rv->out = NULL; }
+    window_clear(rv);
+    rv->busy = 0;
+    memset(&rv->cur_peer, 0, sizeof(rv->cur_peer));
+    rv->cur_plen = 0;
+
+    // 复位流水线状态
+    rv->next_write_seq = 0;
+    rv->high_seq       = 0;
+    rv->run_lo         = 0;
+    rv->bytes_in_order = 0;
+    rv->fin_seen       = 0;
+    rv->fin_seq        = 0;
+}
+
+// 有缓存的 0-RTT 数据，且没超过会话空闲超时（更旧的 START 多半不会来了）
+static int early_fresh(const receiver_t *rv)
+{
+    return rv->early_ms && rv->now_ms - rv->early_ms <= SESSION_IDLE_TIMEOUT_MS;
+}
+
+// 开始一个新会话：登记 sender、开文件、回 START_OK（调用时接收端空闲）
+static int session_flush(receiver_t *rv, const pkt_t *head);
+
+static void session_begin(receiver_t *rv, const struct sockaddr_storage *peer, socklen_t plen,
+                          const char *name, uint64_t file_size, uint16_t caps)
+{
+    // 这个 sender 的 0-RTT 数据已在缓冲里、且没过期就保留，否则清空
+    int has_early = early_fresh(rv) && same_peer(peer, plen, &rv->early_peer, rv->early_plen);
+    if (!has_early) window_clear(rv);     // 空闲时 next_write_seq = 0，早到数据从 0 起
+    rv->early_ms = 0;
+    rv->train_open = 0;
+    rv->next_write_seq = 0; rv->bytes_in_order = 0; rv->fin_seen = 0; rv->fin_seq = 0;
+
+    rv->busy = 1;
+    memcpy(&rv->cur_peer, peer, sizeof(*peer));
+    rv->cur_plen = plen;
+
+    rv->file_size = file_size;
+    rv->caps = caps & RCV_CAPS;
+    snprintf(rv->dst_name, sizeof(rv->dst_name), "%s", name);
+    rv->out = rv->sink.open(rv->sink.ctx, rv->dst_name, file_size);
+    if (!rv->out) {
+        // 打不开输出：不接这个会话，发送端会重发 START
+        LOG(rv, "[RCV] cannot open %s, ignoring START\n", rv->dst_name);
+        rv->busy = 0;
+        return;
+    }
+
+    //Statistics
+    rv->start_ms = rv->now_ms;
+    rv->last_mark_ms = rv->start_ms;
+    rv->last_mark_bytes = 0;
+
+    if (file_size == FILE_SIZE_UNKNOWN) {
+        LOG(rv, "START: recv -> %s (size=unknown, streamed)\n", rv->dst_name);
+    } else {
+        LOG(rv, "START: recv -> %s (size=%lu)\n", rv->dst_name, (unsigned long)file_size);
+    }
+    send_start_ok(rv, (const struct sockaddr*)peer, plen, rv->caps, rcv_window(rv));
+    rv->last_activity_ms = rv->now_ms;
+
+    if (has_early) {
+        // 早到的数据现在可以落盘并确认
+        if (session_flush(rv, NULL) != 0) return;
+        if (rv->next_write_seq > 0) ack_current(rv);
+    }
+}
+
+static int queue_find(const receiver_t *rv, const struct sockaddr_storage *peer, socklen_t plen)
+{
+    for (int i = 0; i < rv->qlen; ++i) {
+        if (same_peer(&rv->queue[i].peer, rv->queue[i].plen, peer, plen)) return i;
+    }
+    return -1;
+}
+
+static void queue_remove(receiver_t *rv, int i)
+{
+    memmove(&rv->queue[i], &rv->queue[i + 1], sizeof(waiter_t) * (size_t)(rv->qlen - i - 1));
+    rv->qlen--;
+}
+
+// 排队的 START：入队（或刷新保活时间），回 BUSY 告诉它排第几
+static void queue_admit(receiver_t *rv, const struct sockaddr_storage *peer, socklen_t plen,
+                        const char *name, uint64_t file_size, uint16_t caps)
+{
+    int i = queue_find(rv, peer, plen);
+    if (i < 0) {
+        if (rv->qlen == ADMIT_QUEUE_MAX) {
+            send_busy(rv, (const struct sockaddr*)peer, plen, 0);
+            return;
+        }
+        i = rv->qlen++;
+        memcpy(&rv->queue[i].peer, peer, sizeof(*peer));
+        rv->queue[i].plen = plen;
+        char who[64];
+        LOG(rv, "[RCV] busy, queued %s at position %d\n", peer_str(peer, who, sizeof(who)), i + 1);
+    }
+    snprintf(rv->queue[i].name, sizeof(rv->queue[i].name), "%s", name);
+    rv->queue[i].file_size = file_size;
+    rv->queue[i].caps = caps;
+    rv->queue[i].last_seen_ms = rv->now_ms;
+    send_busy(rv, (const struct sockaddr*)peer, plen, (uint32_t)(i + 1));
+}
+
+// 当前会话结束：跳过已离开的排队者，把队头放行并通知其余人新位置
+static void admit_next(receiver_t *rv)
+{
+    uint64_t now = rv->now_ms;
+    while (rv->qlen > 0 && now - rv->queue[0].last_seen_ms > QUEUE_STALE_MS) {
+        queue_remove(rv, 0);
+    }
+    if (rv->qlen == 0) {
+        LOG(rv, "Receiver is ready for the next session.\n");
+        return;
+    }
+    waiter_t w = rv->queue[0];
+    queue_remove(rv, 0);
+    char who[64];
+    LOG(rv, "[RCV] granting queued sender %s\n", peer_str(&w.peer, who, sizeof(who)));
+    session_begin(rv, &w.peer, w.plen, w.name, w.file_size, w.caps);
+    for (int i = 0; i < rv->qlen; ++i) {
+        send_busy(rv, (const struct sockaddr*)&rv->queue[i].peer, rv->queue[i].plen, (uint32_t)(i + 1));
+    }
+}
+
+// 按序写盘；sink 写失败时放弃会话（文件不完整），放行下一个
+static int session_flush(receiver_t *rv, const pkt_t *head)
+{
+    prof_enter(PROF_FLUSH);
+    int rc = flush_in_order(rv, head);
+    prof_exit();
+    if (rc == 0) return 0;
+    LOG(rv, "[RCV] write to %s failed, dropping the session\n", rv->dst_name);
+    session_reset(rv, 0);
+    admit_next(rv);
+    return -1;
+}
+
+static void on_start(receiver_t *rv, const pkt_t *h,
+                     const struct sockaddr_storage *peer, socklen_t plen)
+{
+    // 取文件名（h->len 为 name 长度，wire_decode 已检查不越界且 <= 255）
+    char name[256];
+    memcpy(name, h->payload, h->len);
+    name[h->len] = '\0';
+
+    if (rv->busy) {
+        if (!same_peer(peer, plen, &rv->cur_peer, rv->cur_plen)) {
+            queue_admit(rv, peer, plen, name, h->file_size, h->caps);
+            return;
+        }
+        // ✅ 同一 sender 的重复 START：只重发 START_OK，不重置会话/不重开文件
+        send_start_ok(rv, (const struct sockaddr*)peer, plen, rv->caps, rcv_window(rv));
+        rv->last_activity_ms = rv->now_ms;
+        return;
+    }
+    // 空闲：登记 sender，一次性初始化
+    int i = queue_find(rv, peer, plen);
+    if (i >= 0) queue_remove(rv, i);
+    session_begin(rv, peer, plen, name, h->file_size, h->caps);
+}
+
+// 空闲时先到的 0-RTT 数据：按 peer 缓存，等它的 START
+static void on_early_data(receiver_t *rv, const pkt_t *h,
+                          const struct sockaddr_storage *peer, socklen_t plen)
+{
+    uint64_t nowms = rv->now_ms;
+    int fresh = early_fresh(rv);
+    int same = fresh && same_peer(peer, plen, &rv->early_peer, rv->early_plen);
+    if (fresh && !same) {
+        return;   // 缓冲已被另一个 sender 的早到数据占用
+    }
+    if (!same) {
+        window_clear(rv);
+        memcpy(&rv->early_peer, peer, sizeof(*peer));
+        rv->early_plen = plen;
+    }
+    rv->early_ms = nowms;
+    uint64_t seq = seq_extend(0, h->seq);
+    slot_t *sl = slot_at(rv, 0, seq);
+    if (sl && slot_store(rv, sl, h->payload, h->len) == 0) note_high(rv, seq);
+}
+
+// DATA 或 ZERO（[seq, seq+nseg) 全零，最后一片长 len）
+static void on_data(receiver_t *rv, const pkt_t *h,
+                    const struct sockaddr_storage *peer, socklen_t plen)
+{
+    if (!rv->busy) {
+        // 0-RTT：START 还没到（丢了或乱序）就来了数据——先缓存。ZERO 只在 START_OK 之后才会来
+        if (h->type == PKT_DATA) on_early_data(rv, h, peer, plen);
+        return;
+    }
+    // 仅接受当前 sender 的数据；已在队列里的 sender 不必回复（它的 START 已得到 BUSY）
+    if (!same_peer(peer, plen, &rv->cur_peer, rv->cur_plen)) {
+        if (queue_find(rv, peer, plen) < 0) send_busy(rv, (const struct sockaddr*)peer, plen, 0);
+        return;
+    }
+    const struct sockaddr *to = (const struct sockaddr*)&rv->cur_peer;
+
+    rv->last_activity_ms = rv->now_ms;
+    if (!rv->out) return; // 未 START，忽略
+    // 放入窗口缓冲
+    uint64_t seq = seq_extend(rv->next_write_seq, h->seq);
+    uint32_t n = h->type == PKT_ZERO ? h->nseg : 1;
+    int in_window = 0;
+    const pkt_t *head = NULL;
+    uint64_t sack_lo = 0, sack_hi = 0;   // 这次收进缓冲的连续区间，ACK 时报给发送端
+    if (h->type == PKT_DATA && seq == rv->next_write_seq) {
+        // 正好是下一个要写的：直接写出，不经缓冲
+        head = h;
+        in_window = 1;
+        note_high(rv, seq);
+    } else {
+        for (uint32_t k = 0; k < n; ++k) {
+            slot_t *sl = slot_at(rv, rv->next_write_seq, seq + k);
+            if (!sl) continue;
+            in_window = 1;
+            if (slot_store(rv, sl, h->type == PKT_ZERO ? NULL : h->payload,
+                           k + 1 == n ? h->len : MAX_PAYLOAD) != 0) continue;
+            note_high(rv, seq + k);
+            if (sack_hi == seq + k) sack_hi++;
+            else if (sack_hi == 0) { sack_lo = seq + k; sack_hi = sack_lo + 1; }
+        }
+    }
+    if (trace_on) {
+        int why = head ? TRR_IN_ORDER : sack_hi > sack_lo ? TRR_BUFFERED
+                : in_window || seq < rv->next_write_seq ? TRR_DUP : TRR_OUTSIDE;
+        trace_put(rv->now_us, TR_RX, (uint8_t)why, seq, n, 0, 0);
+    }
+    if (!in_window) {
+        // 重复的旧分片：说明 ACK 丢了，补发一次累积 ACK，避免发送端一直超时重传
+        if (seq < rv->next_write_seq) ack_current(rv);
+        // 超出窗口太远，先忽略
+        return;
+    }
+
+    // 尝试按序 flush
+    if (session_flush(rv, head) != 0) return;
+
+    // ---- NACK 触发逻辑（有缺口时把洞列表报给发送端）----
+    // 按序写完后 next_write_seq 必然缺；high_seq 越过它说明右侧已有乱序片，确实丢了
+    if (rv->high_seq > rv->next_write_seq) {
+        uint64_t nowms = rv->now_ms;
+        if (nowms - rv->last_nack_ms >= NACK_GAP_MS) {
+            send_nack(rv, to, rv->cur_plen, rv->next_write_seq, rv->high_seq);
+            rv->last_nack_ms = nowms;
+        }
+    }
+
+    // 10MB 打点：每当有序累计写入增加了 >=10MB，就打印一次
+    uint64_t delta_bytes = rv->bytes_in_order - rv->last_mark_bytes;
+    if (delta_bytes >= TEN_MB) {
+        uint64_t now = rv->now_ms;
+        uint64_t delta_ms = (now - rv->last_mark_ms) ? (now - rv->last_mark_ms) : 1; // 防除零
+        double recent_mbps = (delta_bytes * 8.0) / (double)delta_ms / 1000.0; // Mb/s
+        LOG(rv, "[RCV] Progress: %.2f MB total, recent 10MB avg rate: %.2f Mb/s\n",
+            rv->bytes_in_order / (1024.0*1024.0), recent_mbps);
+        if (rv->log) fflush(rv->log);
+        rv->last_mark_ms = now;
+        // 如果增量 >10MB（一次推进很多），也只前进一个 10MB 档位
+        rv->last_mark_bytes += TEN_MB;
+    }
+
+    // 每收一片回一次 ACK。落在洞后面的带上 SACK：发送端据此知道洞后面到了哪些，
+    // 按发送时间判丢（包括第一片就丢了、累积 ACK 还是 -1 的时候）。
+    // 接在最上面那段后面的报整段（线上最多 64K 片），前一个 ACK 丢了也不缺信息
+    if (sack_hi > sack_lo && sack_hi == rv->high_seq) {
+        sack_lo = rv->run_lo;
+        if (rv->high_seq - sack_lo > UINT16_MAX) sack_lo = rv->high_seq - UINT16_MAX;
+    }
+    if (sack_lo < rv->next_write_seq) sack_lo = rv->next_write_seq;
+    if (sack_hi > sack_lo) {
+        send_ack(rv, to, rv->cur_plen, rv->next_write_seq - 1, rcv_window(rv), sack_lo, (uint32_t)(sack_hi - sack_lo));
+    } else if (rv->next_write_seq > 0) {
+        ack_current(rv);
+    }
+}
+
+// 零窗口探测：发送端窗口被关死时周期性来问，回一个带最新窗口的 ACK
+static void on_wnd_probe(receiver_t *rv, const struct sockaddr_storage *peer, socklen_t plen)
+{
+    if (!rv->busy || !same_peer(peer, plen, &rv->cur_peer, rv->cur_plen)) return;
+    rv->last_activity_ms = rv->now_ms;
+    ack_current(rv);
+}
+
+// 一串 PROBE 的到达统计：发送端据此算 RTT（扣掉 hold_us）、瓶颈带宽（首末间隔）和丢包
+static void probe_report(receiver_t *rv)
+{
+    pkt_t h = {0};
+    h.type    = PKT_PROBE_REPORT;
+    h.seq     = rv->train_id;
+    h.nseg    = rv->train_got;
+    h.first   = rv->train_first;
+    h.idx     = rv->train_last;
+    h.disp_us = (uint32_t)(rv->train_last_us - rv->train_first_us);
+    h.hold_us = (uint32_t)(rv->now_us - rv->train_last_us);
+    send_ctl(rv, &h, (const struct sockaddr*)&rv->cur_peer, rv->cur_plen);
+    rv->train_open = 0;
+}
+
+static uint64_t probe_deadline(const receiver_t *rv)
+{
+    return rv->train_last_us + PROBE_HOLD_US + 2 * (rv->train_last_us - rv->train_first_us);
+}
+
+static void on_probe(receiver_t *rv, const pkt_t *h,
+                     const struct sockaddr_storage *peer, socklen_t plen)
+{
+    if (!rv->busy || !same_peer(peer, plen, &rv->cur_peer, rv->cur_plen)) return;
+    rv->last_activity_ms = rv->now_ms;
+    if (rv->train_open && h->seq != rv->train_id) probe_report(rv);   // 上一串的尾巴丢了
+    if (!rv->train_open) {
+        rv->train_open = 1;
+        rv->train_id = h->seq;
+        rv->train_got = 0;
+        rv->train_first = h->idx;
+        rv->train_first_us = rv->now_us;
+    }
+    rv->train_got++;
+    rv->train_last = h->idx;
+    rv->train_last_us = rv->now_us;
+    if (h->idx + 1 == h->nseg) probe_report(rv);
+}
+
+static void send_fin_ack(receiver_t *rv)
+{
+    pkt_t h = {0};
+    h.type      = PKT_FIN_ACK;
+    h.seq       = rv->done_seq;
+    h.file_size = rv->done_bytes;
+    h.ms        = rv->done_ms;
+    send_ctl(rv, &h, (const struct sockaddr*)&rv->done_peer, rv->done_plen);
+}
+
+static void on_fin(receiver_t *rv, const pkt_t *h,
+                   const struct sockaddr_storage *peer, socklen_t plen)
+{
+    // 已完成会话的重发 FIN（我们的 FIN_ACK 丢了）：照原样再确认一次
+    if (rv->done_plen && h->seq == rv->done_seq && same_peer(peer, plen, &rv->done_peer, rv->done_plen) &&
+        !(rv->busy && same_peer(peer, plen, &rv->cur_peer, rv->cur_plen))) {
+        send_fin_ack(rv);
+        return;
+    }
+    if (!rv->busy) {
+        // 还没会话就来了 FIN（可能 START/数据都丢了）——忽略
+        return;
+    }
+    // 仅接受当前 sender 的 FIN
+    if (!same_peer(peer, plen, &rv->cur_peer, rv->cur_plen)) {
+        if (queue_find(rv, peer, plen) < 0) send_busy(rv, (const struct sockaddr*)peer, plen, 0);
+        return;
+    }
+    rv->last_activity_ms = rv->now_ms;
+    rv->fin_seen = 1; rv->fin_seq = seq_extend(rv->next_write_seq, h->seq); rv->file_size = h->file_size;
+    LOG(rv, "FIN seen: total_seq=%llu, size=%lu\n", (unsigned long long)rv->fin_seq, (unsigned long)rv->file_size);
+    uint64_t end_ms = rv->now_ms;
+
+    // 如果已经全部按序写完（简单判断：bytes_in_order == file_size）
+    if (rv->out && rv->bytes_in_order == rv->file_size) {
+        //When finished, print statistics result
+        double elapsed_s = (end_ms - rv->start_ms) / 1000.0;
+        double avg_mbps = (rv->bytes_in_order * 8.0) / (elapsed_s * 1e6);
+        LOG(rv, "[RCV] DONE: %.2f MB in %.2f s, avg goodput: %.2f Mb/s\n",
+            rv->bytes_in_order / (1024.0*1024.0), elapsed_s, avg_mbps);
+        LOG(rv, "RECV DONE: %s (%lu bytes)\n", rv->dst_name, (unsigned long)rv->bytes_in_order);
+        if (rv->log) fflush(rv->log);
+        rv->stats.sessions++;
+        rv->stats.bytes += rv->bytes_in_order;
+
+        // 确认 FIN 并记下来：发送端收到 FIN_ACK 才退出，丢了它会重发 FIN
+        int fin_ack = rv->caps & CAP_FIN_ACK;
+        memcpy(&rv->done_peer, peer, sizeof(*peer));
+        rv->done_plen  = plen;
+        rv->done_seq   = h->seq;
+        rv->done_bytes = rv->bytes_in_order;
+        rv->done_ms    = (uint32_t)(end_ms - rv->start_ms);
+
+        // ✅ 关键：不退出进程，复位为“空闲”，并立即放行排队的下一个 sender
+        session_reset(rv, 1);
+        if (fin_ack) send_fin_ack(rv);
+        admit_next(rv);
+    }
+    // 否则继续等前面洞补齐（后续会用重传/超时推动）
+}
+
+ncp_receiver_t *ncp_receiver_new(const ncp_receiver_cfg_t *cfg, const ncp_transport_t *tp,
+                                 const ncp_sink_t *sink)
+{
+    receiver_t *rv = (receiver_t*)calloc(1, sizeof(*rv));   // 含准入队列
+    if (!rv) return NULL;
+    rv->tp   = *tp;
+    rv->sink = *sink;
+    rv->log  = cfg->log;
+    rv->W    = cfg->window ? cfg->window : NCP_RCV_WINDOW;
+    rv->buf  = (slot_t*)calloc(rv->W, sizeof(slot_t));
+    if (!rv->buf) { free(rv); return NULL; }
+    return rv;
+}
+
+void ncp_receiver_free(ncp_receiver_t *rv)
+{
+    if (!rv) return;
+    if (rv->out) rv->sink.close(rv->out, 0);
+    while (rv->chunks) {
+        pchunk_t *c = rv->chunks;
+        rv->chunks = c->next;
+        free(c);
+    }
+    free(rv->buf);
+    free(rv);
+}
+
+void ncp_receiver_on_packet(ncp_receiver_t *rv, const uint8_t *frame, size_t len,
+                            const struct sockaddr_storage *peer, socklen_t plen, uint64_t now_us)
+{
+    pkt_t pk;
+    if (wire_decode(frame, len, &pk) != 0) return;   // 截断/未知类型/版本不符
+    const pkt_t *h = &pk;
+
+    rv->now_ms = now_us / 1000;
+    rv->now_us = now_us;
+    prof_enter(PROF_DATA);
+    if (h->type == PKT_START) {
+        on_start(rv, h, peer, plen);
+    } else if (h->type == PKT_DATA || h->type == PKT_ZERO) {
+        on_data(rv, h, peer, plen);
+    } else if (h->type == PKT_FIN) {
+        on_fin(rv, h, peer, plen);
+    } else if (h->type == PKT_WND_PROBE) {
+        on_wnd_probe(rv, peer, plen);
+    } else if (h->type == PKT_PROBE) {
+        on_probe(rv, h, peer, plen);
+    }
+    prof_exit();
+}
+
+void ncp_receiver_on_timer(ncp_receiver_t *rv, uint64_t now_us)
+{
+    rv->now_ms = now_us / 1000;
+    rv->now_us = now_us;
+    prof_enter(PROF_TIMER);
+    if (rv->busy && rv->train_open && now_us >= probe_deadline(rv)) probe_report(rv);
+    if (!rv->busy && rv->early_ms && !early_fresh(rv)) {
+        // START 一直没来：丢掉缓存的 0-RTT 数据，不占着缓冲
+        LOG(rv, "[RCV] early data not claimed by a START, dropped.\n");
+        window_clear(rv);
+        rv->early_ms = 0;
+    }
+    if (rv->busy && rv->last_activity_ms > 0 && rv->now_ms - rv->last_activity_ms > SESSION_IDLE_TIMEOUT_MS) {
+        LOG(rv, "[RCV] session idle timeout, back to IDLE.\n");
+        session_reset(rv, 0);
+        admit_next(rv);
+    }
+    prof_exit();
+}
+
+uint64_t ncp_receiver_next_deadline(const ncp_receiver_t *rv)
+{
+    if (!rv->busy) return rv->early_ms ? (rv->early_ms + SESSION_IDLE_TIMEOUT_MS + 1) * 1000ULL : 0;
+    uint64_t dl = (rv->last_activity_ms + SESSION_IDLE_TIMEOUT_MS + 1) * 1000ULL;
+    if (rv->train_open && probe_deadline(rv) < dl) dl = probe_deadline(rv);
+    return dl;
+}
+
+void ncp_receiver_on_output(ncp_receiver_t *rv, uint64_t now_us)
+{
+    if (!rv->busy || rv->next_write_seq == 0) return;
+    rv->now_ms = now_us / 1000;
+    rv->now_us = now_us;
+    // 至少打开 W/4 才更新，免得每腾出一片就发一个 ACK、发送端一次只补一片（糊涂窗口）
+    uint32_t step = rv->W / 4 ? rv->W / 4 : 1;
+    if (rcv_window(rv) >= rv->adv_wnd + step) ack_current(rv);
+}
+
+void ncp_receiver_stats(const ncp_receiver_t *rv, ncp_rcv_stats_t *st)
+{
+    *st = rv->stats;
+}
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_include.h"
+#include "libncp.h"
+#include "sim_net.h"
+#include "cc.h"
+
+#include <unistd.h>
+
+/*
+ * ncp_sim：libncp 两端经模拟链路（sim_net.h：带宽、时延、瓶颈队列、丢包模型）对接，
+ * 在虚拟时钟上跑完整传输。没有事件时直接跳到下一个到达/定时器时刻，所以比实时快得多，
+ * 同样的参数和 seed 结果完全一样。
+ *
+ * 参数可以给列表（1,2,5 或 lo:hi:step），按所有组合扫一遍，每个组合一行；
+ * 只有一个组合时打印和 ncp / rcv 一样的统计（时间是虚拟的）。
+ */
+
+static void Usage(int argc, char *argv[]);
+static void Print_help(void);
+static void die(const char* msg){ perror(msg); exit(1); }
+
+// 窗口与 RTO 下限：同 ncp 的 env
+enum { W_LAN = 512, W_WAN = 2000 };
+static const uint32_t RTO_LAN_MS = 60;
+static const uint32_t RTO_WAN_MS = 200;
+static const uint64_t MAX_VIRTUAL_US = 3600ULL * 1000000;   // 虚拟时间超过一小时算没跑完
+
+// 可扫的参数
+enum { A_CC, A_WINDOW, A_RTO, A_RATE, A_DELAY, A_BUFFER, A_LOSS, A_BURST, A_SEED, AXES };
+#define MAX_VALUES 64
+
+typedef struct {
+    const char *name;
+    int         n;
+    double      v[MAX_VALUES];
+} axis_t;
+
+static axis_t Axis[AXES] = {
+    { "cc",     0, {0} },
+    { "window", 1, {0} },      // 0 = 按 env
+    { "rto_ms", 1, {0} },      // 0 = 按 env
+    { "Mb/s",   1, {100} },
+    { "delay",  1, {5} },      // 单向，毫秒
+    { "buffer", 1, {1000} },
+    { "loss%",  1, {0} },
+    { "burst",  1, {1} },
+    { "seed",   1, {1} },
+};
+static const cc_ops_t *Ccs[MAX_VALUES];
+static int      Mode = MODE_AUTO;
+static uint64_t Size_bytes = 100ULL * 1024 * 1024;
+static uint32_t Rcv_window = NCP_RCV_WINDOW;
+static int      Verbose;
+static double   Max_redund;        // -x：冗余度超过它也算失败（0 = 不查）
+
+#define PATTERN_LEN (64 * 1024)
+static uint8_t Pattern[PATTERN_LEN + MAX_PAYLOAD];
+
+static ssize_t pattern_read_at(void *ctx, void *buf, size_t len, uint64_t off)
+{
+    (void)ctx;
+    memcpy(buf, Pattern + off % PATTERN_LEN, len);
+    return (ssize_t)len;
+}
+
+// sink：只计数（sim_net 不搬负载）
+static uint64_t Sink_bytes;
+
+static void *count_open(void *ctx, const char *name, uint64_t size)
+{
+    (void)name; (void)size;
+    Sink_bytes = 0;
+    return ctx;
+}
+
+static int count_write(void *session, const void *buf, size_t len)
+{
+    (void)session; (void)buf;
+    Sink_bytes += len;
+    return 0;
+}
+
+static int count_zero(void *session, size_t len)
+{
+    (void)session;
+    Sink_bytes += len;
+    return 0;
+}
+
+static void count_close(void *session, int complete)
+{
+    (void)session; (void)complete;
+}
+
+static uint64_t wall_ns(void)
+{
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t min_deadline(uint64_t a, uint64_t b)
+{
+    if (a == 0) return b;
+    if (b == 0) return a;
+    return a < b ? a : b;
+}
+
+typedef struct {
+    int      ok;
+    double   vt_s;                 // 虚拟时间：START 到发送端结束
+    double   wall_s;
+    ncp_snd_stats_t ss;
+    sim_link_stats_t fwd, rev;
+} result_t;
+
+// 跑一次传输；p[] 是各轴取的值
+static void run_one(const double p[AXES], FILE *log, result_t *res)
+{
+    sim_link_cfg_t link;
+    memset(&link, 0, sizeof(link));
+    link.rate_bps = p[A_RATE] * 1e6;
+    link.delay_us = (uint64_t)(p[A_DELAY] * 1000.0);
+    link.buffer   = (size_t)p[A_BUFFER];
+    link.loss     = p[A_LOSS] / 100.0;
+    link.burst    = p[A_BURST];
+    // 两个方向参数相同（sendto_dbg 也是两端各丢各的）
+    sim_net_t *net = sim_net_new(&link, &link, (uint64_t)p[A_SEED]);
+    if (!net) die("sim_net_new");
+
+    ncp_transport_t snd_tp = sim_net_transport(net, SIM_SND);
+    ncp_transport_t rcv_tp = sim_net_transport(net, SIM_RCV);
+    ncp_receiver_cfg_t rcfg = { log, Rcv_window };
+    ncp_sink_t sink = { &Sink_bytes, count_open, count_write, count_close, count_zero };
+    ncp_receiver_t *rv = ncp_receiver_new(&rcfg, &rcv_tp, &sink);
+    if (!rv) die("ncp_receiver_new");
+
+    ncp_sender_cfg_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.dst_name   = "sim.out";
+    cfg.window     = p[A_WINDOW] > 0 ? (uint32_t)p[A_WINDOW] :
+                     (Mode == MODE_LAN) ? W_LAN : (Mode == MODE_WAN) ? W_WAN : 0;
+    cfg.rto_min_ms = p[A_RTO] > 0 ? (uint32_t)p[A_RTO] :
+                     (Mode == MODE_LAN) ? RTO_LAN_MS : (Mode == MODE_WAN) ? RTO_WAN_MS : 0;
+    cfg.probe      = 1;
+    cfg.cc         = Ccs[(int)p[A_CC]];
+    cfg.npeers     = 1;
+    cfg.log        = log;
+    sim_net_addr(SIM_RCV, &cfg.peers[0], &cfg.peer_lens[0]);
+    ncp_source_t src = { NULL, Size_bytes, pattern_read_at, NULL };
+
+    uint64_t start_us = 1000000, now = start_us;   // 0 在 libncp 里表示“无定时”
+    uint64_t wall0 = wall_ns();
+    sim_net_set_time(net, now);
+    ncp_sender_t *sn = ncp_sender_new(&cfg, &snd_tp, &src, now);
+    if (!sn) die("ncp_sender_new");
+
+    uint8_t buf[MAX_MESS_LEN];
+    int stuck = 0;
+    for (;;) {
+        sim_net_set_time(net, now);
+        ncp_sender_on_timer(sn, now);
+        ncp_receiver_on_timer(rv, now);
+        if (ncp_sender_state(sn) != NCP_RUNNING) break;
+        if (now - start_us > MAX_VIRTUAL_US) { stuck = 1; break; }
+
+        int moved = 0;
+        size_t len;
+        struct sockaddr_storage from; socklen_t flen;
+        int dst;
+        while ((dst = sim_net_pop(net, now, buf, &len, &from, &flen)) >= 0) {
+            if (dst == SIM_SND) ncp_sender_on_packet(sn, buf, len, &from, flen, now);
+            else                ncp_receiver_on_packet(rv, buf, len, &from, flen, now);
+            moved = 1;
+        }
+        if (moved) continue;
+
+        uint64_t next = min_deadline(ncp_sender_next_deadline(sn, now), sim_net_next_due(net));
+        next = min_deadline(next, ncp_receiver_next_deadline(rv));
+        if (next == 0) { stuck = 1; break; }
+        now = next > now ? next : now + 1;
+    }
+    res->wall_s = (wall_ns() - wall0) / 1e9;
+    res->vt_s   = (now - start_us) / 1e6;
+    res->ok     = !stuck && ncp_sender_state(sn) == NCP_DONE && Sink_bytes == Size_bytes;
+    ncp_sender_stats(sn, &res->ss);
+    sim_net_stats(net, SIM_RCV, &res->fwd);
+    sim_net_stats(net, SIM_SND, &res->rev);
+
+    if (log) {
+        if (!res->ok) {
+            fprintf(log, "[SIM] transfer did not finish: %s\n",
+                    stuck ? "no progress" : ncp_sender_error(sn));
+        }
+        ncp_sender_report(sn, log, res->vt_s);
+        fprintf(log, "[SIM] link: data %lu sent, %lu lost, %lu overflow, max queue %lu; "
+                "acks %lu sent, %lu lost, %lu overflow\n",
+                (unsigned long)res->fwd.sent, (unsigned long)res->fwd.lost, (unsigned long)res->fwd.overflow,
+                (unsigned long)res->fwd.max_queue, (unsigned long)res->rev.sent,
+                (unsigned long)res->rev.lost, (unsigned long)res->rev.overflow);
+        fprintf(log, "[SIM] %.3f s virtual in %.3f s wall (%.0fx real time)\n", res->vt_s, res->wall_s,
+                res->wall_s > 0 ? res->vt_s / res->wall_s : 0.0);
+    }
+    ncp_sender_free(sn);
+    ncp_receiver_free(rv);
+    sim_net_free(net);
+}
+
+static void print_header(void)
+{
+    printf("# %-6s %6s %6s %7s %6s %6s %6s %5s %5s | %9s %9s %6s %7s %5s %9s %8s %7s %6s %8s\n",
+           "cc", "window", "rto_ms", "Mb/s", "delay", "buffer", "loss%", "burst", "seed",
+           "time_s", "goodput", "redund", "retx", "rto", "detect_ms", "btl_bw", "min_rtt", "max_q", "speedup");
+}
+
+static void print_row(const double p[AXES], const result_t *r)
+{
+    const ncp_snd_stats_t *s = &r->ss;
+    uint64_t retx = s->retx_nack + s->retx_rack + s->retx_fast + s->retx_tlp + s->retx_rto;
+    printf("  %-6s %6u %6.0f %7.2f %6.2f %6.0f %6.2f %5.1f %5.0f | ",
+           Ccs[(int)p[A_CC]]->name, s->window, s->rto_min_us / 1000.0, p[A_RATE], p[A_DELAY],
+           p[A_BUFFER], p[A_LOSS], p[A_BURST], p[A_SEED]);
+    if (!r->ok) {
+        printf("%9s\n", "FAILED");
+        return;
+    }
+    // btl_bw / min_rtt：拥塞控制模型收敛到的值（Mb/s、毫秒）；max_q：瓶颈队列最长时的包数
+    printf("%9.3f %9.2f %6.2f %7lu %5lu %9.3f %8.2f %7.3f %6lu %8.0f\n", r->vt_s,
+           r->vt_s > 0 ? Size_bytes * 8.0 / r->vt_s / 1e6 : 0.0,
+           Size_bytes ? (double)s->bytes_sent / (double)Size_bytes : 0.0,
+           (unsigned long)retx, (unsigned long)s->retx_rto, s->detect_us / 1000.0,
+           s->btl_bw * MAX_PAYLOAD * 8.0 / 1e6, s->min_rtt_us / 1000.0, (unsigned long)r->fwd.max_queue,
+           r->wall_s > 0 ? r->vt_s / r->wall_s : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    Usage(argc, argv);
+    for (size_t i = 0; i < sizeof(Pattern); ++i) Pattern[i] = (uint8_t)(i * 131 + 7);
+
+    int runs = 1;
+    for (int a = 0; a < AXES; ++a) runs *= Axis[a].n;
+    int sweep = runs > 1;
+    if (sweep) print_header();
+
+    // 按里程表的方式走遍所有组合：最后一个轴变得最快
+    int idx[AXES] = {0};
+    int failed = 0;
+    for (int k = 0; k < runs; ++k) {
+        double p[AXES];
+        for (int a = 0; a < AXES; ++a) p[a] = Axis[a].v[idx[a]];
+        result_t r;
+        if (sweep && Verbose) printf("\n");
+        run_one(p, (!sweep || Verbose) ? stdout : NULL, &r);
+        if (sweep) print_row(p, &r);
+        fflush(stdout);
+        failed += !r.ok;
+        double redund = (double)r.ss.bytes_sent / (double)Size_bytes;
+        if (r.ok && Max_redund > 0 && redund > Max_redund) {
+            printf("[SIM] redundancy %.2fx above the %.2fx limit\n", redund, Max_redund);
+            failed++;
+        }
+        for (int a = AXES - 1; a >= 0; --a) {
+            if (++idx[a] < Axis[a].n) break;
+            idx[a] = 0;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+// "1,2,5" 或 "lo:hi:step"（含 hi），也可以混着写：1,10:50:10
+static void parse_list(axis_t *ax, const char *arg)
+{
+    char *copy = strdup(arg);
+    if (!copy) die("strdup");
+    ax->n = 0;
+    for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        double lo, hi, step;
+        if (sscanf(tok, "%lf:%lf:%lf", &lo, &hi, &step) == 3) {
+            if (step <= 0 || hi < lo) Print_help();
+            for (double v = lo; v <= hi + step * 1e-9; v += step) {
+                if (ax->n == MAX_VALUES) Print_help();
+                ax->v[ax->n++] = v;
+            }
+        } else {
+            char *end;
+            double v = strtod(tok, &end);
+            if (end == tok || *end || ax->n == MAX_VALUES) Print_help();
+            ax->v[ax->n++] = v;
+        }
+    }
+    free(copy);
+    if (ax->n == 0) Print_help();
+    for (int i = 0; i < ax->n; ++i) {
+        if (ax->v[i] < 0) Print_help();
+    }
+}
+
+static void parse_ccs(const char *arg)
+{
+    char *copy = strdup(arg);
+    if (!copy) die("strdup");
+    Axis[A_CC].n = 0;
+    for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        const cc_ops_t *ops = cc_find(tok);
+        if (!ops) {
+            printf("Error: unknown congestion control %s\n", tok);
+            Print_help();
+        }
+        if (Axis[A_CC].n == MAX_VALUES) Print_help();
+        Ccs[Axis[A_CC].n] = ops;
+        Axis[A_CC].v[Axis[A_CC].n] = Axis[A_CC].n;
+        Axis[A_CC].n++;
+    }
+    free(copy);
+    if (Axis[A_CC].n == 0) Print_help();
+}
+
+/* Read commandline arguments */
+static void Usage(int argc, char *argv[])
+{
+    int opt;
+    Ccs[0] = cc_find("bbr");
+    Axis[A_CC].n = 1;
+    while ((opt = getopt(argc, argv, "e:s:R:c:w:o:b:d:q:l:g:r:x:v")) != -1) {
+        switch (opt) {
+        case 'e':
+            if (!strcmp(optarg, "LAN")) Mode = MODE_LAN;
+            else if (!strcmp(optarg, "WAN")) Mode = MODE_WAN;
+            else if (!strcmp(optarg, "AUTO")) Mode = MODE_AUTO;
+            else Print_help();
+            break;
+        case 's': Size_bytes = strtoull(optarg, NULL, 10) * 1024 * 1024; if (!Size_bytes) Print_help(); break;
+        case 'R': Rcv_window = (uint32_t)atoi(optarg); if (Rcv_window == 0) Print_help(); break;
+        case 'c': parse_ccs(optarg); break;
+        case 'w': parse_list(&Axis[A_WINDOW], optarg); break;
+        case 'o': parse_list(&Axis[A_RTO], optarg); break;
+        case 'b': parse_list(&Axis[A_RATE], optarg); break;
+        case 'd': parse_list(&Axis[A_DELAY], optarg); break;
+        case 'q': parse_list(&Axis[A_BUFFER], optarg); break;
+        case 'l': parse_list(&Axis[A_LOSS], optarg); break;
+        case 'g': parse_list(&Axis[A_BURST], optarg); break;
+        case 'r': parse_list(&Axis[A_SEED], optarg); break;
+        case 'x': Max_redund = atof(optarg); if (Max_redund <= 0) Print_help(); break;
+        case 'v': Verbose = 1; break;
+        default:  Print_help();
+        }
+    }
+    if (optind != argc) Print_help();
+    for (int i = 0; i < Axis[A_LOSS].n; ++i) {
+        if (Axis[A_LOSS].v[i] >= 100) Print_help();
+    }
+}
+
+static void Print_help(void)
+{
+    printf("Usage: ncp_sim [-e LAN|WAN|AUTO] [-s MB] [-R rcv_window] [-c cc,...] [-w window,...] [-o rto_ms,...]\n");
+    printf("               [-b Mb/s,...] [-d delay_ms,...] [-q buffer_pkts,...] [-l loss%%,...] [-g burst,...] [-r seed,...]\n");
+    printf("               [-x max_redundancy] [-v]\n");
+    printf("       runs ncp transfers over a simulated link on a virtual clock (deterministic for a given seed)\n");
+    printf("       -e  window and minimum RTO as ncp's env (default AUTO: probe the link); -w / -o override them\n");
+    printf("       -b  bottleneck bandwidth in Mb/s (default 100, 0 = unlimited); -d one-way delay in ms (default 5)\n");
+    printf("       -q  bottleneck queue in packets, tail drop (default 1000, 0 = unlimited)\n");
+    printf("       -l  average loss in percent on each direction; -g mean loss burst length (default 1 = independent)\n");
+    printf("       -x  also fail (exit 1) when bytes sent / file size is above this, e.g. 1.10\n");
+    printf("       list values as 1,2,5 or lo:hi:step; every combination is run and printed as one row;\n");
+    printf("       a single combination prints the same statistics as ncp and rcv (-v does that for every row)\n");
+    exit(0);
+}
@@ -0,0 +1,1519 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "net_include.h"
+#include "wire.h"
+#include "cc.h"
+#include "libncp.h"
+#include "prof.h"
+#include "trace.h"
+
+#include <arpa/inet.h>
+
+// 发送端状态机（libncp）：握手、排队、数据三个阶段，由调用方的事件循环驱动
+
+static const uint32_t PACING_QUANTUM_US = 1000;   // pacing 每次唤醒最多提前发出的量
+
+// 握手/排队参数：排队由接收端管理（FIFO + 主动推 START_OK），发送端只需保活
+static const uint32_t START_RESEND_MS = 500;   // START 重发 / 排队保活间隔
+static const uint32_t PROBE_MAX_MS    = 1000;  // 零窗口探测最大间隔
+static const int      FIN_TRIES       = 8;     // FIN 最多发几次（间隔从 RTO 起翻倍），都没有 FIN_ACK 就放弃等待
+
+// 扇出：NACK 聚合等待时间
+static const uint32_t REPAIR_HOLD_US  = 2000;  // 第一个 NACK 到达后再等这么久，合并各接收端的请求
+
+// 丢包检测（RACK / 快速重传 / 尾部探测）
+static const uint32_t DUPACK_THRESH   = 3;     // 接收端不带 SACK 时：第 3 个重复 ACK 重传 send_base
+static const uint32_t TLP_MIN_US      = 2000;  // 尾部探测超时 PTO = max(2 * srtt, 这么多)，只在比 RTO 短时用
+static const uint32_t RTO_MAX_MS      = 1000;  // 超时退避（每次超时 RTO 翻倍）的上限，远小于接收端 5s 的会话空闲超时
+
+#define ZERO_RUN_MAX 65535u                    // 一个 ZERO 最多覆盖的分片数（线上 16 位）
+
+// 链路探测：握手后先发几轮满长度的 PROBE，第一轮是包对，之后是包串。
+// 每轮等所有接收端的 PROBE_REPORT 或超时，再发下一轮
+#define PROBE_ROUNDS 3
+static const uint16_t PROBE_TRAIN[PROBE_ROUNDS] = { 2, 32, 32 };
+static const uint32_t PROBE_WAIT_MS    = 500;    // 还不知道 RTT 时一轮最多等多久
+static const uint32_t PROBE_GRACE_US   = 20000;  // 知道 RTT 时一轮等 2*RTT + 这么久（含接收端等串尾的时间）
+// cfg 没给窗口 / RTO 下限时按探测结果定：窗口 = 2 个 BDP 再按丢包率放大，夹在 [MIN, MAX]；
+// RTO 下限 = max(PROBE_RTO_MIN_MS, 4 * RTT)。测不出来时用 FALLBACK（同 WAN）
+#define PROBE_W_MIN        512u
+#define PROBE_W_MAX        NCP_AUTO_WINDOW_MAX
+#define PROBE_W_STREAM_MAX 16384u               // 流式输入要整窗缓存负载，上限放低
+#define PROBE_W_FALLBACK   2000u
+static const uint32_t PROBE_RTO_MIN_MS      = 30;
+static const uint32_t PROBE_RTO_FALLBACK_MS = 200;
+
+#define LOG(sn, ...) do { if ((sn)->log) fprintf((sn)->log, __VA_ARGS__); } while (0)
+
+typedef struct {
+    uint64_t last_tx_us;   // 最近一次(重)发时间戳
+    uint64_t prev_tx_us;   // 上一次发送的时间戳（只发过一次时为 0）
+    uint32_t len;          // 仅流式输入：该槽缓存的分片长度
+    uint8_t  retx;         // 被重传过：RTT 样本不可信（Karn）
+    uint8_t  ntx;          // 发出过几份（封顶 255）：多于一份时确认对应哪一份说不准
+    uint8_t  app_limited;
+    // 发出时的交付状态快照，ACK 时据此算交付速率（BBR rate sample）
+    uint64_t delivered;
+    uint64_t delivered_us;
+    uint64_t first_tx_us;
+    uint64_t want;         // 待补发：发来 NACK 的接收端位图（组播/单接收端只看是否非 0）
+    uint8_t  zero;         // 全零，以 ZERO 发出：1 = 区间头（按一个包计），2 = 区间其余分片（不占拥塞窗口）
+    uint8_t  on_tx;        // 在发送时间链表上（已发出、未被确认）
+    uint8_t  sacked;       // 被 SACK 确认过：已离开发送时间链表，等累积确认释放
+    uint32_t tx_prev, tx_next;   // 发送时间链表：槽位下标，TX_NONE 为两端
+} seg_t;
+// 在途分片元数据：环形表，大小 = 窗口 W，seq 放在 ring[seq % W]。
+// 分片长度和文件偏移都由 seq 推出（off = seq * MAX_PAYLOAD），内存与文件大小无关。
+// 流式输入（stdin/管道）无法回读，负载缓存在 sbuf 的同号槽里，直到被累积 ACK。
+// 在途分片另按最近一次发送时间串成双向链表：每次（重）发移到表尾，表头就是最早超时的，
+// 超时检查、RACK 判丢和定时器都只看表头，与窗口大小无关。被 SACK 的分片提前移出链表。
+#define TX_NONE UINT32_MAX
+
+// 接收端：单个、单播列表（每片给每个接收端各发一份）或组播组（每片只发一次）。
+// 每个接收端各自累积确认，发送窗口按最慢的那个推进。
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t alen;
+    int      granted;              // 收到它的 START_OK
+    int      gone;                 // 会话被它清理（数据阶段收到 BUSY），不再等它
+    uint64_t acked;                // 累积确认：[0, acked) 都已收到
+    uint32_t rwnd;                 // 它的通告窗口（从 acked 算起）
+    int      fin_acked;            // 收到它的 FIN_ACK
+    int      train_seen;           // 已报告的最近一串（轮次 + 1）
+    uint64_t probe_rtt_us;         // 它各串里最小的 RTT，0 = 没有报告
+    double   probe_bw;             // 它各串里最大的到达速率（分片/秒），0 = 测不出
+} peer_t;
+
+typedef enum {
+    SND_HANDSHAKE,   // 已发 START，等待 START_OK / BUSY
+    SND_QUEUED,      // 接收端忙：已进入它的准入队列，保活 START，等它推 START_OK
+    SND_PROBE,       // 会话已确认，发 PROBE 包串测 RTT / 带宽 / 丢包，据此定窗口、RTO、pacing
+    SND_DATA,        // 数据阶段：滑动窗口 + 选择重传
+    SND_CLOSING,     // 全部分片已被确认，FIN 已发，等 FIN_ACK（超时重发 FIN）
+    SND_DONE,        // 接收端确认了 FIN（或不支持 FIN_ACK / 重发 FIN 也没等到）
+    SND_FAILED
+} snd_phase_t;
+
+struct ncp_sender {
+    ncp_transport_t tp;
+    ncp_source_t    src;
+    FILE    *log;
+    const char *error;
+
+    struct sockaddr_storage to;    // 单接收端 / 组播组
+    socklen_t tolen;
+    uint64_t fsz;                  // 流式输入：读到 EOF 前为已读字节数
+
+    int      stream;               // 1 = 顺序读的输入，长度未知
+    int      in_eof;
+    uint8_t *sbuf;                 // 流式输入重传缓存：W * MAX_PAYLOAD
+    uint32_t stage_len;            // next_seq 槽里已攒的字节数（攒满一片才发）
+
+    seg_t   *ring;                 // W 个槽位
+    uint64_t total_segs;           // 流式输入：EOF 前为 UINT64_MAX
+    uint32_t W;
+    uint64_t rto_min_us, rto_us;
+    uint64_t srtt_us, rttvar_us;   // RFC 6298 RTT 估计（0 = 还没有样本）
+    uint64_t send_base;            // 最早未确认的分片号（64 位，线上只带低 32 位）
+    uint64_t next_seq;             // 下一个可发分片号
+    uint32_t rwnd;                 // 接收端通告窗口：next_seq < send_base + min(W, rwnd)（扇出取最紧的）
+    uint32_t tx_head, tx_tail;     // 发送时间链表（见 seg_t）
+    uint64_t probe_deadline_us;    // 零窗口探测（0 = 未启动）
+    uint64_t probe_backoff_us;
+
+    cc_t     cc;                   // 拥塞控制：在途上限 cc.cwnd、发送速率 cc.pacing_rate
+    uint64_t next_send_us;         // pacing：下一片最早可发时间
+    uint64_t delivered;            // 已确认分片数（交付速率的分子，重复 ACK 按收到一片计）
+    uint64_t dupacks;              // 洞后面已到达的分片估计：不算在途（无 SACK 时的 pipe 估计）
+    uint64_t delivered_us;         // delivered 最近一次增长的时间
+    uint64_t first_tx_us;          // 当前速率采样区间的起点
+    uint64_t app_limited;          // 非 0：delivered 超过它之前的样本都是应用受限
+    uint64_t total_sent_bytes;     // 包含重传的计数(用于报告)
+    uint64_t zero_bytes;           // 以 ZERO 发出、没有上线的字节
+    uint64_t zero_inflight;        // [send_base, next_seq) 里 zero == 2 的分片数
+    uint64_t extent_from;          // seek_data 缓存：[extent_from, data_off) 是空洞，
+    uint64_t data_off, hole_off;   //   [data_off, hole_off) 是数据；extent_from = UINT64_MAX 为无效
+
+    snd_phase_t phase;
+    int      was_granted;          // 接收端已确认会话（START_OK 或 ACK）
+    int      optimistic;           // 0-RTT：数据阶段但会话尚未被确认，START 继续保活重发
+    uint64_t start_deadline_us;    // HANDSHAKE/QUEUED：下一次重发 START 的时间
+    uint32_t queue_pos;            // 接收端告知的排队位置（0 = 未知）
+
+    uint8_t  start_pkt[MAX_MESS_LEN];   // 编好的 START：头 + 目标文件名（不超 255）
+    int      start_len;
+    uint16_t peer_caps;            // START_OK 协商出的能力位
+
+    peer_t   peers[NCP_MAX_PEERS]; // 非扇出时只有 peers[0]，即 to
+    int      npeers;
+    int      fanout;               // 多个接收端：按地址区分 ACK/NACK，NACK 聚合补发
+    int      mcast;                // to 是组播组，接收端由 START_OK 登记
+    int      expect;               // 组播：要等齐的接收端个数
+    uint64_t repair_deadline_us;   // 0 = 没有待补发的分片
+    uint64_t repair_lo, repair_hi; // 待补发分片所在的范围 [lo, hi)，补发时只扫这一段
+
+    // 丢包检测（单接收端）：ACK 带回刚收进缓冲的乱序区间（SACK），发送端按发送时间判丢（RACK）：
+    // 比已交付分片更早发出、又过了 rack_rtt + 乱序窗口还没确认的，就是丢了，不必等 RTO
+    int      sack_seen;            // 接收端会带 SACK：dupacks 按被 SACK 的分片精确计数
+    uint64_t rack_xmit_us;         // 已交付分片里最晚的一次发送时间（0 = 还没有）
+    uint64_t rack_rtt_us;          // 那一片的往返
+    uint64_t min_rtt_us;           // 乱序窗口 = min_rtt / 4
+    uint32_t dup_run;              // 无 SACK：send_base 不动的连续重复 ACK 数
+    int      tlp_out;              // 尾部探测已发，等 ACK（期间不再探测）
+    uint64_t retx[TRC_CAUSES];     // 重传分片数，按原因 TRC_*（trace.h；ZERO 区间按一次计）
+    uint8_t  tx_cause;             // 下一次发送的原因，记进跟踪后清零
+    uint64_t detect_sum_us, detect_n;   // 分片第一次重传时距原始发送的时间：判丢用了多久
+
+    uint8_t  fin_pkt[32];          // 编好的 FIN，CLOSING 阶段重发
+    size_t   fin_len;
+    int      fin_tries;
+    uint64_t fin_deadline_us;      // CLOSING：下一次重发 FIN 的时间
+    uint64_t fin_backoff_us;
+    int      confirmed;            // 回了 FIN_ACK 的接收端数
+
+    int      probe;                // 数据阶段前先探测链路（接收端支持 CAP_PROBE 时）
+    int      auto_window, auto_rto;   // cfg 没给窗口 / RTO 下限：由探测结果定
+    uint64_t start_tx_us;          // 最近一次发 START 的时间
+    uint64_t hs_rtt_us;            // START → START_OK 的往返（排队后放行的不算），0 = 未知
+    int      train_round;
+    uint64_t train_tx_us;          // 本轮 PROBE 发出时间
+    uint64_t train_deadline_us;
+    uint32_t probe_sent, probe_got;   // 发出 / 收到的探测包数（每个接收端各算一份；没报告的串算全丢）
+    uint32_t probe_reports;           // 收到的串报告数：0 = 丢包率不知道
+    ncp_probe_t probe_res;
+};
+
+typedef struct ncp_sender sender_t;
+
+#define ALL_PEERS UINT64_MAX
+
+static void sender_fail(sender_t *sn, const char *why)
+{
+    if (sn->phase == SND_FAILED) return;
+    sn->phase = SND_FAILED;
+    sn->error = why;
+}
+
+// 发给接收端：单个接收端或组播组只发一次；单播列表按位图逐个发。返回发出的份数
+static int sender_xmit(sender_t *sn, const uint8_t *buf, size_t len, uint64_t mask)
+{
+    if (!sn->fanout || sn->mcast) {
+        sn->tp.send(sn->tp.ctx, buf, len, (const struct sockaddr*)&sn->to, sn->tolen);
+        return 1;
+    }
+    int n = 0;
+    for (int i = 0; i < sn->npeers; ++i) {
+        if (!((mask >> i) & 1) || sn->peers[i].gone) continue;
+        sn->tp.send(sn->tp.ctx, buf, len, (const struct sockaddr*)&sn->peers[i].addr, sn->peers[i].alen);
+        n++;
+    }
+    return n;
+}
+
+// 还没确认会话的接收端（单播列表只给它们重发 START）
+static uint64_t sender_ungranted(const sender_t *sn)
+{
+    uint64_t m = 0;
+    for (int i = 0; i < sn->npeers; ++i) if (!sn->peers[i].granted) m |= 1ULL << i;
+    return m;
+}
+
+static void send_start(sender_t *sn, uint64_t now)
+{
+    sn->start_tx_us = now;
+    sender_xmit(sn, sn->start_pkt, (size_t)sn->start_len, sn->fanout ? sender_ungranted(sn) : ALL_PEERS);
+}
+
+static int same_addr(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    const struct sockaddr_in *pa = (const struct sockaddr_in*)a, *pb = (const struct sockaddr_in*)b;
+    return pa->sin_family == pb->sin_family && pa->sin_port == pb->sin_port &&
+           pa->sin_addr.s_addr == pb->sin_addr.s_addr;
+}
+
+// 包来自哪个接收端：非扇出一律算 peers[0]；组播在握手阶段把新的 START_OK 来源登记进来
+static peer_t *sender_peer(sender_t *sn, const struct sockaddr_storage *from, socklen_t flen, int may_add)
+{
+    if (!sn->fanout) return &sn->peers[0];
+    for (int i = 0; i < sn->npeers; ++i) {
+        if (same_addr(&sn->peers[i].addr, from)) return &sn->peers[i];
+    }
+    if (!may_add || !sn->mcast || sn->npeers >= sn->expect) return NULL;
+    peer_t *p = &sn->peers[sn->npeers++];
+    memset(p, 0, sizeof(*p));
+    memcpy(&p->addr, from, sizeof(*from));
+    p->alen = flen;
+    return p;
+}
+
+static const char *addr_str(const struct sockaddr_storage *a, char *out, size_t n)
+{
+    const struct sockaddr_in *in = (const struct sockaddr_in*)a;
+    char ip[INET_ADDRSTRLEN] = "?";
+    inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+    snprintf(out, n, "%s:%u", ip, (unsigned)ntohs(in->sin_port));
+    return out;
+}
+
+static inline seg_t *seg_at(const sender_t *sn, uint64_t seq)
+{
+    return &sn->ring[seq % sn->W];
+}
+
+// 本端窗口 W（环形表）和接收端通告窗口：从 send_base 算
+static inline uint64_t wnd_limit(const sender_t *sn)
+{
+    return sn->send_base + (sn->rwnd < sn->W ? sn->rwnd : sn->W);
+}
+
+// 发送上限（不含）：拥塞窗口限制的是真正在途的包，洞后面已到达的（dupacks）
+// 和 ZERO 区间里除区间头以外的分片都不占拥塞窗口
+static inline uint64_t send_limit(const sender_t *sn)
+{
+    uint64_t lim  = wnd_limit(sn);
+    // 被 SACK / 重复 ACK 计过的分片已离开管道，可以补发同样多的新分片，但最多一个 cwnd：
+    // 洞一直补不上时 dupacks 会越攒越多，不封顶的话在途量会涨到接收窗口
+    uint64_t dup  = sn->dupacks < sn->cc.cwnd ? sn->dupacks : sn->cc.cwnd;
+    uint64_t cwnd = sn->send_base + dup + sn->zero_inflight + sn->cc.cwnd;
+    return cwnd < lim ? cwnd : lim;
+}
+
+static inline uint8_t *seg_data(const sender_t *sn, uint64_t seq)
+{
+    return sn->sbuf + (size_t)(seq % sn->W) * MAX_PAYLOAD;
+}
+
+// 分片长度：除最后一片外都是 MAX_PAYLOAD
+static inline uint32_t seg_len(const sender_t *sn, uint64_t seq)
+{
+    if (sn->stream) return seg_at(sn, seq)->len;
+    uint64_t left = sn->fsz - seq * MAX_PAYLOAD;
+    return (uint32_t)(left < MAX_PAYLOAD ? left : MAX_PAYLOAD);
+}
+
+static void tx_unlink(sender_t *sn, seg_t *sg)
+{
+    if (!sg->on_tx) return;
+    if (sg->tx_prev != TX_NONE) sn->ring[sg->tx_prev].tx_next = sg->tx_next; else sn->tx_head = sg->tx_next;
+    if (sg->tx_next != TX_NONE) sn->ring[sg->tx_next].tx_prev = sg->tx_prev; else sn->tx_tail = sg->tx_prev;
+    sg->on_tx = 0;
+}
+
+static void tx_append(sender_t *sn, seg_t *sg)
+{
+    uint32_t i = (uint32_t)(sg - sn->ring);
+    sg->tx_prev = sn->tx_tail;
+    sg->tx_next = TX_NONE;
+    if (sn->tx_tail != TX_NONE) sn->ring[sn->tx_tail].tx_next = i; else sn->tx_head = i;
+    sn->tx_tail = i;
+    sg->on_tx = 1;
+}
+
+// 槽位 i 上的在途分片号：[send_base, send_base + W) 里唯一 % W == i 的那个
+static inline uint64_t slot_seq(const sender_t *sn, uint32_t i)
+{
+    return sn->send_base + (i + sn->W - sn->send_base % sn->W) % sn->W;
+}
+
+// 发出 seq 后的记账：时间戳、交付状态快照（速率样本用）、清掉已补发的请求位
+static void seg_mark_sent(sender_t *sn, uint64_t seq, uint64_t mask, uint64_t now)
+{
+    seg_t *sg = seg_at(sn, seq);
+    tx_unlink(sn, sg);
+    tx_append(sn, sg);
+    if (sn->next_seq == sn->send_base) {
+        sn->dupacks = 0;
+        sn->first_tx_us = sn->delivered_us = now;   // 空闲后重新开始采样区间
+    }
+    sg->retx         = seq < sn->next_seq;          // 新分片总是从 next_seq 起
+    sg->prev_tx_us   = sg->retx ? sg->last_tx_us : 0;
+    sg->ntx          = !sg->retx ? 1 : sg->ntx < 255 ? sg->ntx + 1 : 255;
+    sg->last_tx_us   = now;
+    sg->delivered    = sn->delivered;
+    sg->delivered_us = sn->delivered_us;
+    sg->first_tx_us  = sn->first_tx_us;
+    sg->app_limited  = sn->app_limited != 0;
+    sg->want        &= ~mask;
+    if (!sg->retx) sg->zero = sg->sacked = 0;       // 槽位复用：由调用方重新标记
+}
+
+// 记一次重传；分片第一次重传时记下它从发出到被判丢用了多久
+static void sender_count_retx(sender_t *sn, uint64_t seq, int why, uint64_t now)
+{
+    const seg_t *sg = seg_at(sn, seq);
+    sn->retx[why]++;
+    sn->tx_cause = (uint8_t)why;
+    if (!sg->retx && sg->last_tx_us) {
+        sn->detect_sum_us += now - sg->last_tx_us;
+        sn->detect_n++;
+    }
+}
+
+// 只给新数据计 pacing，修补重传不推迟新数据
+static void sender_pace(sender_t *sn, uint64_t now)
+{
+    if (sn->cc.pacing_rate <= 0) return;
+    if (sn->next_send_us < now) sn->next_send_us = now;   // 落后不补发突发
+    sn->next_send_us += (uint64_t)(1e6 / sn->cc.pacing_rate);
+}
+
+// 发一个 DATA：负载已在 frame + DATA_HDR_LEN，这里只补头
+// mask：单播列表扇出时要发给哪些接收端（其余情况忽略）
+static void seg_xmit_data(sender_t *sn, uint64_t seq, uint8_t *frame, uint64_t mask, uint64_t now)
+{
+    uint32_t len = seg_len(sn, seq);
+    pkt_t h = {0};
+    h.type = PKT_DATA;
+    h.seq  = (uint32_t)seq;        // 低 32 位，接收端按 next_write_seq 还原
+    h.len  = len;                  // 负载直接读进 frame，不再拷贝
+    size_t flen = wire_encode(frame, MAX_MESS_LEN, &h);
+
+    int copies = sender_xmit(sn, frame, flen, mask);
+    trace_rec(now, TR_TX, sn->tx_cause, seq, len, (uint32_t)copies, 0);
+    sn->tx_cause = TRC_NEW;
+    seg_mark_sent(sn, seq, mask, now);
+    if (!seg_at(sn, seq)->retx) sender_pace(sn, now);
+    sn->total_sent_bytes += (uint64_t)len * (uint64_t)copies;
+}
+
+// [seq, seq+n) 全是零：一个 ZERO 代替 n 个 DATA。新发的区间只有区间头占拥塞窗口和 pacing，
+// 其余分片记在 zero_inflight 里；重发时各分片保持原来的标记
+static void send_zero_run(sender_t *sn, uint64_t seq, uint32_t n, uint64_t mask, uint64_t now)
+{
+    pkt_t h = {0};
+    h.type = PKT_ZERO;
+    h.seq  = (uint32_t)seq;
+    h.nseg = (uint16_t)n;
+    h.len  = seg_len(sn, seq + n - 1);
+    uint8_t out[MAX_MESS_LEN];
+    size_t flen = wire_encode(out, sizeof(out), &h);
+    int copies = sender_xmit(sn, out, flen, mask);
+    trace_rec(now, TR_TX_ZERO, sn->tx_cause, seq, n, (uint32_t)copies, 0);
+    sn->tx_cause = TRC_NEW;
+
+    int fresh = seq >= sn->next_seq;
+    for (uint32_t k = 0; k < n; ++k) seg_mark_sent(sn, seq + k, mask, now);
+    if (!fresh) return;
+    seg_at(sn, seq)->zero = 1;
+    for (uint32_t k = 1; k < n; ++k) seg_at(sn, seq + k)->zero = 2;
+    sn->zero_bytes    += (uint64_t)(n - 1) * MAX_PAYLOAD + h.len;
+    sn->zero_inflight += n - 1;
+    sender_pace(sn, now);
+}
+
+// 重传 / 补发一个分片：全零的分片仍以 ZERO 发
+static void send_one_segment(sender_t *sn, uint64_t seq, uint64_t mask, uint64_t now)
+{
+    if (seg_at(sn, seq)->zero) { send_zero_run(sn, seq, 1, mask, now); return; }
+
+    uint32_t len = seg_len(sn, seq);
+    uint8_t frame[MAX_MESS_LEN];
+    if (sn->stream) {
+        memcpy(frame + DATA_HDR_LEN, seg_data(sn, seq), len);
+    } else {
+        ssize_t n = sn->src.read_at(sn->src.ctx, frame + DATA_HDR_LEN, len, seq * MAX_PAYLOAD);
+        if (n != (ssize_t)len) { sender_fail(sn, "source read failed"); return; }
+    }
+    seg_xmit_data(sn, seq, frame, mask, now);
+}
+
+// 接收端在 START_OK 里声明认识 ZERO 才用；0-RTT 阶段还不知道对方能力
+static inline int zero_ok(const sender_t *sn)
+{
+    return (sn->peer_caps & CAP_ZERO) && !sn->optimistic;
+}
+
+// 全零检测：按 64 字节块做字 OR 归约（编译器可向量化），块内有非零就提前退出
+static int all_zero(const uint8_t *p, size_t len)
+{
+    uint64_t acc = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        uint64_t w[8];
+        memcpy(w, p + i, sizeof(w));
+        acc |= w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7];
+        if (acc) return 0;
+    }
+    for (; i < len; ++i) acc |= p[i];
+    return acc == 0;
+}
+
+// 分片整个落在源文件的空洞里（seek_data 给出的区段缓存一段，顺序发送时很少再问）
+static int seg_in_hole(sender_t *sn, uint64_t seq)
+{
+    if (!sn->src.seek_data) return 0;
+    uint64_t off = seq * MAX_PAYLOAD, end = off + seg_len(sn, seq);
+    if (sn->extent_from == UINT64_MAX || off < sn->extent_from || off >= sn->hole_off) {
+        uint64_t data, hole;
+        if (sn->src.seek_data(sn->src.ctx, off, &data, &hole) != 0) {
+            sn->src.seek_data = NULL;     // 文件系统不支持：以后只靠扫描
+            return 0;
+        }
+        sn->extent_from = off;
+        sn->data_off = data;
+        sn->hole_off = hole > data ? hole : data;
+    }
+    return end <= sn->data_off;
+}
+
+// 读文件分片到 buf；check_zero 时判断是否全零（空洞里的分片不读）。
+// 返回 1 = 全零，0 = 有数据，-1 = 读失败（会话已失败）
+static int seg_load(sender_t *sn, uint64_t seq, uint8_t *buf, int check_zero)
+{
+    uint32_t len = seg_len(sn, seq);
+    if (check_zero && seg_in_hole(sn, seq)) return 1;
+    ssize_t n = sn->src.read_at(sn->src.ctx, buf, len, seq * MAX_PAYLOAD);
+    if (n != (ssize_t)len) { sender_fail(sn, "source read failed"); return -1; }
+    return check_zero && all_zero(buf, len);
+}
+
+// 当前 RTT：srtt 和最近交付分片的往返（rack_rtt_us，排队变长时比 srtt 先涨）中较大者
+static uint64_t cur_rtt(const sender_t *sn)
+{
+    return sn->srtt_us > sn->rack_rtt_us ? sn->srtt_us : sn->rack_rtt_us;
+}
+
+// 补发保护期：一个当前 RTT 内(重)发过的分片不再因 NACK / 重复 ACK 重发，那份可能还在路上
+static uint64_t resend_guard(const sender_t *sn)
+{
+    uint64_t rtt = cur_rtt(sn);
+    return rtt ? rtt : sn->rto_min_us;
+}
+
+// RACK：sg 刚被确认（累积或 SACK），记下已交付分片里最晚的发送时间和它的往返。
+// 发出过多份的分片要先认定确认的是哪一份，认错了会把 rack_xmit_us 推到重传时刻，把之后发出的分片误判丢：
+//   离最近一份还不到 min_rtt 就确认了：是更早的那份，只发过两份时就是 prev_tx_us 那份
+//   更早的几份都已超过两个当前 RTT 没确认：早丢了，是最近一份
+// 都对不上就不用。接收端不带 SACK 时不用：洞补上后累积 ACK 一下跳过的分片早就到了，
+// 发送端看不出洞后面哪些还在路上
+static void rack_update(sender_t *sn, const seg_t *sg, uint64_t now)
+{
+    if (!sn->sack_seen) return;
+    uint64_t tx = sg->last_tx_us;
+    if (sg->ntx > 1) {
+        if (now - sg->last_tx_us < sn->min_rtt_us) {
+            if (sg->ntx > 2) return;
+            tx = sg->prev_tx_us;
+        } else if (now - sg->prev_tx_us <= 2 * cur_rtt(sn)) {
+            return;
+        }
+    }
+    if (tx >= sn->rack_xmit_us) {
+        sn->rack_xmit_us = tx;
+        sn->rack_rtt_us  = now - tx;
+    }
+}
+
+// 速率 / RTT 样本取本次 ACK 新交付的分片里最晚发出、且从没重传过的那片（Karn）
+static void sample_pick(const seg_t **best, const seg_t *sg)
+{
+    if (!sg->retx && (!*best || sg->last_tx_us > (*best)->last_tx_us)) *best = sg;
+}
+
+// [from, to) 已被累积确认：移出发送时间链表。返回其中 ZERO 区间的非头分片数（已从 zero_inflight 扣掉），
+// *sacked = 其中先前被 SACK 过的分片数（不含 ZERO 区间的非头分片，它们已经计进 dupacks）；
+// best 非 NULL 时从这次才交付的（没被 SACK 过的）分片里挑样本
+static uint64_t sender_release(sender_t *sn, uint64_t from, uint64_t to, uint64_t *sacked,
+                               const seg_t **best, uint64_t now)
+{
+    uint64_t tails = 0, sk = 0;
+    for (uint64_t i = from; i < to; ++i) {
+        seg_t *sg = seg_at(sn, i);
+        if (sg->sacked) {
+            sk += sg->zero != 2;
+        } else {
+            rack_update(sn, sg, now);
+            if (best) sample_pick(best, sg);
+        }
+        tx_unlink(sn, sg);
+        tails += sg->zero == 2;
+    }
+    sn->zero_inflight -= tails;
+    if (sacked) *sacked = sk;
+    return tails;
+}
+
+// RTO = srtt + 4 * rttvar（不低于 rto_min），同时清掉超时退避
+static void sender_rto_reset(sender_t *sn)
+{
+    if (sn->srtt_us == 0) return;
+    uint64_t rto = sn->srtt_us + 4 * sn->rttvar_us;
+    sn->rto_us = rto > sn->rto_min_us ? rto : sn->rto_min_us;
+}
+
+// RFC 6298：srtt/rttvar，RTO 不低于调用方给定的下限
+static void sender_rtt_sample(sender_t *sn, uint64_t rtt)
+{
+    if (sn->srtt_us == 0) {
+        sn->srtt_us = rtt;
+        sn->rttvar_us = rtt / 2;
+    } else {
+        uint64_t err = rtt > sn->srtt_us ? rtt - sn->srtt_us : sn->srtt_us - rtt;
+        sn->rttvar_us = (3 * sn->rttvar_us + err) / 4;
+        sn->srtt_us   = (7 * sn->srtt_us + rtt) / 8;
+    }
+    sender_rto_reset(sn);
+    if (sn->min_rtt_us == 0 || rtt < sn->min_rtt_us) sn->min_rtt_us = rtt;
+}
+
+// 累积 ACK 推进 send_base：[send_base, ack_next) 里先前没按重复 ACK / SACK 计过的记为交付，返回新交付的分片数。
+// tails：其中 ZERO 区间的非头分片数，它们没占拥塞窗口，也不算交付；sacked：其中已按 SACK 计过的
+static uint32_t sender_ack_delivered(sender_t *sn, uint64_t ack_next, uint64_t tails, uint64_t sacked, uint64_t now)
+{
+    uint32_t acked = (uint32_t)(ack_next - sn->send_base - tails);
+    // 被重复 ACK / SACK 预先计过的分片不再重复计数（洞本身不会产生重复 ACK）
+    uint64_t dup_max  = sn->sack_seen ? sacked : acked ? acked - 1 : 0;
+    uint64_t dup_used = sn->dupacks < dup_max ? sn->dupacks : dup_max;
+    sn->dupacks -= dup_used;
+    sn->delivered += acked - dup_used;
+    sn->delivered_us = now;
+    return (uint32_t)(acked - dup_used);
+}
+
+// 一个 ACK 一个速率样本（BBR rate sample）：sg 是这次交付的分片里最晚发出的，acked 是新交付的分片数。
+// 区间取“发送区间”和“确认区间”中较长者，避免 ACK 压缩导致高估。
+// rtt_ok：sg 没重传过，往返可以当 RTT 样本
+static void sender_rate_sample(sender_t *sn, const seg_t *sg, uint32_t acked, int rtt_ok, uint64_t now)
+{
+    cc_sample_t rs;
+    memset(&rs, 0, sizeof(rs));
+    sn->first_tx_us = sg->last_tx_us;
+    if (sn->app_limited && sn->delivered > sn->app_limited) sn->app_limited = 0;
+
+    uint64_t snd_iv = sg->last_tx_us - sg->first_tx_us;
+    uint64_t ack_iv = now - sg->delivered_us;
+    uint64_t iv = snd_iv > ack_iv ? snd_iv : ack_iv;
+    if (rtt_ok) {
+        rs.rtt_us = now - sg->last_tx_us;
+        if (rs.rtt_us == 0) rs.rtt_us = 1;
+        sender_rtt_sample(sn, rs.rtt_us);
+    }
+    if (iv > 0) rs.delivery_rate = (double)(sn->delivered - sg->delivered) * 1e6 / (double)iv;
+    // 管道里的量：在途减去 ZERO 区间尾和已被 SACK / 重复 ACK 计过的（DRAIN / PROBE_RTT 按它判断排空）
+    uint64_t out = sn->next_seq - sn->send_base - sn->zero_inflight;
+    rs.now_us          = now;
+    rs.delivered       = sn->delivered;
+    rs.prior_delivered = sg->delivered;
+    rs.acked           = acked;
+    rs.inflight        = (uint32_t)(out > sn->dupacks ? out - sn->dupacks : 0);
+    rs.app_limited     = sg->app_limited;
+    sn->cc.ops->on_ack(&sn->cc, &rs);
+}
+
+// 进入排队：暂停发送，等接收端推 START_OK。
+// 从数据阶段被踢出时接收端还不认识我们，立刻补一个 START 让它入队。
+static void sender_enter_queue(sender_t *sn, uint64_t now, int need_start)
+{
+    sn->phase = SND_QUEUED;
+    if (need_start) send_start(sn, now);
+    sn->start_deadline_us = now + START_RESEND_MS * 1000ULL;
+}
+
+// 还没确认 seq 的接收端（超时重传只发给它们）
+static uint64_t sender_lagging(const sender_t *sn, uint64_t seq)
+{
+    uint64_t m = 0;
+    for (int i = 0; i < sn->npeers; ++i) {
+        if (!sn->peers[i].gone && sn->peers[i].acked <= seq) m |= 1ULL << i;
+    }
+    return m;
+}
+
+// 扇出：send_base = 所有在场接收端累积确认的最小值，通告窗口取最紧的那个。
+// 接收端全走光时会话失败，send_base 不动
+static uint64_t sender_min_acked(sender_t *sn)
+{
+    uint64_t base = UINT64_MAX, lim = UINT64_MAX;
+    for (int i = 0; i < sn->npeers; ++i) {
+        const peer_t *p = &sn->peers[i];
+        if (p->gone) continue;
+        if (p->acked < base) base = p->acked;
+        if (p->acked + p->rwnd < lim) lim = p->acked + p->rwnd;
+    }
+    if (base == UINT64_MAX) {
+        sender_fail(sn, "all receivers dropped the session");
+        return sn->send_base;
+    }
+    sn->rwnd = (uint32_t)(lim > base ? lim - base : 0);
+    return base;
+}
+
+// 换窗口：只在还没发数据时做（探测之后），环形表和流式缓存按新大小重建
+static int sender_set_window(sender_t *sn, uint32_t W, uint64_t now)
+{
+    seg_t *ring = (seg_t*)calloc(W, sizeof(seg_t));
+    uint8_t *sbuf = sn->stream ? (uint8_t*)malloc((size_t)W * MAX_PAYLOAD) : NULL;
+    if (!ring || (sn->stream && !sbuf)) {
+        free(ring);
+        free(sbuf);
+        return -1;                 // 内存不够就保持原窗口
+    }
+    free(sn->ring);
+    free(sn->sbuf);
+    sn->ring = ring;
+    sn->sbuf = sbuf;
+    sn->W = W;
+    cc_init(&sn->cc, sn->cc.ops, W, now);
+    return 0;
+}
+
+static void sender_probe_train(sender_t *sn, uint64_t now)
+{
+    uint8_t out[MAX_MESS_LEN];
+    memset(out, 0, sizeof(out));
+    pkt_t pr = {0};
+    pr.type = PKT_PROBE;
+    pr.seq  = (uint32_t)sn->train_round + 1;
+    pr.nseg = PROBE_TRAIN[sn->train_round];
+    pr.len  = (uint32_t)(MAX_MESS_LEN - wire_hdr_len(PKT_PROBE));   // 满长度，和 DATA 一样过瓶颈
+    for (uint16_t i = 0; i < pr.nseg; ++i) {
+        pr.idx = i;
+        size_t n = wire_encode(out, sizeof(out), &pr);
+        sender_xmit(sn, out, n, ALL_PEERS);
+    }
+    // 发出就计数：报告丢了或超时的串也要算进丢包率，不然丢得越狠估得越低
+    for (int i = 0; i < sn->npeers; ++i) {
+        if (!sn->peers[i].gone) sn->probe_sent += pr.nseg;
+    }
+    // 一串在同一次调用里发完，各包共用发出时间。等待时间按已知最慢的往返
+    uint64_t rtt = sn->hs_rtt_us;
+    for (int i = 0; i < sn->npeers; ++i) {
+        if (sn->peers[i].probe_rtt_us > rtt) rtt = sn->peers[i].probe_rtt_us;
+    }
+    sn->train_tx_us = now;
+    sn->train_deadline_us = now + (rtt ? 2 * rtt + PROBE_GRACE_US : PROBE_WAIT_MS * 1000ULL);
+}
+
+// 丢包率：没有一串有报告时是“?”，不要显示成 0%
+static const char *probe_loss_str(const ncp_probe_t *r, char *buf, size_t len)
+{
+    if (r->loss < 0) snprintf(buf, len, "?");
+    else snprintf(buf, len, "%.1f%%", r->loss * 100.0);
+    return buf;
+}
+
+// 探测结束：取最慢的接收端的 RTT、最窄的带宽，定 RTO / 窗口，给拥塞控制起步，进入数据阶段
+static void sender_probe_done(sender_t *sn, uint64_t now)
+{
+    ncp_probe_t *r = &sn->probe_res;
+    r->rtt_us = 0;
+    r->bw = 0;
+    for (int i = 0; i < sn->npeers; ++i) {
+        const peer_t *p = &sn->peers[i];
+        if (p->gone) continue;
+        if (p->probe_rtt_us > r->rtt_us) r->rtt_us = p->probe_rtt_us;
+        if (p->probe_bw > 0 && (r->bw == 0 || p->probe_bw < r->bw)) r->bw = p->probe_bw;
+    }
+    r->loss = sn->probe_reports ? 1.0 - (double)sn->probe_got / (double)sn->probe_sent : -1;
+    r->done = 1;
+
+    if (sn->auto_rto && r->rtt_us) {
+        uint64_t lo = PROBE_RTO_MIN_MS * 1000ULL;
+        sn->rto_min_us = 4 * r->rtt_us > lo ? 4 * r->rtt_us : lo;
+    }
+    if (sn->auto_window) {
+        uint32_t max = sn->stream ? PROBE_W_STREAM_MAX : PROBE_W_MAX;
+        uint32_t W = PROBE_W_FALLBACK;
+        if (r->bw > 0 && r->rtt_us) {
+            double loss = r->loss < 0 ? 0 : r->loss < 0.5 ? r->loss : 0.5;   // 丢包要补的洞也占窗口
+            double w = 2 * r->bw * (double)r->rtt_us / 1e6 / (1 - loss);
+            W = w < PROBE_W_MIN ? PROBE_W_MIN : w > max ? max : (uint32_t)w;
+        }
+        if (W != sn->W) sender_set_window(sn, W, now);
+    }
+    sn->rto_us = sn->rto_min_us;
+    if (r->rtt_us) sender_rtt_sample(sn, r->rtt_us);
+    cc_seed(&sn->cc, r->bw, r->rtt_us, now);
+    char loss[16];
+    probe_loss_str(r, loss, sizeof(loss));
+    LOG(sn, "[SND] probe: rtt %.3f ms, bw %.2f Mb/s, loss %s -> window %u, rto_min %.0f ms\n",
+        r->rtt_us / 1000.0, r->bw * MAX_PAYLOAD * 8.0 / 1e6, loss, sn->W, sn->rto_min_us / 1000.0);
+    sn->phase = SND_DATA;
+}
+
+static void sender_probe_next(sender_t *sn, uint64_t now)
+{
+    if (++sn->train_round < PROBE_ROUNDS) sender_probe_train(sn, now);
+    else sender_probe_done(sn, now);
+}
+
+// 会话已确认：第一次进数据阶段前先探测（对端不认识 PROBE 就直接开始）
+static void sender_begin_data(sender_t *sn, uint64_t now)
+{
+    if (sn->probe && !sn->probe_res.done && sn->next_seq == 0 && (sn->peer_caps & CAP_PROBE)) {
+        sn->phase = SND_PROBE;
+        sn->train_round = 0;
+        sender_probe_train(sn, now);
+        return;
+    }
+    sn->phase = SND_DATA;
+}
+
+static void sender_on_probe_report(sender_t *sn, peer_t *p, const pkt_t *rh, uint64_t now)
+{
+    uint16_t n = PROBE_TRAIN[sn->train_round];
+    if (rh->seq != (uint32_t)sn->train_round + 1 || p->train_seen == sn->train_round + 1) return;
+    p->train_seen = sn->train_round + 1;
+    sn->probe_reports++;
+    sn->probe_got += rh->nseg < n ? rh->nseg : n;
+    // 整串同时发出：RTT = 报告到达 - 发出 - 接收端压着报告的时间
+    uint64_t rtt = now - sn->train_tx_us;
+    rtt = rtt > rh->hold_us ? rtt - rh->hold_us : 1;
+    if (p->probe_rtt_us == 0 || rtt < p->probe_rtt_us) p->probe_rtt_us = rtt;
+    // 瓶颈把一串拉开：到达间隔里过去了 got - 1 个满长度包
+    if (rh->nseg >= 2 && rh->disp_us > 0) {
+        double bw = (rh->nseg - 1) * 1e6 / rh->disp_us;
+        if (bw > p->probe_bw) p->probe_bw = bw;
+    }
+    for (int i = 0; i < sn->npeers; ++i) {
+        const peer_t *q = &sn->peers[i];
+        if (!q->gone && q->train_seen != sn->train_round + 1) return;
+    }
+    sender_probe_next(sn, now);
+}
+
+static void sender_on_start_ok(sender_t *sn, peer_t *p, const pkt_t *rh, uint64_t now)
+{
+    if (sn->phase == SND_HANDSHAKE && sn->hs_rtt_us == 0) sn->hs_rtt_us = now - sn->start_tx_us;
+    if (sn->fanout) {
+        // 扇出（不支持 0-RTT）：等齐所有接收端再进入数据阶段
+        if (sn->phase != SND_HANDSHAKE || p->granted) return;
+        // 能力位取所有接收端的交集：第一个加入的直接拿它的（单播列表 npeers 一开始就是全数）
+        int first = 1;
+        for (int i = 0; i < sn->npeers; ++i) first = first && !sn->peers[i].granted;
+        p->granted = 1;
+        p->rwnd = rh->wnd;
+        sn->peer_caps = first ? rh->caps : (sn->peer_caps & rh->caps);
+        char who[64];
+        LOG(sn, "[SND] receiver %s joined\n", addr_str(&p->addr, who, sizeof(who)));
+        int ready = sn->mcast ? sn->npeers == sn->expect : 1;
+        for (int i = 0; i < sn->npeers; ++i) ready = ready && sn->peers[i].granted;
+        if (ready) {
+            sn->was_granted = 1;
+            sender_min_acked(sn);
+            sender_begin_data(sn, now);
+        }
+        return;
+    }
+    if (sn->phase == SND_DATA && sn->optimistic) {
+        // 0-RTT 成功：已发出的数据被接收端缓存，不用重发
+        sn->optimistic = 0;
+        sn->was_granted = 1;
+        sn->peer_caps = rh->caps;
+        sn->rwnd = p->rwnd = rh->wnd;
+    } else if (sn->phase == SND_HANDSHAKE || sn->phase == SND_QUEUED) {
+        if (sn->next_seq > 0) {
+            // 接收端没有我们已发的数据（旧会话被清理 / 0-RTT 数据被拒）：从头再来
+            if (!sn->stream) {
+                memset(sn->ring, 0, sizeof(seg_t) * sn->W);
+                sn->tx_head = sn->tx_tail = TX_NONE;
+                sn->send_base = sn->next_seq = 0;
+                sn->dupacks = sn->zero_inflight = 0;
+                sn->rack_xmit_us = 0;
+                p->acked = 0;
+            } else if (sn->send_base == 0) {
+                // 缓存里还有全部已发数据：立即全部重发
+                // 全部在途分片都置 0，发送时间链表的顺序仍然成立；被 SACK 过的也已丢失，放回链表
+                for (uint64_t i = 0; i < sn->next_seq; ++i) {
+                    seg_t *sg = seg_at(sn, i);
+                    sg->last_tx_us = 0;
+                    sg->sacked = 0;
+                    if (!sg->on_tx) tx_append(sn, sg);
+                }
+                sn->dupacks = 0;
+                sn->rack_xmit_us = 0;
+            } else {
+                sender_fail(sn, "receiver restarted the session, stream input cannot be replayed");
+                return;
+            }
+        }
+        sn->was_granted = 1;
+        sn->peer_caps = rh->caps;
+        sn->rwnd = p->rwnd = rh->wnd;
+        sender_begin_data(sn, now);
+    }
+}
+
+static void sender_on_busy(sender_t *sn, peer_t *p, const pkt_t *rh, uint64_t now)
+{
+    if (sn->fanout) {
+        char who[64];
+        if (sn->phase == SND_HANDSHAKE && !p->granted) {
+            // 它在服务别人：START 照常每 500ms 重发，就是排队保活
+            LOG(sn, "[SND] receiver %s busy, queue position %u\n", addr_str(&p->addr, who, sizeof(who)), rh->seq);
+        } else if (sn->phase == SND_DATA && !p->gone) {
+            p->gone = 1;
+            LOG(sn, "[SND] receiver %s dropped the session, continuing without it\n",
+                addr_str(&p->addr, who, sizeof(who)));
+            uint64_t base = sender_min_acked(sn);
+            if (base > sn->send_base) {
+                sender_release(sn, sn->send_base, base, NULL, NULL, now);
+                sn->send_base = base;
+            }
+        }
+        return;
+    }
+    if (sn->phase == SND_HANDSHAKE) {
+        sender_enter_queue(sn, now, 0);
+    } else if (sn->phase == SND_DATA && sn->optimistic) {
+        // 0-RTT 数据被丢弃：退回普通排队，放行后重发
+        sn->optimistic = 0;
+        sender_enter_queue(sn, now, rh->seq == 0);
+        LOG(sn, "[SND] Receiver is busy, falling back to queued start.\n");
+    } else if (sn->phase == SND_DATA) {
+        // 接收端正服务别人（我们的会话已被它清理）→ 重新排队
+        sender_enter_queue(sn, now, 1);
+        LOG(sn, "[SND] Receiver is busy, I was blocked.\n");
+    }
+    // BUSY.seq = 排队位置（对 START 的回应，或队头前移时接收端主动通知）
+    if (sn->phase == SND_QUEUED && rh->seq != 0 && rh->seq != sn->queue_pos) {
+        sn->queue_pos = rh->seq;
+        LOG(sn, "[SND] Queued at receiver, position %u\n", sn->queue_pos);
+    }
+}
+
+// SACK：[lo, lo+n) 已收进接收端缓冲。移出发送时间链表（不再超时重传），按收到的分片计进 dupacks，
+// 并推进 RACK 的最晚交付时间；洞前面更早发出的分片由 RACK 判丢。新 SACK 的分片也参与挑选速率 / RTT 样本，
+// 有洞的时候样本照样更新。返回新交付的分片数。
+// 接收端报的是洞后面那一整段，前面的部分上一个 ACK 多半已报过：从高往低走，遇到已标记的就停
+static uint32_t sender_on_sack(sender_t *sn, uint64_t lo, uint32_t n, const seg_t **best, uint64_t now)
+{
+    uint64_t hi = lo + n;
+    if (lo < sn->send_base) lo = sn->send_base;
+    if (hi > sn->next_seq) hi = sn->next_seq;
+    int fresh = 0;
+    uint32_t newly = 0;
+    for (uint64_t i = hi; i-- > lo; ) {
+        seg_t *sg = seg_at(sn, i);
+        if (sg->sacked) break;
+        sg->sacked = 1;
+        tx_unlink(sn, sg);
+        rack_update(sn, sg, now);
+        sample_pick(best, sg);
+        uint64_t rtt = now - sg->last_tx_us;
+        if (!sg->retx && (sn->min_rtt_us == 0 || rtt < sn->min_rtt_us)) sn->min_rtt_us = rtt;
+        if (sg->zero != 2) {
+            sn->dupacks++;
+            sn->delivered++;
+            newly++;
+        }
+        fresh = 1;
+    }
+    if (fresh) {
+        sn->delivered_us = now;
+        sn->tlp_out = 0;
+    }
+    return newly;
+}
+
+static void sender_on_ack(sender_t *sn, peer_t *p, const pkt_t *rh, uint64_t now)
+{
+    if (sn->optimistic) {       // 接收端只在会话内 ACK：等同于 START_OK
+        sn->optimistic = 0;
+        sn->was_granted = 1;
+    }
+    // 累积 ACK：确认该接收端的 [acked .. ack]，出窗的槽位在 next_seq 走到时复用。
+    // 按线上 32 位先 +1 再还原，接收端还没收到任何分片时 ack = -1 也能处理。
+    uint64_t ack_next = seq_extend(p->acked, rh->seq + 1);
+    // 扇出时没有重复 ACK 计数：该接收端一次只前进一片才算按序到达
+    int in_order = sn->fanout ? ack_next == p->acked + 1 : sn->dupacks == 0;
+    if (ack_next > p->acked && ack_next <= sn->next_seq) p->acked = ack_next;
+    // 每个 ACK 都带窗口；ack 不前进的纯窗口更新也要处理
+    if (ack_next >= p->acked) p->rwnd = rh->wnd;
+
+    uint64_t base = p->acked, prev = sn->send_base;
+    if (sn->fanout) {
+        base = sender_min_acked(sn);
+    } else {
+        sn->rwnd = p->rwnd;
+    }
+    int sack = !sn->fanout && (rh->flags & WIRE_ACK_SACK);
+    trace_rec(now, TR_ACK_IN, (uint8_t)(p - sn->peers), ack_next, rh->wnd,
+              (rh->flags & WIRE_ACK_SACK) ? rh->nseg : 0, rh->sack);
+    if (sack && !sn->sack_seen) {
+        sn->sack_seen = 1;
+        sn->dupacks = 0;           // 之后按 SACK 精确计数，丢掉此前的估计
+    }
+    // 样本：接收端带 SACK 时取新交付（累积确认或 SACK）的分片里最晚发出的未重传分片，不管前面有没有洞；
+    // 不带 SACK / 扇出时看不出洞后面哪些早就到了，仍只在没越过洞时拿最后一片的往返当 RTT
+    const seg_t *best = NULL;
+    uint32_t newly = 0;
+    if (base > prev) {
+        uint64_t sacked;
+        uint64_t tails = sender_release(sn, prev, base, &sacked, sack ? &best : NULL, now);
+        newly = sender_ack_delivered(sn, base, tails, sacked, now);
+        if (!sack) {
+            const seg_t *last = seg_at(sn, base - 1);   // 仍在 [send_base, next_seq) 内，槽未复用
+            sender_rate_sample(sn, last, newly, !last->retx && in_order, now);
+        }
+        sn->send_base = base;
+        sn->dup_run = 0;
+        sn->tlp_out = 0;
+    } else if (!sn->fanout && !sn->sack_seen && ack_next == prev && prev < sn->next_seq) {
+        // 重复 ACK（接收端不带 SACK）：接收端每收一片都回 ACK，ack 不动说明洞后面又到了一片
+        if (sn->dupacks + 1 < sn->next_seq - prev) {
+            sn->dupacks++;
+            sn->delivered++;
+            sn->delivered_us = now;
+        }
+        // 快速重传：连续第 DUPACK_THRESH 个重复 ACK 时重传洞（一个 RTT 内 NACK 已补过就不再发）
+        uint64_t guard = resend_guard(sn);
+        if (++sn->dup_run == DUPACK_THRESH && now - seg_at(sn, prev)->last_tx_us >= guard) {
+            sender_count_retx(sn, prev, TRC_DUPACK, now);
+            send_one_segment(sn, prev, ALL_PEERS, now);
+        }
+    }
+    if (sack) {
+        newly += sender_on_sack(sn, seq_extend(sn->send_base, rh->sack), rh->nseg, &best, now);
+        if (best) {
+            sender_rate_sample(sn, best, newly, 1, now);
+        } else if (base > prev) {
+            sender_rate_sample(sn, seg_at(sn, base - 1), newly, 0, now);   // 全是重传：只记交付量
+        }
+    }
+    if (newly) sender_rto_reset(sn);   // 有新数据交付说明路径通了，退避作废（同 Linux 清 backoff）
+    trace_rec(now, TR_STATE, 0, sn->send_base, sn->cc.cwnd, (uint32_t)sn->rto_us,
+              (uint32_t)(sn->next_seq - sn->send_base));
+    if (sn->rwnd > 0) {
+        sn->probe_deadline_us = 0;
+    } else if (sn->probe_deadline_us == 0) {
+        // 窗口关死：启动持续计时器，等在途的都确认后开始探测
+        sn->probe_backoff_us = sn->rto_us;
+        sn->probe_deadline_us = now + sn->probe_backoff_us;
+    }
+}
+
+// NACK 带洞列表：把缺的分片记进待补发位图，统一在 sender_on_timer 里补发。
+// 扇出时多等 REPAIR_HOLD_US，让各接收端对同一分片的请求合并成一次重传；
+// 单接收端 / 组播下一个当前 RTT 内(重)发过的分片（比如 RACK 刚判丢重发的），迟到的 NACK 不再触发重传。
+static void sender_on_nack(sender_t *sn, peer_t *p, const pkt_t *rh, uint64_t now)
+{
+    int idx = (int)(p - sn->peers);
+    uint64_t first = seq_extend(p->acked, rh->seq);
+    uint64_t guard = resend_guard(sn);
+    int marked = 0;
+    if (trace_on) {
+        uint32_t missing = 0;
+        for (int b = 0; b < rh->nblk; ++b) missing += rh->blk[b].len;
+        trace_put(now, TR_NACK_IN, (uint8_t)idx, first, rh->nblk, missing, 0);
+    }
+    for (int b = 0; b < rh->nblk; ++b) {
+        for (uint32_t k = 0; k < rh->blk[b].len; ++k) {
+            uint64_t want = first + rh->blk[b].off + k;
+            if (want < sn->send_base || want < p->acked || want >= sn->next_seq) continue;
+            seg_t *sg = seg_at(sn, want);
+            if (sg->sacked || ((!sn->fanout || sn->mcast) && now - sg->last_tx_us < guard)) continue;
+            sg->want |= 1ULL << idx;
+            if (sn->repair_deadline_us == 0 && !marked) {
+                sn->repair_lo = want;
+                sn->repair_hi = want + 1;
+            }
+            if (want < sn->repair_lo) sn->repair_lo = want;
+            if (want + 1 > sn->repair_hi) sn->repair_hi = want + 1;
+            marked = 1;
+        }
+    }
+    if (marked && sn->repair_deadline_us == 0) {
+        sn->repair_deadline_us = now + (sn->fanout ? REPAIR_HOLD_US : 0);
+    }
+}
+
+// 还没回 FIN_ACK 的接收端
+static uint64_t sender_unconfirmed(const sender_t *sn)
+{
+    uint64_t m = 0;
+    for (int i = 0; i < sn->npeers; ++i) {
+        if (!sn->peers[i].gone && !sn->peers[i].fin_acked) m |= 1ULL << i;
+    }
+    return m;
+}
+
+// FIN_ACK 带回接收端这次会话的统计；所有在场接收端都确认后结束
+static void sender_on_fin_ack(sender_t *sn, peer_t *p, const pkt_t *rh)
+{
+    if (p->fin_acked || rh->seq != (uint32_t)(sn->total_segs > 0 ? sn->total_segs - 1 : 0)) return;
+    p->fin_acked = 1;
+    sn->confirmed++;
+    char who[64];
+    double secs = rh->ms / 1000.0;
+    LOG(sn, "[SND] receiver %s confirmed: %.2f MB in %.2f s, goodput %.2f Mb/s\n",
+        addr_str(&p->addr, who, sizeof(who)), rh->file_size / (1024.0*1024.0), secs,
+        secs > 0 ? rh->file_size * 8.0 / secs / 1e6 : 0.0);
+    if (sender_unconfirmed(sn) == 0) sn->phase = SND_DONE;
+}
+
+static void sender_on_packet(sender_t *sn, const uint8_t *rbuf, size_t rcvd,
+                             const struct sockaddr_storage *from, socklen_t flen, uint64_t now)
+{
+    pkt_t pk;
+    if (sn->phase == SND_DONE || sn->phase == SND_FAILED) return;
+    if (wire_decode(rbuf, rcvd, &pk) != 0) return;
+    const pkt_t *rh = &pk;
+    peer_t *p = sender_peer(sn, from, flen, rh->type == PKT_START_OK);
+    if (!p) return;
+
+    switch (rh->type) {
+    case PKT_START_OK:
+        sender_on_start_ok(sn, p, rh, now);
+        break;
+    case PKT_BUSY:
+        sender_on_busy(sn, p, rh, now);
+        break;
+    case PKT_ACK:
+        if (sn->phase != SND_DATA || p->gone) break;
+        sender_on_ack(sn, p, rh, now);
+        break;
+    case PKT_NACK:
+        if (sn->phase != SND_DATA || p->gone) break;
+        sender_on_nack(sn, p, rh, now);
+        break;
+    case PKT_PROBE_REPORT:
+        if (sn->phase != SND_PROBE || p->gone) break;
+        sender_on_probe_report(sn, p, rh, now);
+        break;
+    case PKT_FIN_ACK:
+        if (sn->phase != SND_CLOSING || p->gone) break;
+        sender_on_fin_ack(sn, p, rh);
+        break;
+    default:
+        break;
+    }
+}
+
+// 乱序窗口：RACK 判丢前多等这么久，容忍轻微乱序
+static inline uint64_t rack_reo_wnd(const sender_t *sn)
+{
+    return sn->min_rtt_us / 4;
+}
+
+// 在途分片判丢：超时（RTO），或比最晚交付的那片更早发出、且已过 rack_rtt + 乱序窗口（RACK，单接收端）
+static inline int seg_lost(const sender_t *sn, const seg_t *sg, uint64_t now)
+{
+    if (now - sg->last_tx_us > sn->rto_us) return 1;
+    return sn->rack_xmit_us && sg->last_tx_us < sn->rack_xmit_us &&
+           now >= sg->last_tx_us + sn->rack_rtt_us + rack_reo_wnd(sn);
+}
+
+// 尾部探测（TLP）：最后发出的分片 PTO 内没有任何确认，可能是窗口尾部整段丢了，
+// 后面没有分片能让 RACK / 重复 ACK 发现，就重发它一次换回一个 ACK，不必等 RTO。0 = 不需要
+static uint64_t tlp_deadline(const sender_t *sn)
+{
+    if (sn->tlp_out || sn->tx_tail == TX_NONE || sn->srtt_us == 0) return 0;
+    uint64_t pto = 2 * sn->srtt_us > TLP_MIN_US ? 2 * sn->srtt_us : TLP_MIN_US;
+    if (pto >= sn->rto_us) return 0;
+    return sn->ring[sn->tx_tail].last_tx_us + pto;
+}
+
+// 重发从 seq 开始的全零分片：后面紧挨着、同样要发给 mask 的全零分片并进同一个 ZERO。
+// by_want：补发 NACK 请求（看 want）；否则是判丢重传（看 seg_lost 和还没确认的接收端）。返回下一个要看的分片
+static uint64_t zero_run_from(sender_t *sn, uint64_t seq, uint64_t mask, uint64_t now, int by_want)
+{
+    uint64_t end = seq + 1;
+    while (end < sn->next_seq && end - seq < ZERO_RUN_MAX) {
+        const seg_t *sg = seg_at(sn, end);
+        if (!sg->zero || sg->sacked) break;
+        if (by_want ? sg->want != mask
+                    : (!seg_lost(sn, sg, now) || sender_lagging(sn, end) != mask)) break;
+        end++;
+    }
+    send_zero_run(sn, seq, (uint32_t)(end - seq), mask, now);
+    return end;
+}
+
+// 处理到期事件：START 重发、判丢重传（Selective Repeat）
+static void sender_expire(sender_t *sn, uint64_t now)
+{
+    if (sn->phase == SND_HANDSHAKE) {
+        if (now >= sn->start_deadline_us) {
+            send_start(sn, now);
+            sn->start_deadline_us = now + START_RESEND_MS * 1000ULL;
+        }
+    } else if (sn->phase == SND_QUEUED) {
+        if (now >= sn->start_deadline_us) {
+            // 保活：让接收端知道我们还在排队；若推来的 START_OK 丢了，它会再回一次
+            send_start(sn, now);
+            sn->start_deadline_us = now + START_RESEND_MS * 1000ULL;
+        }
+    } else if (sn->phase == SND_DATA) {
+        if (sn->optimistic && now >= sn->start_deadline_us) {
+            send_start(sn, now);                 // START 可能丢了：保活重发
+            sn->start_deadline_us = now + START_RESEND_MS * 1000ULL;
+        }
+        if (sn->repair_deadline_us && now >= sn->repair_deadline_us) {
+            // 补发 NACK 请求过的分片：组播一次发完，单播列表只发给请求者
+            sn->repair_deadline_us = 0;
+            uint64_t lo = sn->repair_lo > sn->send_base ? sn->repair_lo : sn->send_base;
+            uint64_t hi = sn->repair_hi < sn->next_seq ? sn->repair_hi : sn->next_seq;
+            for (uint64_t i = lo; i < hi; ) {
+                const seg_t *sg = seg_at(sn, i);
+                uint64_t want = sg->want;
+                if (want) sender_count_retx(sn, i, TRC_NACK, now);
+                if (want && sg->zero) { i = zero_run_from(sn, i, want, now, 1); continue; }
+                if (want) send_one_segment(sn, i, want, now);
+                ++i;
+            }
+        }
+        // 判丢重传：从发送时间链表头取，重发后移到表尾，遇到还不算丢的就停（链表按发送时间排序）
+        int timed_out = 0;
+        while (sn->phase == SND_DATA && sn->tx_head != TX_NONE) {
+            const seg_t *sg = &sn->ring[sn->tx_head];
+            if (!seg_lost(sn, sg, now)) break;
+            uint64_t i = slot_seq(sn, sn->tx_head);
+            int rto = now - sg->last_tx_us > sn->rto_us;
+            timed_out |= rto;
+            sender_count_retx(sn, i, rto ? TRC_RTO : TRC_RACK, now);
+            if (sg->zero) zero_run_from(sn, i, sender_lagging(sn, i), now, 0);
+            else send_one_segment(sn, i, sender_lagging(sn, i), now);
+        }
+        if (timed_out) {
+            // RFC 6298 5.5：每次超时 RTO 翻倍，直到有新数据被确认。否则排在后面、只晚发出一点的
+            // 分片会每隔一两毫秒一个接一个地跟着超时
+            uint64_t max_us = RTO_MAX_MS * 1000ULL;
+            if (sn->rto_us < max_us) sn->rto_us = sn->rto_us * 2 < max_us ? sn->rto_us * 2 : max_us;
+        }
+        uint64_t tlp = tlp_deadline(sn);
+        if (sn->phase == SND_DATA && tlp && now >= tlp) {
+            uint64_t i = slot_seq(sn, sn->tx_tail);
+            sn->tlp_out = 1;
+            sender_count_retx(sn, i, TRC_TLP, now);
+            send_one_segment(sn, i, sender_lagging(sn, i), now);
+        }
+        if (sn->probe_deadline_us && now >= sn->probe_deadline_us) {
+            // 零窗口且没有在途数据：没有 ACK 会自己回来，主动探测（窗口更新丢了也靠它恢复）
+            if (sn->next_seq == sn->send_base) {
+                pkt_t pr = {0};
+                pr.type = PKT_WND_PROBE;
+                pr.seq  = (uint32_t)sn->send_base;
+                uint8_t out[MAX_MESS_LEN];
+                size_t n = wire_encode(out, sizeof(out), &pr);
+                sender_xmit(sn, out, n, ALL_PEERS);
+            }
+            uint64_t max_us = PROBE_MAX_MS * 1000ULL;
+            sn->probe_backoff_us = (sn->probe_backoff_us * 2 < max_us) ? sn->probe_backoff_us * 2 : max_us;
+            sn->probe_deadline_us = now + sn->probe_backoff_us;
+        }
+    } else if (sn->phase == SND_PROBE && now >= sn->train_deadline_us) {
+        sender_probe_next(sn, now);     // 报告丢了 / 接收端没收到这一串：不等了
+    } else if (sn->phase == SND_CLOSING && now >= sn->fin_deadline_us) {
+        if (sn->fin_tries >= FIN_TRIES) {
+            // 数据都已被确认，只是没等到确认收尾：照常结束
+            LOG(sn, "[SND] no FIN_ACK after %d FINs, finishing anyway\n", sn->fin_tries);
+            sn->phase = SND_DONE;
+            return;
+        }
+        sender_xmit(sn, sn->fin_pkt, sn->fin_len, sn->fanout ? sender_unconfirmed(sn) : ALL_PEERS);
+        sn->fin_tries++;
+        sn->fin_backoff_us *= 2;
+        sn->fin_deadline_us = now + sn->fin_backoff_us;
+    }
+}
+
+// pacing：允许比 next_send_us 最多提前一个 quantum，一次唤醒发出一小批
+static inline int sender_pacing_ok(const sender_t *sn, uint64_t now)
+{
+    return sn->cc.pacing_rate <= 0 || sn->next_send_us <= now + PACING_QUANTUM_US;
+}
+
+// 流式输入：非阻塞读入 next_seq 的槽，攒满一片（或 EOF）就发出去。
+// 读到 EOF 才知道总长度和分片总数。
+static void sender_fill_from_stream(sender_t *sn, uint64_t now)
+{
+    while (!sn->in_eof && sn->next_seq < send_limit(sn) && sender_pacing_ok(sn, now) &&
+           sn->phase == SND_DATA) {
+        uint8_t *dst = seg_data(sn, sn->next_seq) + sn->stage_len;
+        ssize_t r = sn->src.read(sn->src.ctx, dst, MAX_PAYLOAD - sn->stage_len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // 窗口有空位却没数据：这段时间的速率样本不代表链路能力
+                sn->app_limited = sn->delivered + (sn->next_seq - sn->send_base);
+                if (sn->app_limited == 0) sn->app_limited = 1;
+                return;
+            }
+            sender_fail(sn, "source read failed");
+            return;
+        }
+        if (r == 0) sn->in_eof = 1;
+        sn->stage_len += (uint32_t)r;
+        sn->fsz += (uint64_t)r;
+        if (sn->stage_len == MAX_PAYLOAD || (sn->in_eof && sn->stage_len > 0)) {
+            seg_t *sg = seg_at(sn, sn->next_seq);
+            sg->len  = sn->stage_len;   // 最后一片可能不满
+            sg->zero = 0;
+            sn->stage_len = 0;
+            // 流式输入按片判断，不合并成区间
+            if (zero_ok(sn) && all_zero(seg_data(sn, sn->next_seq), sg->len)) {
+                send_zero_run(sn, sn->next_seq, 1, ALL_PEERS, now);
+            } else {
+                send_one_segment(sn, sn->next_seq, ALL_PEERS, now);
+            }
+            sn->next_seq++;
+        }
+        if (sn->in_eof) sn->total_segs = sn->next_seq;
+    }
+}
+
+// 窗口内全确认 → 发 FIN。接收端支持 FIN_ACK 时进入 CLOSING，等它确认收齐再结束
+static void sender_finish(sender_t *sn, uint64_t now)
+{
+    pkt_t fin = {0};
+    fin.type = PKT_FIN;
+    fin.seq  = (uint32_t)((sn->total_segs > 0) ? (sn->total_segs - 1) : 0);
+    fin.file_size = sn->fsz;
+    sn->fin_len = wire_encode(sn->fin_pkt, sizeof(sn->fin_pkt), &fin);
+    sender_xmit(sn, sn->fin_pkt, sn->fin_len, ALL_PEERS);
+    if (!(sn->peer_caps & CAP_FIN_ACK)) {
+        sn->phase = SND_DONE;      // 老接收端：只发一次 FIN
+        return;
+    }
+    sn->phase = SND_CLOSING;
+    sn->fin_tries = 1;
+    sn->fin_backoff_us = sn->rto_us;
+    sn->fin_deadline_us = now + sn->fin_backoff_us;
+}
+
+// 尽量填满窗口；全部确认后进入 DONE。
+// 全零分片连同后面连续的全零分片合成一个 ZERO，区间只受本端/接收端窗口限制
+static void sender_fill_window(sender_t *sn, uint64_t now)
+{
+    if (sn->phase != SND_DATA) return;
+    if (sn->send_base >= sn->total_segs) { sender_finish(sn, now); return; }
+    if (sn->stream) { sender_fill_from_stream(sn, now); return; }
+    uint8_t frame[MAX_MESS_LEN], scratch[MAX_PAYLOAD];
+    int zok = zero_ok(sn);
+    while (sn->phase == SND_DATA && sn->next_seq < sn->total_segs && sn->next_seq < send_limit(sn) &&
+           sender_pacing_ok(sn, now)) {
+        uint64_t seq = sn->next_seq;
+        int z = seg_load(sn, seq, frame + DATA_HDR_LEN, zok);
+        if (z < 0) return;
+        if (!z) {
+            seg_xmit_data(sn, seq, frame, ALL_PEERS, now);
+            sn->next_seq++;
+            continue;
+        }
+        uint64_t end = seq + 1, lim = wnd_limit(sn);
+        while (end < sn->total_segs && end < lim && end - seq < ZERO_RUN_MAX) {
+            z = seg_load(sn, end, scratch, 1);
+            if (z < 0) return;
+            if (!z) break;
+            end++;
+        }
+        send_zero_run(sn, seq, (uint32_t)(end - seq), ALL_PEERS, now);
+        sn->next_seq = end;
+    }
+}
+
+void ncp_sender_on_packet(ncp_sender_t *sn, const uint8_t *rbuf, size_t rcvd,
+                          const struct sockaddr_storage *from, socklen_t flen, uint64_t now)
+{
+    prof_enter(PROF_ACK);
+    sender_on_packet(sn, rbuf, rcvd, from, flen, now);
+    prof_exit();
+}
+
+void ncp_sender_on_timer(ncp_sender_t *sn, uint64_t now)
+{
+    prof_enter(PROF_RETX);
+    sender_expire(sn, now);
+    prof_exit();
+    prof_enter(PROF_FILL);
+    sender_fill_window(sn, now);
+    prof_exit();
+}
+
+// 流式输入只在窗口有空位时才关心可读，避免窗口满时被输入反复唤醒
+int ncp_sender_wants_input(const ncp_sender_t *sn, uint64_t now)
+{
+    return sn->stream && !sn->in_eof && sn->phase == SND_DATA &&
+           sn->next_seq < send_limit(sn) && sender_pacing_ok(sn, now);
+}
+
+// 下一个需要醒来的时间点（0 表示无定时任务）
+uint64_t ncp_sender_next_deadline(const ncp_sender_t *sn, uint64_t now)
+{
+    if (sn->phase == SND_HANDSHAKE || sn->phase == SND_QUEUED) return sn->start_deadline_us;
+    if (sn->phase == SND_PROBE) return sn->train_deadline_us;
+    if (sn->phase == SND_CLOSING) return sn->fin_deadline_us;
+    if (sn->phase != SND_DATA) return 0;
+
+    uint64_t dl = sn->optimistic ? sn->start_deadline_us : 0;
+    if (sn->probe_deadline_us && (dl == 0 || sn->probe_deadline_us < dl)) dl = sn->probe_deadline_us;
+    if (sn->repair_deadline_us && (dl == 0 || sn->repair_deadline_us < dl)) dl = sn->repair_deadline_us;
+    if (sn->tx_head != TX_NONE) {
+        const seg_t *sg = &sn->ring[sn->tx_head];
+        uint64_t t = sg->last_tx_us + sn->rto_us + 1;   // 最早发出的先超时
+        if (sn->rack_xmit_us && sg->last_tx_us < sn->rack_xmit_us) {
+            uint64_t r = sg->last_tx_us + sn->rack_rtt_us + rack_reo_wnd(sn);   // RACK 判丢
+            if (r < t) t = r;
+        }
+        if (dl == 0 || t < dl) dl = t;
+    }
+    uint64_t tlp = tlp_deadline(sn);
+    if (tlp && (dl == 0 || tlp < dl)) dl = tlp;
+    // 只被 pacing 挡住（窗口有空位、还有数据）时，到点再发下一批
+    int more = sn->stream ? !sn->in_eof : sn->next_seq < sn->total_segs;
+    if (more && sn->next_seq < send_limit(sn) && !sender_pacing_ok(sn, now)) {
+        uint64_t t = sn->next_send_us - PACING_QUANTUM_US;
+        if (dl == 0 || t < dl) dl = t;
+    }
+    return dl;
+}
+
+ncp_state_t ncp_sender_state(const ncp_sender_t *sn)
+{
+    if (sn->phase == SND_DONE) return NCP_DONE;
+    if (sn->phase == SND_FAILED) return NCP_FAILED;
+    return NCP_RUNNING;
+}
+
+const char *ncp_sender_error(const ncp_sender_t *sn)
+{
+    return sn->error;
+}
+
+void ncp_sender_stats(const ncp_sender_t *sn, ncp_snd_stats_t *st)
+{
+    st->bytes_sent = sn->total_sent_bytes;
+    st->zero_bytes = sn->zero_bytes;
+    st->file_size  = sn->fsz;
+    st->segments   = sn->stream && !sn->in_eof ? sn->next_seq : sn->total_segs;
+    st->srtt_us    = sn->srtt_us;
+    st->btl_bw     = cc_btl_bw(&sn->cc);
+    st->min_rtt_us = cc_min_rtt_us(&sn->cc);
+    st->npeers     = sn->npeers;
+    st->confirmed  = sn->confirmed;
+    st->probe      = sn->probe_res;
+    st->window     = sn->W;
+    st->rto_min_us = sn->rto_min_us;
+    st->retx_nack  = sn->retx[TRC_NACK];
+    st->retx_rack  = sn->retx[TRC_RACK];
+    st->retx_fast  = sn->retx[TRC_DUPACK];
+    st->retx_tlp   = sn->retx[TRC_TLP];
+    st->retx_rto   = sn->retx[TRC_RTO];
+    st->detect_us  = sn->detect_n ? sn->detect_sum_us / sn->detect_n : 0;
+}
+
+void ncp_sender_report(const ncp_sender_t *sn, FILE *out, double elapsed_s)
+{
+    ncp_snd_stats_t ss;
+    ncp_sender_stats(sn, &ss);
+    double over_wire_MB   = ss.bytes_sent / (1024.0*1024.0);
+    double over_wire_mbps = elapsed_s > 0 ? (ss.bytes_sent * 8.0) / (elapsed_s * 1e6) : 0.0;
+    // 冗余度：含重传的发送量 / 实际文件大小
+    double redundancy = ss.file_size > 0 ? (double)ss.bytes_sent / (double)ss.file_size : 0.0;
+
+    fprintf(out, "[SND] SENT(total incl. retrans): %.2f MB in %.2f s, avg send rate: %.2f Mb/s\n",
+            over_wire_MB, elapsed_s, over_wire_mbps);
+    fprintf(out, "[SND] Redundancy (bytes_sent/file_size): %.2fx\n", redundancy);
+    if (ss.zero_bytes > 0) {
+        fprintf(out, "[SND] Zero ranges: %.2f MB sent as ZERO records instead of DATA\n",
+                ss.zero_bytes / (1024.0*1024.0));
+    }
+    if (ss.probe.done) {
+        char loss[16];
+        fprintf(out, "[SND] Probe: rtt %.3f ms, bw %.2f Mb/s, loss %s; window %u, min RTO %.0f ms\n",
+                ss.probe.rtt_us / 1000.0, ss.probe.bw * MAX_PAYLOAD * 8.0 / 1e6,
+                probe_loss_str(&ss.probe, loss, sizeof(loss)), ss.window, ss.rto_min_us / 1000.0);
+    }
+    uint64_t retx = ss.retx_nack + ss.retx_rack + ss.retx_fast + ss.retx_tlp + ss.retx_rto;
+    if (retx > 0) {
+        fprintf(out, "[SND] Retransmits: %lu (nack %lu, rack %lu, dupack %lu, tlp %lu, rto %lu), loss detected after %.3f ms on average\n",
+                (unsigned long)retx, (unsigned long)ss.retx_nack, (unsigned long)ss.retx_rack,
+                (unsigned long)ss.retx_fast, (unsigned long)ss.retx_tlp, (unsigned long)ss.retx_rto,
+                ss.detect_us / 1000.0);
+    }
+    if (ss.btl_bw > 0) {
+        fprintf(out, "[SND] %s model: btl_bw %.2f Mb/s, min_rtt %.3f ms, srtt %.3f ms\n", sn->cc.ops->name,
+                ss.btl_bw * MAX_PAYLOAD * 8.0 / 1e6, ss.min_rtt_us / 1000.0,
+                ss.srtt_us / 1000.0);
+    }
+}
+
+ncp_sender_t *ncp_sender_new(const ncp_sender_cfg_t *cfg, const ncp_transport_t *tp,
+                             const ncp_source_t *src, uint64_t now)
+{
+    if (cfg->npeers < 1 || cfg->npeers > NCP_MAX_PEERS ||
+        (cfg->mcast && (cfg->npeers != 1 || cfg->expect < 1 || cfg->expect > NCP_MAX_PEERS))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    sender_t *sn = (sender_t*)calloc(1, sizeof(*sn));
+    if (!sn) return NULL;
+    sn->tp  = *tp;
+    sn->src = *src;
+    sn->log = cfg->log;
+
+    // 接收端：组播组（接收端由 START_OK 登记）或单播列表（>1 个即扇出）
+    memcpy(&sn->to, &cfg->peers[0], sizeof(sn->to));
+    sn->tolen = cfg->peer_lens[0];
+    if (cfg->mcast) {
+        sn->fanout = sn->mcast = 1;
+        sn->expect = cfg->expect;
+    } else {
+        for (int i = 0; i < cfg->npeers; ++i) {
+            memcpy(&sn->peers[i].addr, &cfg->peers[i], sizeof(sn->peers[i].addr));
+            sn->peers[i].alen = cfg->peer_lens[i];
+        }
+        sn->npeers = cfg->npeers;
+        sn->fanout = cfg->npeers > 1;
+    }
+
+    // 分片总数；元数据只为窗口内的分片保留（环形表），无需预先建表
+    sn->stream = src->size == UINT64_MAX;
+    if (sn->stream) {
+        sn->fsz = 0;
+        sn->total_segs = UINT64_MAX;        // 读到 EOF 才确定
+    } else {
+        sn->fsz = src->size;
+        sn->total_segs = (sn->fsz + MAX_PAYLOAD - 1) / MAX_PAYLOAD;
+    }
+    // 窗口上限和 RTO 下限由调用方给出（0 = 由探测定，先按 FALLBACK），实际在途量由拥塞控制决定
+    sn->probe = cfg->probe;
+    sn->auto_window = cfg->window == 0;
+    sn->auto_rto = cfg->rto_min_ms == 0;
+    sn->W = sn->auto_window ? PROBE_W_FALLBACK : cfg->window;
+    sn->rto_min_us = (sn->auto_rto ? PROBE_RTO_FALLBACK_MS : cfg->rto_min_ms) * 1000ULL;
+    sn->rto_us = sn->rto_min_us;
+    cc_init(&sn->cc, cfg->cc ? cfg->cc : cc_find("bbr"), sn->W, now);
+    sn->rwnd = sn->W;                      // 接收端窗口在 START_OK/ACK 里通告，之前先按本端窗口
+    sn->extent_from = UINT64_MAX;
+    sn->tx_head = sn->tx_tail = TX_NONE;
+    sn->ring = (seg_t*)calloc(sn->W, sizeof(seg_t));
+    if (sn->stream) sn->sbuf = (uint8_t*)malloc((size_t)sn->W * MAX_PAYLOAD);
+    if (!sn->ring || (sn->stream && !sn->sbuf)) {
+        ncp_sender_free(sn);
+        return NULL;
+    }
+
+    // START：携带目标文件名
+    pkt_t sh = {0};
+    size_t name_len = strlen(cfg->dst_name);
+    sh.type      = PKT_START;
+    sh.caps      = CAP_STREAM | CAP_EARLY_DATA | CAP_ZERO | CAP_FIN_ACK | CAP_PROBE;
+    sh.file_size = sn->stream ? FILE_SIZE_UNKNOWN : sn->fsz;   // 流式：总长度在 FIN 里给出
+    sh.payload   = (const uint8_t*)cfg->dst_name;
+    sh.len       = (uint32_t)(name_len > 255 ? 255 : name_len);
+    sn->start_len = (int)wire_encode(sn->start_pkt, sizeof(sn->start_pkt), &sh);
+
+    send_start(sn, now);
+    sn->start_deadline_us = now + START_RESEND_MS * 1000ULL;
+    if (cfg->zero_rtt && !sn->fanout) {
+        // 乐观启动：紧跟 START 发出第一窗数据，接收端在 START 解析前先缓存
+        sn->phase = SND_DATA;
+        sn->optimistic = 1;
+    } else {
+        sn->phase = SND_HANDSHAKE;
+    }
+    return sn;
+}
+
+void ncp_sender_free(ncp_sender_t *sn)
+{
+    if (!sn) return;
+    free(sn->ring);
+    free(sn->sbuf);
+    free(sn);
+}
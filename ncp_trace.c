@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_include.h"
+#include "trace.h"
+
+#include <unistd.h>
+
+/*
+ * ncp_trace：解码 ncp / rcv 的 -T 跟踪文件。可以同时给发送端和接收端的文件，
+ * 按时间戳合并（同一台机器上两边用的是同一个单调时钟）。
+ *   默认  汇总：各类事件计数、重传按原因（判丢用时、伪重传）、模拟丢包按包类型
+ *   -t    时间线：每条记录一行
+ *   -s    序号图数据：每类事件一块（gnuplot 的 index），第一行是块名
+ */
+
+static void Usage(int argc, char *argv[]);
+static void Print_help(void);
+static void die(const char* msg){ perror(msg); exit(1); }
+
+static int    Mode;            // 0 = 汇总，'t' = 时间线，'s' = 序号图
+static char **Files;
+static int    Nfiles;
+
+typedef struct {
+    trace_rec_t r;
+    uint64_t    ord;           // 文件内顺序：同一时间戳的记录保持原来的先后
+} rec_t;
+
+static rec_t   *Recs;
+static size_t   Nrecs, Cap;
+static uint64_t Per_who[2];    // 'S' / 'R' 的记录数
+
+static const char *Ev_names[TR_EVENTS] = {
+    "?", "TX", "TX_ZERO", "ACK_IN", "NACK_IN", "STATE", "RX", "ACK_OUT", "NACK_OUT", "DROP"
+};
+static const char *Cause_names[TRC_CAUSES] = { "new", "nack", "rack", "dupack", "tlp", "rto" };
+static const char *Rx_names[] = { "in-order", "buffered", "duplicate", "outside" };
+static const char *Pkt_names[] = {
+    "?", "START", "DATA", "FIN", "ACK", "NACK", "BUSY", "START_OK", "WND_PROBE", "ZERO",
+    "FIN_ACK", "PROBE", "PROBE_REPORT"
+};
+#define NPKT ((int)(sizeof(Pkt_names) / sizeof(Pkt_names[0])))
+
+static const char *pkt_name(uint32_t t) { return t < (uint32_t)NPKT ? Pkt_names[t] : "?"; }
+static const char *ev_name(uint8_t e)   { return e < TR_EVENTS ? Ev_names[e] : "?"; }
+static const char *cause_name(uint8_t c) { return c < TRC_CAUSES ? Cause_names[c] : "?"; }
+static const char *rx_name(uint8_t c)   { return c <= TRR_OUTSIDE ? Rx_names[c] : "?"; }
+static int who_idx(uint8_t who)         { return who == 'R'; }
+
+static void load(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) die(path);
+    trace_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+        fprintf(stderr, "ncp_trace: %s: not a trace file\n", path);
+        exit(1);
+    }
+    if (hdr.version != TRACE_VERSION || hdr.rec_size != sizeof(trace_rec_t)) {
+        fprintf(stderr, "ncp_trace: %s: trace version %u (record %u bytes), expected %u (%u bytes)\n",
+                path, hdr.version, hdr.rec_size, TRACE_VERSION, (unsigned)sizeof(trace_rec_t));
+        exit(1);
+    }
+    for (;;) {
+        if (Nrecs == Cap) {
+            Cap = Cap ? Cap * 2 : 65536;
+            Recs = (rec_t*)realloc(Recs, Cap * sizeof(rec_t));
+            if (!Recs) die("realloc");
+        }
+        rec_t *x = &Recs[Nrecs];
+        size_t n = fread(&x->r, 1, sizeof(x->r), fp);
+        if (n == 0) break;
+        if (n != sizeof(x->r)) {
+            fprintf(stderr, "ncp_trace: %s: truncated last record ignored\n", path);
+            break;
+        }
+        x->ord = Nrecs++;
+        Per_who[who_idx(x->r.who)]++;
+    }
+    fclose(fp);
+}
+
+static int by_time(const void *a, const void *b)
+{
+    const rec_t *x = (const rec_t*)a, *y = (const rec_t*)b;
+    if (x->r.t_us != y->r.t_us) return x->r.t_us < y->r.t_us ? -1 : 1;
+    return x->ord < y->ord ? -1 : x->ord > y->ord;
+}
+
+// 模拟丢包只记了线上 32 位序号：按同一端前面记录的 64 位序号还原。
+// 丢掉的 ACK 线上是最后一个按序分片，+1 后和 ACK_IN / ACK_OUT 一样表示“下一片”
+static void extend_drops(void)
+{
+    uint64_t ref[2] = { 0, 0 };
+    for (size_t i = 0; i < Nrecs; ++i) {
+        trace_rec_t *r = &Recs[i].r;
+        int w = who_idx(r->who);
+        if (r->ev != TR_DROP) {
+            if (r->ev != TR_STATE) ref[w] = r->seq;
+            continue;
+        }
+        switch (r->b) {
+        case PKT_DATA: case PKT_ZERO: case PKT_NACK: case PKT_FIN: case PKT_WND_PROBE:
+            r->seq = seq_extend(ref[w], (uint32_t)r->seq);
+            break;
+        case PKT_ACK:
+            r->seq = seq_extend(ref[w], (uint32_t)r->seq + 1);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void print_rec(const trace_rec_t *r, uint64_t t0)
+{
+    printf("%12.3f %c%-2u %-8s ", (r->t_us - t0) / 1000.0, r->who ? r->who : '?', r->tid, ev_name(r->ev));
+    unsigned long long seq = (unsigned long long)r->seq;
+    switch (r->ev) {
+    case TR_TX:
+        printf("seq %llu len %u", seq, r->a);
+        break;
+    case TR_TX_ZERO:
+        printf("seq %llu..%llu", seq, seq + r->a - 1);
+        break;
+    case TR_ACK_IN:
+    case TR_ACK_OUT:
+        if (r->ev == TR_ACK_IN) printf("peer %u ", r->cause);
+        printf("ack %llu wnd %u", seq, r->a);
+        if (r->b) {
+            unsigned long long lo = (unsigned long long)seq_extend(r->seq, r->c);
+            printf(" sack %llu..%llu", lo, lo + r->b - 1);
+        }
+        break;
+    case TR_NACK_IN:
+    case TR_NACK_OUT:
+        if (r->ev == TR_NACK_IN) printf("peer %u ", r->cause);
+        printf("first %llu blocks %u missing %u", seq, r->a, r->b);
+        break;
+    case TR_STATE:
+        printf("base %llu cwnd %u rto %.1f ms inflight %u", seq, r->a, r->b / 1000.0, r->c);
+        break;
+    case TR_RX:
+        printf("seq %llu", seq);
+        if (r->a > 1) printf("..%llu", seq + r->a - 1);
+        printf(" %s", rx_name(r->cause));
+        break;
+    case TR_DROP:
+        printf("%s len %u seq %llu", pkt_name(r->b), r->a, seq);
+        break;
+    default:
+        break;
+    }
+    if ((r->ev == TR_TX || r->ev == TR_TX_ZERO)) {
+        if (r->b > 1) printf(" x%u", r->b);
+        if (r->cause != TRC_NEW) printf(" retx(%s)", cause_name(r->cause));
+    }
+    printf("\n");
+}
+
+static void timeline(void)
+{
+    uint64_t t0 = Nrecs ? Recs[0].r.t_us : 0;
+    for (size_t i = 0; i < Nrecs; ++i) print_rec(&Recs[i].r, t0);
+}
+
+// 序号图：一块一类事件，列 = 毫秒 序号
+enum { P_TX, P_RETX, P_DROP, P_RX, P_ACK, P_NACK, P_KINDS };
+static const char *Plot_names[P_KINDS] = { "tx", "retx", "drop", "rx", "ack", "nack" };
+
+static int plot_kind(const trace_rec_t *r)
+{
+    switch (r->ev) {
+    case TR_TX:
+    case TR_TX_ZERO: return r->cause == TRC_NEW ? P_TX : P_RETX;
+    case TR_DROP:    return r->b == PKT_DATA || r->b == PKT_ZERO ? P_DROP : -1;
+    case TR_RX:      return r->cause <= TRR_BUFFERED ? P_RX : -1;
+    case TR_ACK_IN:  return P_ACK;
+    case TR_ACK_OUT: return Per_who[0] ? -1 : P_ACK;     // 有发送端跟踪时只画它收到的
+    case TR_NACK_IN: return P_NACK;
+    case TR_NACK_OUT: return Per_who[0] ? -1 : P_NACK;
+    default:         return -1;
+    }
+}
+
+static void seqplot(void)
+{
+    uint64_t t0 = Nrecs ? Recs[0].r.t_us : 0;
+    printf("# ncp_trace sequence plot: one block per event kind (gnuplot index 0..%d), columns t_ms seq\n",
+           P_KINDS - 1);
+    printf("# plot for [i=0:%d] 'FILE' index i using 1:2 with dots title columnheader(1)\n", P_KINDS - 1);
+    for (int k = 0; k < P_KINDS; ++k) {
+        if (k > 0) printf("\n\n");
+        printf("\"%s\"\n", Plot_names[k]);
+        for (size_t i = 0; i < Nrecs; ++i) {
+            const trace_rec_t *r = &Recs[i].r;
+            if (plot_kind(r) != k) continue;
+            printf("%.3f %llu\n", (r->t_us - t0) / 1000.0, (unsigned long long)r->seq);
+        }
+    }
+}
+
+static void summary(void)
+{
+    uint64_t ev[2][TR_EVENTS] = {{0}};
+    uint64_t tx_cause[TRC_CAUSES] = {0}, spurious[TRC_CAUSES] = {0};
+    uint64_t detect_sum[TRC_CAUSES] = {0}, detect_n[TRC_CAUSES] = {0};
+    uint64_t rx[TRR_OUTSIDE + 1] = {0};
+    uint64_t drops[2][NPKT + 1];
+    uint64_t ack_sack[2] = {0};
+    const trace_rec_t *last_state = NULL;
+    memset(drops, 0, sizeof(drops));
+
+    // 按分片记最近一次发送时间和第一次到达时间：重传时它已经到了就是伪重传
+    uint64_t max_seq = 0;
+    for (size_t i = 0; i < Nrecs; ++i) {
+        const trace_rec_t *r = &Recs[i].r;
+        uint64_t end = r->seq + (r->ev == TR_TX_ZERO || r->ev == TR_RX ? r->a : 1);
+        if ((r->ev == TR_TX || r->ev == TR_TX_ZERO || r->ev == TR_RX) && end > max_seq) max_seq = end;
+    }
+    const uint64_t MAX_TRACKED = 1ULL << 28;
+    uint64_t *last_tx = NULL, *first_rx = NULL;
+    if (max_seq <= MAX_TRACKED) {
+        last_tx  = (uint64_t*)calloc((size_t)max_seq + 1, sizeof(uint64_t));
+        first_rx = (uint64_t*)calloc((size_t)max_seq + 1, sizeof(uint64_t));
+        if (!last_tx || !first_rx) die("calloc");
+    }
+
+    for (size_t i = 0; i < Nrecs; ++i) {
+        const trace_rec_t *r = &Recs[i].r;
+        int w = who_idx(r->who);
+        if (r->ev < TR_EVENTS) ev[w][r->ev]++;
+        switch (r->ev) {
+        case TR_TX:
+        case TR_TX_ZERO:
+            if (r->cause >= TRC_CAUSES) break;
+            tx_cause[r->cause]++;
+            if (!last_tx) break;
+            if (r->cause != TRC_NEW) {
+                if (first_rx[r->seq]) spurious[r->cause]++;
+                if (last_tx[r->seq]) {
+                    detect_sum[r->cause] += r->t_us - last_tx[r->seq];
+                    detect_n[r->cause]++;
+                }
+            }
+            for (uint32_t k = 0; k < (r->ev == TR_TX_ZERO ? r->a : 1); ++k) last_tx[r->seq + k] = r->t_us;
+            break;
+        case TR_RX:
+            if (r->cause <= TRR_OUTSIDE) rx[r->cause]++;
+            if (first_rx && r->cause <= TRR_BUFFERED) {
+                for (uint32_t k = 0; k < r->a; ++k) {
+                    if (!first_rx[r->seq + k]) first_rx[r->seq + k] = r->t_us;
+                }
+            }
+            break;
+        case TR_ACK_IN:
+        case TR_ACK_OUT:
+            if (r->b) ack_sack[w]++;
+            break;
+        case TR_STATE:
+            last_state = r;
+            break;
+        case TR_DROP:
+            drops[w][r->b < (uint32_t)NPKT ? r->b : NPKT]++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    uint64_t span = Nrecs ? Recs[Nrecs - 1].r.t_us - Recs[0].r.t_us : 0;
+    printf("Trace: %d file(s), %lu records over %.3f s (sender %lu, receiver %lu)\n", Nfiles,
+           (unsigned long)Nrecs, span / 1e6, (unsigned long)Per_who[0], (unsigned long)Per_who[1]);
+    if (Per_who[0]) {
+        uint64_t retx = 0;
+        for (int c = TRC_NEW + 1; c < TRC_CAUSES; ++c) retx += tx_cause[c];
+        printf("Sender:\n");
+        printf("  DATA sent %lu, ZERO sent %lu (new %lu, retransmitted %lu)\n",
+               (unsigned long)ev[0][TR_TX], (unsigned long)ev[0][TR_TX_ZERO],
+               (unsigned long)tx_cause[TRC_NEW], (unsigned long)retx);
+        printf("  ACK in %lu (with SACK %lu), NACK in %lu\n", (unsigned long)ev[0][TR_ACK_IN],
+               (unsigned long)ack_sack[0], (unsigned long)ev[0][TR_NACK_IN]);
+        if (last_state) {
+            printf("  last state: send_base %lu, cwnd %u, rto %.1f ms, inflight %u\n",
+                   (unsigned long)last_state->seq, last_state->a, last_state->b / 1000.0, last_state->c);
+        }
+        if (retx > 0) {
+            printf("Retransmits by cause:\n");
+            printf("  %-8s %10s %10s %14s\n", "cause", "count", "spurious", "detect ms");
+            for (int c = TRC_NEW + 1; c < TRC_CAUSES; ++c) {
+                if (!tx_cause[c]) continue;
+                printf("  %-8s %10lu", cause_name((uint8_t)c), (unsigned long)tx_cause[c]);
+                if (Per_who[1] && last_tx) printf(" %10lu", (unsigned long)spurious[c]);
+                else printf(" %10s", "-");
+                if (detect_n[c]) printf(" %14.3f\n", detect_sum[c] / 1000.0 / detect_n[c]);
+                else printf(" %14s\n", "-");
+            }
+            printf("  (spurious = the receiver already had the segment when it was resent; "
+                   "detect = time since its previous transmission)\n");
+            if (!Per_who[1]) printf("  (give the receiver trace too to count spurious retransmits)\n");
+        }
+    }
+    if (Per_who[1]) {
+        printf("Receiver:\n");
+        printf("  segments in: in-order %lu, buffered %lu, duplicate %lu, outside window %lu\n",
+               (unsigned long)rx[TRR_IN_ORDER], (unsigned long)rx[TRR_BUFFERED],
+               (unsigned long)rx[TRR_DUP], (unsigned long)rx[TRR_OUTSIDE]);
+        printf("  ACK out %lu (with SACK %lu), NACK out %lu\n", (unsigned long)ev[1][TR_ACK_OUT],
+               (unsigned long)ack_sack[1], (unsigned long)ev[1][TR_NACK_OUT]);
+    }
+    for (int w = 0; w < 2; ++w) {
+        if (!ev[w][TR_DROP]) continue;
+        printf("Emulated drops by %s: %lu (", w ? "receiver" : "sender", (unsigned long)ev[w][TR_DROP]);
+        const char *sep = "";
+        for (int t = 0; t <= NPKT; ++t) {
+            if (!drops[w][t]) continue;
+            printf("%s%s %lu", sep, t < NPKT ? Pkt_names[t] : "?", (unsigned long)drops[w][t]);
+            sep = ", ";
+        }
+        printf(")\n");
+    }
+    free(last_tx);
+    free(first_rx);
+}
+
+int main(int argc, char *argv[])
+{
+    Usage(argc, argv);
+    for (int i = 0; i < Nfiles; ++i) load(Files[i]);
+    qsort(Recs, Nrecs, sizeof(rec_t), by_time);
+    extend_drops();
+    if (Mode == 't') timeline();
+    else if (Mode == 's') seqplot();
+    else summary();
+    free(Recs);
+    return 0;
+}
+
+/* Read commandline arguments */
+static void Usage(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "ts")) != -1) {
+        switch (opt) {
+        case 't':
+        case 's': Mode = opt; break;
+        default:  Print_help();
+        }
+    }
+    if (optind >= argc) Print_help();
+    Files  = argv + optind;
+    Nfiles = argc - optind;
+}
+
+static void Print_help(void) {
+    printf("Usage: ncp_trace [-t | -s] <trace_file> [<trace_file> ...]\n");
+    printf("       decodes ncp/rcv -T traces; several files (sender and receiver) are merged by time\n");
+    printf("       default: summary with retransmits by cause, spurious retransmits and emulated drops\n");
+    printf("       -t  timeline, one line per event\n");
+    printf("       -s  sequence plot data for gnuplot, one block per event kind\n");
+    exit(0);
+}
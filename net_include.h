@@ -10,11 +10,13 @@
 
 #define MAX_MESS_LEN 1400
 
+#define MODE_AUTO 0   // 不给 env：握手后探测链路来定窗口和 RTO
 #define MODE_LAN 1
 #define MODE_WAN 2
 
 
-#define MAX_PAYLOAD    1360          // 保证总长<=1400B
+#define DATA_HDR_LEN   5             // DATA 头：type/flags(1) + seq(4)，见 wire.h
+#define MAX_PAYLOAD    (MAX_MESS_LEN - DATA_HDR_LEN)   // 1395，保证总长<=1400B
 #define PKT_START      1
 #define PKT_DATA       2
 #define PKT_FIN        3
@@ -22,19 +24,44 @@
 #define PKT_NACK       5
 #define PKT_BUSY       6  // 新增，接收端忙时回复
 #define PKT_START_OK   7 //ready to start transferring
-// e.g. in net_include.h
+#define PKT_WND_PROBE  8             // 零窗口探测：接收端用带窗口的 ACK 回应
+#define PKT_ZERO       9             // 全零分片区间：代替 DATA，不带负载
+#define PKT_FIN_ACK   10             // 接收端确认 FIN：文件已完整落盘，带回本次会话统计
+#define PKT_PROBE     11             // 链路探测：握手后发一串满长度的包（包对 / 包串）
+#define PKT_PROBE_REPORT 12          // 接收端对一串 PROBE 的到达统计
 
+#define FILE_SIZE_UNKNOWN UINT64_MAX   // START.file_size：流式输入，总长度只在 FIN 里给出
 
-#pragma pack(push,1)
-typedef struct {
-    uint8_t  type;        // START/DATA/FIN/ACK
-    uint32_t seq;         // DATA: 分片号; ACK: 累积确认号(最后一个已按序提交的分片号)
-    uint32_t len;         // 负载长度（DATA）或附带信息长度
-    uint64_t file_size;   // START/FIN 携带；ACK 可不管
-} hdr_t;
-#pragma pack(pop)
+// 线上序号只有 32 位；两端内部用 64 位。取离参考点 ref 最近的 64 位值
+// （|差值| < 2^31 即可安全回绕，窗口远小于此）
+static inline uint64_t seq_extend(uint64_t ref, uint32_t wire) {
+    int32_t d = (int32_t)(wire - (uint32_t)ref);
+    if (d < 0 && (uint64_t)(-(int64_t)d) > ref) return wire;
+    return ref + (int64_t)d;
+}
 
 static inline uint64_t now_ms(void) {
     struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
     return (uint64_t)ts.tv_sec*1000ULL + ts.tv_nsec/1000000ULL;
 }
+
+static inline uint64_t now_us(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000ULL + ts.tv_nsec/1000ULL;
+}
+
+// UDP socket 缓冲按窗口放大：先试 *BUFFORCE（有 CAP_NET_ADMIN 时可越过 net.core.[rw]mem_max），
+// 不行再用普通选项（会被截到上限）。只放大不缩小；返回内核实际给的大小（字节）
+#define SOCK_BUF_MAX (256 * 1024 * 1024)
+static inline int sock_buf_size(int s, int rcv, uint64_t bytes) {
+    int opt = rcv ? SO_RCVBUF : SO_SNDBUF, force = rcv ? SO_RCVBUFFORCE : SO_SNDBUFFORCE;
+    int want = bytes > SOCK_BUF_MAX ? SOCK_BUF_MAX : (int)bytes;
+    int got = 0; socklen_t len = sizeof(got);
+    if (getsockopt(s, SOL_SOCKET, opt, &got, &len) == 0 && got / 2 >= want) return got / 2;
+    if (setsockopt(s, SOL_SOCKET, force, &want, sizeof(want)) < 0) {
+        setsockopt(s, SOL_SOCKET, opt, &want, sizeof(want));
+    }
+    len = sizeof(got);
+    if (getsockopt(s, SOL_SOCKET, opt, &got, &len) < 0) return 0;
+    return got / 2;   // 内核按记账开销翻倍后报告
+}
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "prof.h"
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+int prof_on;
+
+// 计数器：前三个是硬件事件（虚拟机里常常没有），上下文切换是软件事件
+enum { C_CYCLES, C_INSNS, C_CMISS, C_CSW, NCTR };
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} Ctr[NCTR] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+static const char *Names[PROF_PHASES] = {
+    "loop", "wait", "recv", "send", "ack", "retx", "fill", "read", "data", "flush", "write", "timer"
+};
+
+#define PROF_DEPTH 8
+
+typedef struct {
+    uint64_t calls;
+    uint64_t ns;
+    uint64_t v[NCTR];
+} acc_t;
+
+static int      Leader = -1;        // 组长的 fd；一次 read 读出整组
+static int      Slot[NCTR];         // 在组读出结果里的下标，-1 = 没开成
+static int      Nopen;
+static int      User_only;          // 权限不够时只数用户态（系统调用里的开销就看不到了）
+static acc_t    Acc[PROF_PHASES];
+static uint64_t Last_ns, Last_v[NCTR];
+static uint64_t Since_ns;
+static prof_phase_t Stack[PROF_DEPTH];
+static int      Depth;
+
+static int open_ctr(int i)
+{
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof(a));
+    a.size           = sizeof(a);
+    a.type           = Ctr[i].type;
+    a.config         = Ctr[i].config;
+    a.disabled       = Leader < 0;  // 组员跟着组长一起开
+    a.exclude_hv     = 1;
+    a.exclude_kernel = User_only;
+    a.read_format    = PERF_FORMAT_GROUP;
+    int fd = (int)syscall(SYS_perf_event_open, &a, 0, -1, Leader, 0);
+    if (fd < 0 && (errno == EACCES || errno == EPERM) && !User_only) {
+        User_only = 1;
+        a.exclude_kernel = 1;
+        fd = (int)syscall(SYS_perf_event_open, &a, 0, -1, Leader, 0);
+    }
+    return fd;
+}
+
+static void sample(uint64_t *ns, uint64_t v[NCTR])
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    if (Leader < 0) return;
+    uint64_t buf[1 + NCTR];
+    if (read(Leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) return;
+    for (int i = 0; i < NCTR; ++i) {
+        if (Slot[i] >= 0 && (uint64_t)Slot[i] < buf[0]) v[i] = buf[1 + Slot[i]];
+    }
+}
+
+// 上次边界到现在的量记给栈顶阶段
+static void charge(void)
+{
+    uint64_t ns, v[NCTR];
+    memcpy(v, Last_v, sizeof(v));
+    sample(&ns, v);
+    int top = Depth > PROF_DEPTH ? PROF_DEPTH : Depth;
+    acc_t *a = &Acc[top ? Stack[top - 1] : PROF_LOOP];
+    a->ns += ns - Last_ns;
+    for (int i = 0; i < NCTR; ++i) a->v[i] += v[i] - Last_v[i];
+    Last_ns = ns;
+    memcpy(Last_v, v, sizeof(v));
+}
+
+int prof_init(void)
+{
+    for (int i = 0; i < NCTR; ++i) {
+        Slot[i] = -1;
+        int fd = open_ctr(i);
+        if (fd < 0) continue;
+        if (Leader < 0) Leader = fd;
+        Slot[i] = Nopen++;
+    }
+    if (Leader >= 0) {
+        ioctl(Leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    prof_on = 1;
+    prof_reset();
+    return Nopen;
+}
+
+void prof_reset(void)
+{
+    memset(Acc, 0, sizeof(Acc));
+    sample(&Last_ns, Last_v);
+    Since_ns = Last_ns;
+}
+
+void prof_enter_slow(prof_phase_t ph)
+{
+    charge();
+    if (Depth < PROF_DEPTH) Stack[Depth] = ph;
+    Depth++;
+    Acc[ph].calls++;
+}
+
+void prof_exit_slow(void)
+{
+    charge();
+    if (Depth > 0) Depth--;
+}
+
+static void put_ctr(FILE *out, int i, uint64_t v)
+{
+    if (Slot[i] < 0) fprintf(out, " %12s", "-");
+    else fprintf(out, " %12llu", (unsigned long long)v);
+}
+
+void prof_report(FILE *out, const char *who)
+{
+    if (!prof_on) return;
+    charge();
+    uint64_t total = Last_ns - Since_ns, bounds = 0;
+    for (int p = 0; p < PROF_PHASES; ++p) bounds += 2 * Acc[p].calls;
+    fprintf(out, "[%s] Profile: %.3f s, %llu phase boundaries%s\n", who, total / 1e9,
+            (unsigned long long)bounds, User_only ? " (user-mode counts only)" : "");
+    if (Slot[C_CYCLES] < 0) fprintf(out, "[%s]   (no hardware counters here: time and context switches only)\n", who);
+    fprintf(out, "[%s]   %-6s %10s %10s %6s %12s %12s %5s %12s %12s\n", who,
+            "phase", "calls", "ms", "%", "cycles", "instr", "IPC", "cache-miss", "ctx-switch");
+    for (int p = 0; p < PROF_PHASES; ++p) {
+        const acc_t *a = &Acc[p];
+        if (a->calls == 0 && a->ns == 0) continue;
+        fprintf(out, "[%s]   %-6s %10llu %10.2f %6.1f", who, Names[p], (unsigned long long)a->calls,
+                a->ns / 1e6, total ? 100.0 * a->ns / total : 0.0);
+        put_ctr(out, C_CYCLES, a->v[C_CYCLES]);
+        put_ctr(out, C_INSNS, a->v[C_INSNS]);
+        if (Slot[C_CYCLES] >= 0 && Slot[C_INSNS] >= 0 && a->v[C_CYCLES] > 0) {
+            fprintf(out, " %5.2f", (double)a->v[C_INSNS] / (double)a->v[C_CYCLES]);
+        } else {
+            fprintf(out, " %5s", "-");
+        }
+        put_ctr(out, C_CMISS, a->v[C_CMISS]);
+        put_ctr(out, C_CSW, a->v[C_CSW]);
+        fprintf(out, "\n");
+    }
+}
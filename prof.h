@@ -0,0 +1,43 @@
+#ifndef CS2520_PROF
+#define CS2520_PROF
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * 分阶段性能计数（ncp/rcv/ncp_bench 的 -P）：perf_event_open 开一组计数器
+ * （周期、指令、cache miss、上下文切换），在各循环的阶段边界读一次，差值记到当前阶段。
+ * 阶段可以嵌套（sendto 在填窗口里面），只记自身：进入子阶段前先把已过的量记给外层。
+ * 不在任何阶段里的算 loop（事件循环本身）。
+ * 没开时 prof_enter/prof_exit 只是一次分支；开了每个边界多一次 read() 和 clock_gettime()。
+ * 只统计调用 prof_init 的线程。
+ */
+typedef enum {
+    PROF_LOOP,      // 事件循环里不属于下面任何阶段的部分
+    PROF_WAIT,      // epoll_wait 空等
+    PROF_RECV,      // recvfrom
+    PROF_SEND,      // sendto
+    PROF_ACK,       // 发送端：处理 ACK/NACK 等回包
+    PROF_RETX,      // 发送端：到期事件、判丢重传扫描
+    PROF_FILL,      // 发送端：填窗口
+    PROF_READ,      // 发送端：读源文件 / 输入
+    PROF_DATA,      // 接收端：处理收到的包（放进重排缓冲）
+    PROF_FLUSH,     // 接收端：重排缓冲按序交付
+    PROF_WRITE,     // 接收端：写文件
+    PROF_TIMER,     // 接收端：会话超时、探测报告
+    PROF_PHASES
+} prof_phase_t;
+
+extern int prof_on;
+
+// 打开计数器并开始计数，返回开成的计数器个数（0 = 只有时间）
+int  prof_init(void);
+void prof_reset(void);                  // 清零，从现在起重新统计
+void prof_enter_slow(prof_phase_t ph);
+void prof_exit_slow(void);
+void prof_report(FILE *out, const char *who);
+
+static inline void prof_enter(prof_phase_t ph) { if (prof_on) prof_enter_slow(ph); }
+static inline void prof_exit(void)             { if (prof_on) prof_exit_slow(); }
+
+#endif
@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "sendto_dbg.h"
 #include "net_include.h"
+#include "libncp.h"
+#include "prof.h"
+#include "trace.h"
 
 
 #include <unistd.h>
@@ -11,19 +15,14 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
-#include <arpa/inet.h>
-#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
 
 
-#define RECV_WINDOW 4096   // 简易缓冲上限（可调）
-typedef struct {
-    int      present;      // 是否已收到
-    uint32_t seq;          // 分片序号
-    uint32_t len;          // 该分片长度
-    uint8_t  data[MAX_PAYLOAD];
-} slot_t;
-#define TEN_MB (10u * 1024u * 1024u)
-
 static void die(const char* msg) { perror(msg); exit(1); }  // ← 新增
 
 static void Usage(int argc, char *argv[]);
@@ -33,333 +32,450 @@ static void Print_help(void);
 static int Loss_rate;
 static int Mode;
 static char *Port_Str;
+static char *Mcast_group;   // -g：加入组播组接收扇出数据
+static uint32_t Window = NCP_RCV_WINDOW;   // -w：接收窗口（分片数）
+static int Profile;                        // -P：按阶段统计，每个会话结束时打印
+static char *Trace_file;                   // -T：报文事件写进二进制跟踪文件（ncp_trace 解码）
+static char *Out_path;                     // -o：收到的字节按序写到这里（"-" = stdout，或命名管道），不按 START 里的文件名落盘
+static volatile sig_atomic_t Stop;         // 跟踪时 Ctrl-C / kill：退出循环，把跟踪写完再走
+
+static const uint64_t STREAM_LINGER_MS = 1000;   // -o：传完后再留一会，应答重发的 FIN
+static const uint64_t STREAM_DRAIN_MS  = 10000;  // -o：会话结束后积压还没写完，下游这么久没读走任何数据就放弃
+
+static void on_stop(int sig) { (void)sig; Stop = 1; }
+
+// libncp 的传输：回复经 sendto_dbg 发出
+static void udp_send(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr *to, socklen_t tolen)
+{
+    prof_enter(PROF_SEND);
+    sendto_dbg(*(int*)ctx, (const char*)buf, (int)len, 0, to, tolen);
+    prof_exit();
+}
+
+// libncp 的 sink：每个会话写一个本地文件
+static void *file_open(void *ctx, const char *name, uint64_t size)
+{
+    (void)ctx; (void)size;
+    if (prof_on) prof_reset();    // 剖析从会话开始算，不含之前的空等
+    return fopen(name, "wb");
+}
+
+static int file_write(void *session, const void *buf, size_t len)
+{
+    prof_enter(PROF_WRITE);
+    size_t n = fwrite(buf, 1, len, (FILE*)session);
+    prof_exit();
+    return n == len ? 0 : -1;
+}
 
-static void send_start_ok(int s, const struct sockaddr *to, socklen_t tolen){
-    hdr_t h = {0};
-    h.type = PKT_START_OK;
-    sendto_dbg(s, (const char*)&h, sizeof(h), 0, to, tolen);
+// 全零区间：往后跳，留成空洞（不占磁盘、不写）；不可定位的输出才老实写零
+static int file_zero(void *session, size_t len)
+{
+    static const uint8_t zeros[MAX_PAYLOAD];
+    FILE *fp = (FILE*)session;
+    int rc = 0;
+    prof_enter(PROF_WRITE);
+    if (fseeko(fp, (off_t)len, SEEK_CUR) != 0) {
+        while (len > 0 && rc == 0) {
+            size_t n = len < sizeof(zeros) ? len : sizeof(zeros);
+            if (fwrite(zeros, 1, n, fp) != n) rc = -1;
+            len -= n;
+        }
+    }
+    prof_exit();
+    return rc;
 }
-static int busy = 0; // 当前是否在接收一个会话
-static struct sockaddr_storage cur_peer;
-static socklen_t               cur_plen = 0;
 
-// 会话活跃时间（用于超时清理）
-static uint64_t last_activity_ms = 0;
-static const uint64_t SESSION_IDLE_TIMEOUT_MS = 5000; // 5s，可按需调
+static void file_close(void *session, int complete)
+{
+    FILE *fp = (FILE*)session;
+    (void)complete;               // 不完整的文件也留着，便于排查
+    // 结尾是空洞时只移动了位置，文件还没这么长：截到逻辑长度
+    prof_enter(PROF_WRITE);
+    off_t end = ftello(fp);
+    fflush(fp);
+    if (end > 0 && ftruncate(fileno(fp), end) != 0) perror("ftruncate");
+    fclose(fp);
+    prof_exit();
+    prof_report(stdout, "RCV");   // 一个会话一份剖析
+}
 
-static int same_peer(const struct sockaddr_storage* a, socklen_t alen,
-                     const struct sockaddr_storage* b, socklen_t blen)
+// 流式输出（-o）：只收一个会话，按序字节写到非阻塞的 fd，下游读得慢时先存在这里。
+// 积压（backlog）从通告窗口里扣掉，所以最多积压一个窗口；下游腾出空间后再发窗口更新
+typedef struct {
+    int      fd;
+    int      flags;               // 原来的 fd 标志，结束时恢复
+    int      pollable;            // 普通文件不能进 epoll（也不会写不进去）
+    int      used;                // 已有会话用过：后来的发送端拒绝
+    int      draining;            // 会话已结束，积压还在写（走 EPOLLOUT，不阻塞收包）
+    int      done;                // 积压写完或放弃，fd 已关
+    uint8_t *buf;                 // 积压 [head, head + len)
+    size_t   head, len, cap;
+    size_t   max_len;
+    uint64_t bytes, stalls;
+    uint64_t drain_ms;            // draining 时最近一次写出进展的时间
+    uint64_t done_ms;
+} out_stream_t;
+
+static out_stream_t Out = { -1 };
+
+// 把积压尽量写出去；下游暂时写不进返回 0，出错返回 -1
+static int out_flush(void)
 {
-    if (a->ss_family != b->ss_family || alen != blen) return 0;
-    if (a->ss_family == AF_INET) {
-        const struct sockaddr_in *pa=(const struct sockaddr_in*)a, *pb=(const struct sockaddr_in*)b;
-        return pa->sin_port==pb->sin_port &&
-               memcmp(&pa->sin_addr,&pb->sin_addr,sizeof(struct in_addr))==0;
-    } else if (a->ss_family == AF_INET6) {
-        const struct sockaddr_in6 *pa=(const struct sockaddr_in6*)a, *pb=(const struct sockaddr_in6*)b;
-        return pa->sin6_port==pb->sin6_port &&
-               memcmp(&pa->sin6_addr,&pb->sin6_addr,sizeof(struct in6_addr))==0;
+    while (Out.len > 0) {
+        ssize_t n = write(Out.fd, Out.buf + Out.head, Out.len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        Out.head += (size_t)n;
+        Out.len  -= (size_t)n;
+        if (Out.draining) Out.drain_ms = now_ms();
     }
+    Out.head = 0;
     return 0;
 }
 
-static void send_busy(int s, const struct sockaddr *to, socklen_t tolen)
+static void *out_open(void *ctx, const char *name, uint64_t size)
+{
+    (void)ctx; (void)size;
+    if (Out.used) return NULL;
+    Out.used = 1;
+    printf("[RCV] streaming %s to %s\n", name, Out_path);
+    if (prof_on) prof_reset();
+    return &Out;
+}
+
+static int out_write(void *session, const void *buf, size_t len)
+{
+    (void)session;
+    prof_enter(PROF_WRITE);
+    size_t total = len;
+    int rc = out_flush();
+    if (rc == 0 && Out.len == 0) {
+        // 没有积压：直接写，写不完的才存下
+        while (len > 0) {
+            ssize_t n = write(Out.fd, buf, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) rc = -1;
+                break;
+            }
+            buf = (const uint8_t*)buf + n;
+            len -= (size_t)n;
+        }
+    }
+    if (rc == 0 && len > 0) {
+        if (Out.len == 0) Out.stalls++;
+        if (Out.head > 0) {
+            memmove(Out.buf, Out.buf + Out.head, Out.len);
+            Out.head = 0;
+        }
+        if (Out.len + len > Out.cap) {
+            size_t cap = Out.cap ? Out.cap : 1 << 20;
+            while (cap < Out.len + len) cap *= 2;
+            uint8_t *b = (uint8_t*)realloc(Out.buf, cap);
+            if (!b) rc = -1;
+            else { Out.buf = b; Out.cap = cap; }
+        }
+        if (rc == 0) {
+            memcpy(Out.buf + Out.len, buf, len);
+            Out.len += len;
+            if (Out.len > Out.max_len) Out.max_len = Out.len;
+        }
+    }
+    if (rc == 0) Out.bytes += total;
+    prof_exit();
+    return rc;
+}
+
+static size_t out_backlog(void *session)
 {
-    hdr_t h = {0};
-    h.type = PKT_BUSY;            // 需要你在 net_include.h 里定义 PKT_BUSY
-    sendto_dbg(s, (const char*)&h, sizeof(h), 0, to, tolen);
+    (void)session;
+    return Out.len;
 }
 
-// 将 [base, base+RECV_WINDOW) 映射到缓冲槽 idx
-static inline int slot_index(uint32_t base, uint32_t seq) {
-    if (seq < base) return -1;
-    uint32_t d = seq - base;
-    if (d >= RECV_WINDOW) return -1;
-    return (int)d;
+// 关 fd（下游读到 EOF）并报告；complete = 0 时丢掉没写出去的积压
+static void out_finish(int complete)
+{
+    fcntl(Out.fd, F_SETFL, Out.flags);   // "-" 时 fd 和启动者共用，别把 O_NONBLOCK 留给它
+    close(Out.fd);
+    printf("[RCV] Output: %lu bytes to %s, consumer stalled %lu times, max backlog %lu KB%s\n",
+           (unsigned long)(Out.bytes - Out.len), Out_path, (unsigned long)Out.stalls,
+           (unsigned long)(Out.max_len / 1024), complete ? "" : " (incomplete)");
+    prof_report(stdout, "RCV");
+    free(Out.buf);
+    Out.buf = NULL;
+    Out.len = 0;
+    Out.fd = -1;
+    Out.draining = 0;
+    Out.done = 1;
+    Out.done_ms = now_ms();
 }
 
-static void send_ack(int s, const struct sockaddr *peer, socklen_t plen, uint32_t ack_seq) {
-    hdr_t ack = {0};
-    ack.type = PKT_ACK;
-    ack.seq  = ack_seq;   // Last in-order sequence number received
-    ack.len  = 0;
-    // ACK has to go sendto_dbg(required by project)
-    sendto_dbg(s, (const char*)&ack, sizeof(ack), 0, peer, plen);
+// 会话结束。这里不能阻塞：接收端紧接着要回 FIN_ACK，还要接着应答 socket。
+// 积压写不完就留给事件循环按 EPOLLOUT 接着写，写完再关 fd
+static void out_close(void *session, int complete)
+{
+    (void)session;
+    prof_enter(PROF_WRITE);
+    int rc = complete ? out_flush() : -1;
+    prof_exit();
+    if (rc != 0 && complete) perror("write output");
+    if (rc != 0 || Out.len == 0) {
+        out_finish(rc == 0);
+        return;
+    }
+    Out.draining = 1;
+    Out.drain_ms = now_ms();
+    printf("[RCV] Session done, %lu KB of backlog left to write to %s\n",
+           (unsigned long)(Out.len / 1024), Out_path);
 }
-static void send_nack(int s, const struct sockaddr *peer, socklen_t plen, uint32_t want_seq) {
-    hdr_t nack = (hdr_t){0};
-    nack.type = PKT_NACK;
-    nack.seq  = want_seq;   // 告诉发送端：我现在需要这个分片（next_write_seq）
-    nack.len  = 0;
-    sendto_dbg(s, (const char*)&nack, sizeof(nack), 0, peer, plen);
+
+// 打开 -o 的目标。"-" 时数据走原来的 stdout，日志改到 stderr
+static void out_setup(void)
+{
+    if (strcmp(Out_path, "-") == 0) {
+        Out.fd = dup(STDOUT_FILENO);
+        if (Out.fd < 0) die("dup");
+        fflush(stdout);
+        if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) die("dup2");
+    } else {
+        struct stat st;
+        if (stat(Out_path, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            printf("\tWaiting for a reader on %s ...\n", Out_path);
+            fflush(stdout);
+        }
+        Out.fd = open(Out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);   // FIFO：阻塞到有读者
+        if (Out.fd < 0) die("open output");
+    }
+    Out.flags = fcntl(Out.fd, F_GETFL);
+    if (Out.flags < 0 || fcntl(Out.fd, F_SETFL, Out.flags | O_NONBLOCK) < 0) die("fcntl");
+    signal(SIGPIPE, SIG_IGN);     // 下游退出：write 返回 EPIPE，放弃会话
 }
 
+static void arm_timer(int tfd, uint64_t deadline_us)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));   // 全 0 即解除定时
+    if (deadline_us) {
+        its.it_value.tv_sec  = (time_t)(deadline_us / 1000000);
+        its.it_value.tv_nsec = (long)(deadline_us % 1000000) * 1000L;
+    }
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) die("timerfd_settime");
+}
 
-static void run_receiver(const char* port_str, int expect_loss_sim_env_is_lan_or_wan_unused)
+// 把 socket 里排着的包都交给引擎
+static void receiver_drain(int s, ncp_receiver_t *rv)
 {
-    struct sockaddr_storage sender_addr;
-    socklen_t sender_len = 0;
-    int sender_known = 0;
+    for (;;) {
+        uint8_t frame[MAX_MESS_LEN + 300]; // 预留
+        struct sockaddr_storage peer; socklen_t plen = sizeof(peer);
+        prof_enter(PROF_RECV);
+        ssize_t r = recvfrom(s, frame, sizeof(frame), MSG_DONTWAIT, (struct sockaddr*)&peer, &plen);
+        prof_exit();
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            die("recvfrom");
+        }
+        if (r == 0) continue;
+        ncp_receiver_on_packet(rv, frame, (size_t)r, &peer, plen, now_us());
+    }
+}
 
-    int s;
+static void run_receiver(const char* port_str, int expect_loss_sim_env_is_lan_or_wan_unused)
+{
     struct addrinfo hints, *res;
     memset(&hints,0,sizeof(hints));
     hints.ai_family   = AF_INET;
     hints.ai_socktype = SOCK_DGRAM;
     hints.ai_flags    = AI_PASSIVE;
-    //NACK
-    uint64_t last_nack_ms = 0;     // 上次发NACK时间（节流）
-    const   uint64_t nack_gap_ms = 50; // NACK最小间隔
-
 
     if (getaddrinfo(NULL, port_str, &hints, &res)!=0) die("getaddrinfo");
-    s = socket(res->ai_family, res->ai_socktype, 0);
+    int s = socket(res->ai_family, res->ai_socktype, 0);
     if (s<0) die("socket");
+    // 回复用 socket：组播时单独开一个单播 socket，
+    // 同机多个 rcv 共用组播端口，发送端靠源端口区分它们
+    int out_s = s;
+    if (Mcast_group) {
+        // 同一台机器上可以起多个 rcv 收同一个组
+        int yes = 1;
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0) die("setsockopt SO_REUSEADDR");
+    }
     if (bind(s, res->ai_addr, res->ai_addrlen)<0) die("bind");
+    // 内核接收缓冲要装得下一整窗的突发，否则窗口再大也在 socket 里丢
+    uint64_t wbytes = (uint64_t)Window * MAX_MESS_LEN;
+    int rcvbuf = sock_buf_size(s, 1, wbytes);
+    printf("\tSocket receive buffer = %d KB\n", rcvbuf / 1024);
+    if ((uint64_t)rcvbuf < wbytes && wbytes <= SOCK_BUF_MAX) {
+        printf("\t(window needs %lu KB: raise net.core.rmem_max)\n", (unsigned long)(wbytes / 1024));
+    }
     freeaddrinfo(res);
+    if (Mcast_group) {
+        struct ip_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        if (inet_pton(AF_INET, Mcast_group, &mreq.imr_multiaddr) != 1) {
+            printf("Error: bad multicast group %s\n", Mcast_group);
+            exit(1);
+        }
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) die("setsockopt IP_ADD_MEMBERSHIP");
+        out_s = socket(AF_INET, SOCK_DGRAM, 0);
+        if (out_s < 0) die("socket");
+    }
 
     printf("rcv listening on %s/UDP ...\n", port_str);
 
-    // 会话状态
-    FILE*    fp = NULL;
-    char     dst_name[256] = {0};
-    uint64_t file_size = 0;
-    uint32_t next_write_seq = 0;
-    uint64_t bytes_in_order = 0;
-    int      fin_seen = 0;            // 收到 FIN
-    uint32_t fin_seq  = 0;            // 期望的总包数（来自 FIN）
-    //Statistics
-    uint64_t start_ms = 0;        // 本次会话开始时间（收到 START 后）
-    uint64_t last_mark_ms = 0;    // 上一个 10MB 报告时间
-    uint64_t last_mark_bytes = 0; // 上一个 10MB 报告时的有序字节数
-
-
-    // 简易滑动窗口缓冲
-    slot_t*  buf = (slot_t*)calloc(RECV_WINDOW, sizeof(slot_t));
-    if (!buf) die("calloc");
-
+    if (Profile) prof_init();
+    if (Trace_file) {
+        if (trace_open(Trace_file, 'R') < 0) die("trace_open");
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_stop;        // 不带 SA_RESTART：epoll_wait 以 EINTR 返回
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+    }
+    ncp_receiver_cfg_t cfg = { stdout, Window };
+    ncp_transport_t tp = { &out_s, udp_send };
+    ncp_sink_t sink = { NULL, file_open, file_write, file_close, file_zero };
+    if (Out_path) {
+        ncp_sink_t out = { NULL, out_open, out_write, out_close, NULL, out_backlog };
+        sink = out;
+    }
+    ncp_receiver_t *rv = ncp_receiver_new(&cfg, &tp, &sink);
+    if (!rv) die("ncp_receiver_new");
+
+    // 事件循环：socket 可读 + timerfd（会话空闲超时）。
+    // 超时由定时器驱动：发送端消失后不用等下一个包来，到点就放行排队者
+    int ep  = epoll_create1(0);
+    if (ep < 0) die("epoll_create1");
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (tfd < 0) die("timerfd_create");
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN; ev.data.fd = s;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, s, &ev) < 0) die("epoll_ctl");
+    ev.events = EPOLLIN; ev.data.fd = tfd;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev) < 0) die("epoll_ctl");
+    int out_fd = Out.fd, out_watched = 0, out_failed = 0;
+    if (out_fd >= 0) {
+        ev.events = 0; ev.data.fd = out_fd;    // 有积压时才关心可写
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, out_fd, &ev) == 0) Out.pollable = 1;
+        else if (errno != EPERM) die("epoll_ctl output");
+    }
 
-    // 接收 loop
     for (;;) {
-        uint8_t frame[sizeof(hdr_t) + MAX_PAYLOAD + 300]; // 预留
-        struct sockaddr_storage peer; socklen_t plen = sizeof(peer);
-        ssize_t r = recvfrom(s, frame, sizeof(frame), 0, (struct sockaddr*)&peer, &plen);
-        if (r < (ssize_t)sizeof(hdr_t)) continue;
-
-        hdr_t* h = (hdr_t*)frame;
-        uint8_t* payload = frame + sizeof(hdr_t);
-
-        uint64_t now = now_ms();
-        if (busy && last_activity_ms > 0 && now - last_activity_ms > SESSION_IDLE_TIMEOUT_MS) {
-            if (fp) { fclose(fp); fp = NULL; }
-            busy = 0; sender_known = 0; cur_plen = 0;
-            next_write_seq = 0; bytes_in_order = 0; fin_seen = 0; fin_seq = 0;
-            memset(&cur_peer, 0, sizeof(cur_peer));
-            memset(buf, 0, sizeof(slot_t) * RECV_WINDOW);
-            printf("[RCV] session idle timeout, back to IDLE.\n");
-        }
-
-
-        if (h->type == PKT_START) {
-
-            if (busy) {
-                if (!same_peer(&peer, plen, &cur_peer, cur_plen)) {
-                    send_busy(s, (struct sockaddr*)&peer, plen);
-                    continue;
-                }
-                // ✅ 同一 sender 的重复 START：只重发 START_OK，不重置会话/不重开文件
-                send_start_ok(s, (struct sockaddr*)&peer, plen);
-                last_activity_ms = now_ms();
-                continue;
-            } else {
-                // 空闲：登记 sender，一次性初始化
-                busy = 1;
-                memcpy(&cur_peer, &peer, sizeof(peer));
-                cur_plen = plen;
-            }
-            // 同一个 sender 的新 START：重启会话（关闭旧文件，清状态）
-            if (fp) { fclose(fp); fp = NULL; }
-            next_write_seq = 0; bytes_in_order = 0; fin_seen = 0; fin_seq = 0;
-            memset(buf, 0, sizeof(slot_t) * RECV_WINDOW);
-
-
-            file_size = h->file_size;
-            // 取文件名（h->len 为 name 长度）
-            size_t name_len = (size_t)h->len;
-            if (name_len > sizeof(dst_name)-1) name_len = sizeof(dst_name)-1;
-            memcpy(dst_name, payload, name_len);
-            dst_name[name_len] = '\0';
-
-            fp = fopen(dst_name, "wb");
-
-            //Statistics
-            start_ms = now_ms();
-            last_mark_ms = start_ms;
-            last_mark_bytes = 0;
-
-
-            if (!fp) die("fopen");
-            next_write_seq = 0;
-            bytes_in_order = 0;
-            fin_seen = 0;
-            printf("START: recv -> %s (size=%lu)\n", dst_name, (unsigned long)file_size);
-            memcpy(&sender_addr, &peer, sizeof(peer));
-            sender_len = plen;
-            sender_known = 1;
-            send_start_ok(s, (struct sockaddr*)&peer, plen);
-            last_activity_ms = now_ms();
-
-        }else if (h->type == PKT_DATA) {
-            if (!busy) {
-                // 还没会话就来了 FIN（可能 START/数据都丢了）——忽略
-                continue;
-            }
-            // 仅接受当前 sender 的 FIN
-            if (!same_peer(&peer, plen, &cur_peer, cur_plen)) {
-                send_busy(s, (struct sockaddr*)&peer, plen);
-                continue;
-            }
-
-            last_activity_ms = now_ms();
-            if (!fp) continue; // 未 START，忽略
-            // 放入窗口缓冲
-            int idx = slot_index(next_write_seq, h->seq);
-            if (idx < 0) {
-                // 超出窗口太远或重复在窗口左边，先忽略（后续加NACK/重传）
+        ncp_receiver_on_timer(rv, now_us());     // 空闲超时的会话清理掉
+        uint64_t deadline = ncp_receiver_next_deadline(rv);
+        if (Out.draining) {
+            // 积压还没写完：下游太久没读就放弃，别让 rcv 一直挂着
+            uint64_t give_up_us = (Out.drain_ms + STREAM_DRAIN_MS) * 1000ULL;
+            if (now_us() >= give_up_us) {
+                fprintf(stderr, "rcv: output %s not read for %lu s, dropping %lu KB of backlog\n", Out_path,
+                        (unsigned long)(STREAM_DRAIN_MS / 1000), (unsigned long)(Out.len / 1024));
+                out_finish(0);
                 continue;
             }
-            if (!buf[idx].present) {
-                buf[idx].present = 1;
-                buf[idx].seq = h->seq;
-                buf[idx].len = h->len;
-                memcpy(buf[idx].data, payload, h->len);
-            }
-
-            // 尝试按序 flush
-            while (buf[0].present) {
-                // 写盘
-                fwrite(buf[0].data, 1, buf[0].len, fp);
-                bytes_in_order += buf[0].len;
-                next_write_seq++;
-
-                // 窗口整体左移一格（O(W) 简单实现；后续可用环形缓冲优化成 O(1)）
-                memmove(&buf[0], &buf[1], sizeof(slot_t) * (RECV_WINDOW - 1));
-                memset(&buf[RECV_WINDOW - 1], 0, sizeof(slot_t));
-            }
-            // ---- NACK 触发逻辑（有缺口时主动催促 next_write_seq）----
-        if (sender_known) {
-            // 条件1：最左槽 buf[0] 仍缺（说明按序缺口存在）
-            // 条件2：但右侧已有至少一个乱序片（说明不是发得太慢，而是确实丢了一个洞）
-            int has_right = 0;
-            for (int i = 1; i < RECV_WINDOW; ++i) {
-                if (buf[i].present) { has_right = 1; break; }
-            }
-            if (!buf[0].present && has_right) {
-                uint64_t nowms = now_ms();
-                if (nowms - last_nack_ms >= nack_gap_ms) {
-                    // 向发送端请求 next_write_seq 这个分片
-                    send_nack(s, (struct sockaddr*)&sender_addr, sender_len, next_write_seq);
-                    last_nack_ms = nowms;
-                    // 可选日志：printf("[RCV] NACK want=%u\n", next_write_seq);
-                }
-            }
+            if (deadline == 0 || give_up_us < deadline) deadline = give_up_us;
         }
-
-
-            // 10MB 打点：每当有序累计写入增加了 >=10MB，就打印一次
-            uint64_t delta_bytes = bytes_in_order - last_mark_bytes;
-            if (delta_bytes >= TEN_MB) {
-                uint64_t now = now_ms();
-                uint64_t delta_ms = (now - last_mark_ms) ? (now - last_mark_ms) : 1; // 防除零
-                double recent_mbps = (delta_bytes * 8.0) / (double)delta_ms / 1000.0; // Mb/s
-                printf("[RCV] Progress: %.2f MB total, recent 10MB avg rate: %.2f Mb/s\n",
-                    bytes_in_order / (1024.0*1024.0), recent_mbps);
-                fflush(stdout);
-                last_mark_ms = now;
-                // 如果增量 >10MB（一次推进很多），也只前进一个 10MB 档位
-                last_mark_bytes += TEN_MB;
-            }
-
-            // 只要推进了按序进度，就发一次 ACK
-            if (sender_known && next_write_seq > 0) {
-                send_ack(s, (struct sockaddr*)&sender_addr, sender_len, next_write_seq - 1);
-            }
-            // 更新会话活跃时间
-            last_activity_ms = now_ms();
-            
-            // 这里也可以做“每 10MB 输出一次中间速率”的计数（后续再加时间戳/速率计算）
+        if (Out.done) {
+            // 流式输出只收一个会话：留一会应答重发的 FIN 再走
+            uint64_t linger_us = (Out.done_ms + STREAM_LINGER_MS) * 1000ULL;
+            if (now_us() >= linger_us) break;
+            if (deadline == 0 || linger_us < deadline) deadline = linger_us;
+        } else if (Out.pollable && (Out.len > 0) != out_watched) {
+            out_watched = !out_watched;
+            ev.events = out_watched ? EPOLLOUT : 0; ev.data.fd = out_fd;
+            if (epoll_ctl(ep, EPOLL_CTL_MOD, out_fd, &ev) < 0) die("epoll_ctl output");
         }
-        else if (h->type == PKT_FIN) {
-
-            if (!busy) {
-                // 还没会话就来了 FIN（可能 START/数据都丢了）——忽略
-                continue;
-            }
-            last_activity_ms = now_ms();
-            // 仅接受当前 sender 的 FIN
-            if (!same_peer(&peer, plen, &cur_peer, cur_plen)) {
-                send_busy(s, (struct sockaddr*)&peer, plen);
-                continue;
-            }
-            fin_seen = 1; fin_seq = h->seq; file_size = h->file_size;
-            printf("FIN seen: total_seq=%u, size=%lu\n", fin_seq, (unsigned long)file_size);
-            uint64_t end_ms = now_ms();
-
-
-            // 如果已经全部按序写完（简单判断：bytes_in_order == file_size）
-            if (fp && bytes_in_order == file_size) {
-                //When finished, print statistics result
-                double elapsed_s = (end_ms - start_ms) / 1000.0;
-                double avg_mbps = (bytes_in_order * 8.0) / (elapsed_s * 1e6);
-                printf("[RCV] DONE: %.2f MB in %.2f s, avg goodput: %.2f Mb/s\n",
-                    bytes_in_order / (1024.0*1024.0), elapsed_s, avg_mbps);
-                fflush(stdout);
-                
-                fclose(fp); fp = NULL;
-                printf("RECV DONE: %s (%lu bytes)\n", dst_name, (unsigned long)bytes_in_order);
-                // 简化：单次会话就退出；你也可以 while 等下一次 START
-                // ✅ 关键：不退出进程，复位为“空闲”，接受下一次 START
-                busy = 0;
-                sender_known = 0;
-                memset(&cur_peer, 0, sizeof(cur_peer));
-                cur_plen = 0;
-
-                // 复位流水线状态
-                next_write_seq  = 0;
-                bytes_in_order  = 0;
-                fin_seen        = 0;
-                fin_seq         = 0;
-                memset(buf, 0, sizeof(slot_t) * RECV_WINDOW);
-
-                printf("Receiver is ready for the next session.\n");
-                continue;   // 回到 for(;;) 顶部，等待下一次 START
+        arm_timer(tfd, deadline);
+        fflush(stdout);
+        struct epoll_event evs[3];
+        prof_enter(PROF_WAIT);
+        int nev = epoll_wait(ep, evs, 3, -1);
+        prof_exit();
+        if (Stop) break;
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            die("epoll_wait");
+        }
+        for (int i = 0; i < nev; ++i) {
+            if (evs[i].data.fd == s) {
+                receiver_drain(s, rv);
+            } else if (out_fd >= 0 && evs[i].data.fd == out_fd && !Out.done) {
+                // 下游读走了一些：接着写积压，窗口打开够多就告诉发送端
+                prof_enter(PROF_WRITE);
+                int rc = (evs[i].events & (EPOLLERR | EPOLLHUP)) ? -1 : out_flush();
+                prof_exit();
+                if (rc != 0) {
+                    fprintf(stderr, "rcv: output %s closed or failed, giving up\n", Out_path);
+                    out_failed = 1;
+                    break;
+                }
+                if (!Out.draining) ncp_receiver_on_output(rv, now_us());
+                else if (Out.len == 0) out_finish(1);
+            } else if (evs[i].data.fd == tfd) {
+                uint64_t expirations;
+                if (read(tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) die("read timerfd");
             }
-                last_activity_ms = now_ms();   // 否则继续等前面洞补齐（后续会用重传/超时推动）
         }
+        if (out_failed) break;
     }
-
-    free(buf);
+    if (Out.draining) out_finish(0);     // 下游失败或被信号打断：会话已不在引擎里，在这里关
+
+    close(tfd);
+    close(ep);
+    uint64_t trace_lost = trace_close();
+    if (trace_lost > 0) printf("[RCV] Trace: %lu records dropped (ring full)\n", (unsigned long)trace_lost);
+    ncp_receiver_free(rv);
+    if (out_s != s) close(out_s);
     close(s);
 }
 
 int main(int argc, char *argv[]) {
     /* Initialize */
     Usage(argc, argv);
+    if (Out_path) out_setup();    // 先于任何输出："-" 时 stdout 只留给数据
     sendto_dbg_init(Loss_rate);
     printf("Successfully initialized with:\n");
     printf("\tLoss rate = %d\n", Loss_rate);
     printf("\tPort = %s\n", Port_Str);
+    if (Mcast_group) printf("\tMulticast group = %s\n", Mcast_group);
+    if (Out_path) printf("\tOutput = %s (one session, in-order stream)\n", Out_path);
+    printf("\tWindow = %u segments\n", Window);
     if (Mode == MODE_LAN) {
         printf("\tMode = LAN\n");
-    } else { /*(Mode == WAN)*/
+    } else if (Mode == MODE_WAN) {
         printf("\tMode = WAN\n");
+    } else {
+        printf("\tMode = AUTO\n");
     }
     run_receiver(Port_Str, Mode);
 }
 
 /* Read commandline arguments */
 static void Usage(int argc, char *argv[]) {
-    if (argc != 4) {
+    int opt;
+    while ((opt = getopt(argc, argv, "+g:w:o:PT:")) != -1) {
+        switch (opt) {
+        case 'g': Mcast_group = optarg; break;
+        case 'P': Profile = 1; break;
+        case 'T': Trace_file = optarg; break;
+        case 'o': Out_path = optarg; break;
+        case 'w':
+            Window = (uint32_t)strtoul(optarg, NULL, 10);
+            if (Window == 0) Print_help();
+            break;
+        default:  Print_help();
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    // env 可省略：接收端不按它调参，发送端会探测链路
+    if (argc != 3 && argc != 4) {
         Print_help();
     }
 
@@ -369,16 +485,25 @@ static void Usage(int argc, char *argv[]) {
 
     Port_Str = argv[2];
 
-    if (!strncmp(argv[3], "WAN", 4)) {
+    Mode = MODE_AUTO;
+    if (argc == 3) {
+        // 没有 env
+    } else if (!strncmp(argv[3], "WAN", 4)) {
         Mode = MODE_WAN;
     } else if (!strncmp(argv[3], "LAN", 4)) {
         Mode = MODE_LAN;
-    } else {
+    } else if (strncmp(argv[3], "AUTO", 5)) {
         Print_help();
     }
 }
 
 static void Print_help(void) {
-    printf("Usage: rcv <loss_rate_percent> <port> <env>\n");
+    printf("Usage: rcv [-g multicast_group] [-w window] [-o output] [-P] [-T trace_file] <loss_rate_percent> <port> [<env>]\n");
+    printf("       -g  join a multicast group to receive an ncp fan-out (several rcv may share the port)\n");
+    printf("       -w  receive window in segments (default %d); only out-of-order segments are buffered\n", NCP_RCV_WINDOW);
+    printf("       -o  receive one file and stream it in order to output (\"-\" = stdout, or a named pipe) as it arrives;\n");
+    printf("           a slow reader shrinks the advertised window and throttles the sender. Logs go to stderr with \"-\"\n");
+    printf("       -P  profile each session: per-phase time, cycles, instructions, cache misses and context switches\n");
+    printf("       -T  write a binary trace of every packet event to trace_file until interrupted (decode with ncp_trace)\n");
     exit(0);
 }
@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "net_include.h"
+#include "trace.h"
+
 static int first_time = 1;
 static int cutoff = 64; /* default is 25% loss */
 
@@ -31,6 +34,11 @@ int sendto_dbg(int s, const char *buf, int len, int flags,
 
     decision = rand() & 0xff;
     if ((cutoff > 0) && (decision <= cutoff)) { /* drop the packet, but claim success */
+        if (trace_on) { /* seq = bytes 1..4 (network order) for DATA/ACK/NACK/... */
+            const unsigned char *p = (const unsigned char *)buf;
+            uint32_t seq = len >= 5 ? ((uint32_t)p[1] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 8 | p[4]) : 0;
+            trace_put(now_us(), TR_DROP, 0, seq, (uint32_t)len, len > 0 ? (p[0] & 0x1f) : 0, 0);
+        }
         return (len);
     }
     ret = sendto(s, buf, len, flags, to, tolen);
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_include.h"
+#include "sim_net.h"
+
+#include <arpa/inet.h>
+
+typedef struct {
+    uint64_t due_us;                  // 到达时间
+    uint64_t done_us;                 // 发完（离开瓶颈队列）的时间
+    uint32_t len;
+    uint8_t  data[SIM_KEEP];
+} sim_pkt_t;
+
+typedef struct {
+    sim_net_t *net;
+    int        ep;
+} sim_ep_t;
+
+typedef struct {
+    sim_link_cfg_t   cfg;
+    sim_pkt_t       *q;               // 环形 FIFO：发完时间和到达时间都按入队顺序递增
+    size_t           cap, head, count;
+    uint64_t         enq_n, deq_n;    // 累计入队 / 出队数
+    uint64_t         done_n;          // 累计已发完的（>= deq_n 之前的都算）；之后的还在排队
+    double           free_us;         // 链路空闲时刻：上一个报文发完
+    double           p_gb, p_bg;      // Gilbert-Elliott：好→坏、坏→好的转移概率
+    int              bad;
+    uint64_t         rng;
+    sim_link_stats_t st;
+} sim_link_t;
+
+struct sim_net {
+    sim_link_t link[2];               // 按目的端点
+    sim_ep_t   ep[2];
+    uint64_t   now_us;
+};
+
+// xorshift64*：每条链路一个，不碰全局 rand 状态
+static double link_rand(sim_link_t *l)
+{
+    l->rng ^= l->rng >> 12;
+    l->rng ^= l->rng << 25;
+    l->rng ^= l->rng >> 27;
+    return (double)((l->rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int link_drop(sim_link_t *l)
+{
+    if (l->cfg.loss <= 0) return 0;
+    if (l->cfg.burst <= 1) return link_rand(l) < l->cfg.loss;
+    double u = link_rand(l);
+    if (l->bad) { if (u < l->p_bg) l->bad = 0; }
+    else if (u < l->p_gb) l->bad = 1;
+    return l->bad;
+}
+
+static int link_grow(sim_link_t *l)
+{
+    size_t cap = l->cap ? l->cap * 2 : 1024;
+    sim_pkt_t *q = (sim_pkt_t*)malloc(cap * sizeof(sim_pkt_t));
+    if (!q) return -1;
+    for (size_t i = 0; i < l->count; ++i) q[i] = l->q[(l->head + i) % l->cap];
+    free(l->q);
+    l->q = q;
+    l->cap = cap;
+    l->head = 0;
+    return 0;
+}
+
+static sim_pkt_t *link_at(sim_link_t *l, uint64_t n)   // 第 n 个入队的（n >= deq_n）
+{
+    return &l->q[(l->head + (size_t)(n - l->deq_n)) % l->cap];
+}
+
+static void link_send(sim_link_t *l, const uint8_t *buf, size_t len, uint64_t now)
+{
+    l->st.sent++;
+    if (len > MAX_MESS_LEN || link_drop(l)) { l->st.lost++; return; }
+    // 瓶颈队列里还剩几个：已发完的往前推
+    if (l->done_n < l->deq_n) l->done_n = l->deq_n;
+    while (l->done_n < l->enq_n && link_at(l, l->done_n)->done_us <= now) l->done_n++;
+    size_t queued = (size_t)(l->enq_n - l->done_n);
+    if (l->cfg.buffer && queued >= l->cfg.buffer) { l->st.overflow++; return; }
+    if (l->count == l->cap && link_grow(l) != 0) { l->st.overflow++; return; }
+
+    double start = l->free_us > (double)now ? l->free_us : (double)now;
+    double done  = l->cfg.rate_bps > 0 ? start + len * 8.0 * 1e6 / l->cfg.rate_bps : (double)now;
+    if (l->cfg.rate_bps > 0) l->free_us = done;
+    sim_pkt_t *p = &l->q[(l->head + l->count) % l->cap];
+    p->done_us = (uint64_t)done;
+    p->due_us  = p->done_us + l->cfg.delay_us;
+    p->len     = (uint32_t)len;
+    memcpy(p->data, buf, len < SIM_KEEP ? len : SIM_KEEP);
+    l->count++;
+    l->enq_n++;
+    if (queued + 1 > l->st.max_queue) l->st.max_queue = queued + 1;
+}
+
+static void sim_send(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr *to, socklen_t tolen)
+{
+    const sim_ep_t *ep = (const sim_ep_t*)ctx;
+    (void)to; (void)tolen;            // 只有两个端点：发给对面
+    link_send(&ep->net->link[!ep->ep], buf, len, ep->net->now_us);
+}
+
+void sim_net_addr(int ep, struct sockaddr_storage *addr, socklen_t *alen)
+{
+    struct sockaddr_in *in = (struct sockaddr_in*)addr;
+    memset(addr, 0, sizeof(*addr));
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)(SIM_PORT0 + ep));
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *alen = sizeof(*in);
+}
+
+sim_net_t *sim_net_new(const sim_link_cfg_t *fwd, const sim_link_cfg_t *rev, uint64_t seed)
+{
+    sim_net_t *net = (sim_net_t*)calloc(1, sizeof(*net));
+    if (!net) return NULL;
+    net->link[SIM_RCV].cfg = *fwd;
+    net->link[SIM_SND].cfg = *rev;
+    for (int i = 0; i < 2; ++i) {
+        sim_link_t *l = &net->link[i];
+        if (l->cfg.burst > 1 && l->cfg.loss > 0 && l->cfg.loss < 1) {
+            // 稳态坏状态占比 = p_gb / (p_gb + p_bg) = loss，平均在坏状态停 1 / p_bg 个报文
+            l->p_bg = 1.0 / l->cfg.burst;
+            l->p_gb = l->cfg.loss * l->p_bg / (1.0 - l->cfg.loss);
+        }
+        l->rng = (seed + 1) * 0x9E3779B97F4A7C15ULL + (uint64_t)i;   // 不能是 0
+        if (link_grow(l) != 0) { sim_net_free(net); return NULL; }
+        net->ep[i].net = net;
+        net->ep[i].ep = i;
+    }
+    return net;
+}
+
+void sim_net_free(sim_net_t *net)
+{
+    if (!net) return;
+    free(net->link[0].q);
+    free(net->link[1].q);
+    free(net);
+}
+
+ncp_transport_t sim_net_transport(sim_net_t *net, int ep)
+{
+    ncp_transport_t tp = { &net->ep[ep], sim_send };
+    return tp;
+}
+
+void sim_net_set_time(sim_net_t *net, uint64_t now_us)
+{
+    net->now_us = now_us;
+}
+
+int sim_net_pop(sim_net_t *net, uint64_t now_us, uint8_t *buf, size_t *len,
+                struct sockaddr_storage *from, socklen_t *flen)
+{
+    // 两条链路里先到的那个
+    int dst = -1;
+    for (int i = 0; i < 2; ++i) {
+        const sim_link_t *l = &net->link[i];
+        if (l->count == 0 || l->q[l->head].due_us > now_us) continue;
+        if (dst < 0 || l->q[l->head].due_us < net->link[dst].q[net->link[dst].head].due_us) dst = i;
+    }
+    if (dst < 0) return -1;
+    sim_link_t *l = &net->link[dst];
+    const sim_pkt_t *p = &l->q[l->head];
+    memcpy(buf, p->data, p->len < SIM_KEEP ? p->len : SIM_KEEP);
+    *len = p->len;
+    sim_net_addr(!dst, from, flen);
+    l->head = (l->head + 1) % l->cap;
+    l->count--;
+    l->deq_n++;
+    l->st.delivered++;
+    return dst;
+}
+
+uint64_t sim_net_next_due(const sim_net_t *net)
+{
+    uint64_t due = 0;
+    for (int i = 0; i < 2; ++i) {
+        const sim_link_t *l = &net->link[i];
+        if (l->count && (due == 0 || l->q[l->head].due_us < due)) due = l->q[l->head].due_us;
+    }
+    return due;
+}
+
+void sim_net_stats(const sim_net_t *net, int dst, sim_link_stats_t *st)
+{
+    *st = net->link[dst].st;
+}
@@ -0,0 +1,63 @@
+#ifndef CS2520_SIM_NET
+#define CS2520_SIM_NET
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "libncp.h"
+
+/*
+ * 模拟链路：给 ncp_sim 用，一个发送端一个接收端，两个方向各一条链路。
+ * 每条链路是一个瓶颈：报文先按丢包模型丢（同 sendto_dbg，在发出端），再进尾丢的队列，
+ * 按带宽逐个发出（发送时长 = 长度 / 带宽），发完再过固定的传播时延到达。
+ * 丢包模型：独立随机丢，或 Gilbert-Elliott 两状态（坏状态全丢），给出平均丢包率和平均连续丢包长度。
+ *
+ * 与 mem_transport 不同，这里不搬负载：只保留报文头部（SIM_KEEP 字节），交付时后面的字节不确定，
+ * 所以接收端的 sink 只能计数。时间由调用方传入（微秒），同一个 seed 结果完全一样。
+ */
+
+enum { SIM_SND = 0, SIM_RCV = 1 };    // 端点；链路按目的端点编号：0 = 回程（ACK），1 = 去程（DATA）
+
+#define SIM_PORT0 10000
+#define SIM_KEEP  288                 // 保留的报文头部（START 带文件名最长 268 字节）
+
+typedef struct sim_net sim_net_t;
+
+typedef struct {
+    double   rate_bps;                // 带宽（比特/秒），0 = 不限
+    uint64_t delay_us;                // 单向传播时延
+    size_t   buffer;                  // 瓶颈队列（排队等发送的报文数），0 = 不限
+    double   loss;                    // 平均丢包率 0..1
+    double   burst;                   // 平均连续丢包长度；> 1 用 Gilbert-Elliott，否则独立随机丢
+} sim_link_cfg_t;
+
+typedef struct {
+    uint64_t sent;                    // 交给链路的报文数
+    uint64_t lost;                    // 丢包模型丢掉的
+    uint64_t overflow;                // 队列满被尾丢的
+    uint64_t delivered;
+    size_t   max_queue;               // 瓶颈队列最长时的报文数
+} sim_link_stats_t;
+
+// fwd：发送端到接收端，rev：回程
+sim_net_t *sim_net_new(const sim_link_cfg_t *fwd, const sim_link_cfg_t *rev, uint64_t seed);
+void sim_net_free(sim_net_t *net);
+
+void sim_net_addr(int ep, struct sockaddr_storage *addr, socklen_t *alen);
+ncp_transport_t sim_net_transport(sim_net_t *net, int ep);
+
+// 设定下一批 send 的时间戳（调用 libncp 入口前设成同一个 now）
+void sim_net_set_time(sim_net_t *net, uint64_t now_us);
+
+// 取出一个已到达（<= now）的报文：返回目的端点，没有则返回 -1。buf 至少 MAX_MESS_LEN 字节
+int sim_net_pop(sim_net_t *net, uint64_t now_us, uint8_t *buf, size_t *len,
+                struct sockaddr_storage *from, socklen_t *flen);
+
+// 最早的到达时间，两条链路都空返回 0
+uint64_t sim_net_next_due(const sim_net_t *net);
+
+// dst：链路的目的端点
+void sim_net_stats(const sim_net_t *net, int dst, sim_link_stats_t *st);
+
+#endif
@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "net_include.h"
+#include "sendto_dbg.h"
+#include "snd_pipe.h"
+
+#include <sys/eventfd.h>
+
+#define CACHE_SEGS  8192u             // 分片缓存：8192 片约 11 MB
+#define READ_CHUNK  64u               // 预读一次 pread 的分片数；是 CACHE_SEGS 的约数，一次读不会绕回环头
+#define ACK_BATCH   64                // ACK 线程一次加锁最多交给引擎的包数
+static const long ACK_POLL_MS = 20;   // ACK 线程收包超时：到点看一下是否该退出
+
+static void die(const char* msg){ perror(msg); exit(1); }
+
+typedef struct {
+    uint32_t  len;
+    socklen_t tolen;
+    struct sockaddr_storage to;
+    uint8_t   data[MAX_MESS_LEN];
+} tx_pkt_t;
+
+typedef struct {
+    tx_pkt_t *pkt;
+    size_t    n, cap;
+} tx_queue_t;
+
+// 每个阶段的统计
+typedef struct {
+    uint64_t cpu_ns;                  // 线程 CPU 时间
+    uint64_t items;                   // 预读：分片；ACK：包；发送：报文
+    uint64_t batches;                 // 预读：pread 次数；ACK：加锁次数；发送：取队列次数
+    uint64_t lock_wait_ns;            // 等引擎锁（只在有争用时计时）
+    uint64_t waits;                   // 预读：缓存满等引擎的次数
+} stage_t;
+
+enum { ST_READ, ST_ACK, ST_TX, STAGES };
+static const char *Stage_names[STAGES] = { "read", "ack", "tx" };
+
+struct snd_pipe {
+    int       sock, fd, efd;
+    uint64_t  size, nsegs;
+    pthread_mutex_t lock;             // 引擎锁
+    tx_queue_t q[2];                  // q[fill] 在锁内由引擎填，另一个归发送线程
+    int       fill;
+    ncp_sender_t *sn;
+
+    // 分片缓存：第 seg 片放在 slot[seg % CACHE_SEGS]，tag = seg + 1（0 = 空或正在写）
+    uint8_t (*slot)[MAX_PAYLOAD];
+    _Atomic uint64_t *tag;
+    _Atomic uint64_t want_hi;         // 引擎取过的最大分片 + 1：预读最多领先它 CACHE_SEGS 片
+    _Atomic uint64_t reader_need;     // 预读线程在等 want_hi 到这个值（0 = 没在等）
+    pthread_mutex_t rd_lock;
+    pthread_cond_t  rd_cond;
+    uint64_t  hits, misses;           // 引擎锁内更新
+
+    pthread_t reader, acker;
+    int       has_reader, has_acker;
+    int       cpus[STAGES];           // 绑的核，-1 = 没绑
+    uint64_t  tx_cpu0;                // 发送线程（调用方）开始时的 CPU 时间
+    _Atomic int stop;
+    stage_t   st[STAGES];
+};
+
+static uint64_t clock_ns(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// 加引擎锁；拿不到时才计时，没有争用就不多读时钟
+static void lock_engine(snd_pipe_t *pp, stage_t *st)
+{
+    if (pthread_mutex_trylock(&pp->lock) == 0) return;
+    uint64_t t0 = clock_ns(CLOCK_MONOTONIC);
+    pthread_mutex_lock(&pp->lock);
+    st->lock_wait_ns += clock_ns(CLOCK_MONOTONIC) - t0;
+}
+
+/* ---------------- 预读 ---------------- */
+
+static uint32_t seg_bytes(const snd_pipe_t *pp, uint64_t seg)
+{
+    uint64_t off = seg * MAX_PAYLOAD;
+    return pp->size - off < MAX_PAYLOAD ? (uint32_t)(pp->size - off) : MAX_PAYLOAD;
+}
+
+static void *read_main(void *arg)
+{
+    snd_pipe_t *pp = (snd_pipe_t*)arg;
+    stage_t *st = &pp->st[ST_READ];
+    uint64_t next = 0;
+    while (!atomic_load(&pp->stop) && next < pp->nsegs) {
+        uint64_t hi = atomic_load(&pp->want_hi);
+        // 引擎跳到前面去了（空洞、缓存没赶上）：从它那里接着读
+        if (next + READ_CHUNK <= hi) next = hi / READ_CHUNK * READ_CHUNK;
+        if (next + READ_CHUNK > hi + CACHE_SEGS) {
+            // 缓存满：等引擎取走一块
+            pthread_mutex_lock(&pp->rd_lock);
+            atomic_store(&pp->reader_need, next + READ_CHUNK - CACHE_SEGS);
+            while (!atomic_load(&pp->stop) && atomic_load(&pp->want_hi) + CACHE_SEGS < next + READ_CHUNK) {
+                pthread_cond_wait(&pp->rd_cond, &pp->rd_lock);
+            }
+            atomic_store(&pp->reader_need, 0);
+            pthread_mutex_unlock(&pp->rd_lock);
+            st->waits++;
+            continue;
+        }
+        uint32_t n = pp->nsegs - next < READ_CHUNK ? (uint32_t)(pp->nsegs - next) : READ_CHUNK;
+        // 稀疏文件：整块都在空洞里就跳过（引擎对空洞发 ZERO，不会来读）
+        off_t d = lseek(pp->fd, (off_t)(next * MAX_PAYLOAD), SEEK_DATA);
+        if (d < 0 && errno == ENXIO) break;
+        if (d >= (off_t)((next + n) * MAX_PAYLOAD)) {
+            next = (uint64_t)d / MAX_PAYLOAD / READ_CHUNK * READ_CHUNK;
+            continue;
+        }
+        uint32_t at = (uint32_t)(next % CACHE_SEGS);
+        for (uint32_t k = 0; k < n; ++k) atomic_store_explicit(&pp->tag[at + k], 0, memory_order_release);
+        atomic_thread_fence(memory_order_seq_cst);   // 先让读者看到作废，再改内容
+        ssize_t r = pread(pp->fd, pp->slot[at], (size_t)n * MAX_PAYLOAD, (off_t)(next * MAX_PAYLOAD));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;            // 读错：引擎回退到直接 pread，错误在那里报
+        uint32_t ok = 0;
+        for (uint32_t k = 0; k < n; ++k) {
+            if ((uint64_t)k * MAX_PAYLOAD + seg_bytes(pp, next + k) > (uint64_t)r) break;
+            atomic_store_explicit(&pp->tag[at + k], next + k + 1, memory_order_release);
+            ok++;
+        }
+        st->items += ok;
+        st->batches++;
+        // 读短了（文件在传输中变短等）：不再预读，引擎回退到直接 pread，错误在那里报。
+        // 接着读的话 next 不再按 READ_CHUNK 对齐，下一次会写出环尾
+        if (ok < n) break;
+        next += n;
+    }
+    st->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    return NULL;
+}
+
+ssize_t snd_pipe_read_at(void *ctx, void *buf, size_t len, uint64_t off)
+{
+    snd_pipe_t *pp = (snd_pipe_t*)ctx;
+    uint64_t seg = off / MAX_PAYLOAD;
+    if (pp->has_reader && off % MAX_PAYLOAD == 0 && len <= MAX_PAYLOAD) {
+        if (seg + 1 > atomic_load_explicit(&pp->want_hi, memory_order_relaxed)) {
+            atomic_store(&pp->want_hi, seg + 1);
+            uint64_t need = atomic_load(&pp->reader_need);
+            if (need && seg + 1 >= need) {
+                pthread_mutex_lock(&pp->rd_lock);
+                pthread_cond_signal(&pp->rd_cond);
+                pthread_mutex_unlock(&pp->rd_lock);
+            }
+        }
+        // 拷贝前后 tag 都对，说明拷贝期间预读线程没动这个槽
+        _Atomic uint64_t *t = &pp->tag[seg % CACHE_SEGS];
+        if (atomic_load_explicit(t, memory_order_acquire) == seg + 1) {
+            memcpy(buf, pp->slot[seg % CACHE_SEGS], len);
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(t, memory_order_relaxed) == seg + 1) {
+                pp->hits++;
+                return (ssize_t)len;
+            }
+        }
+        pp->misses++;
+    }
+    ssize_t n;
+    do {
+        n = pread(pp->fd, buf, len, (off_t)off);
+    } while (n < 0 && errno == EINTR);
+    return n == (ssize_t)len ? n : -1;
+}
+
+/* ---------------- 发送队列 ---------------- */
+
+static void queue_send(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr *to, socklen_t tolen)
+{
+    snd_pipe_t *pp = (snd_pipe_t*)ctx;
+    tx_queue_t *q = &pp->q[pp->fill];
+    if (len > MAX_MESS_LEN || tolen > sizeof(struct sockaddr_storage)) return;
+    if (q->n == q->cap) {
+        size_t cap = q->cap ? q->cap * 2 : 256;
+        tx_pkt_t *p = (tx_pkt_t*)realloc(q->pkt, cap * sizeof(tx_pkt_t));
+        if (!p) return;               // 内存不够就当丢包，引擎会重传
+        q->pkt = p;
+        q->cap = cap;
+    }
+    tx_pkt_t *p = &q->pkt[q->n++];
+    p->len = (uint32_t)len;
+    p->tolen = tolen;
+    memcpy(&p->to, to, tolen);
+    memcpy(p->data, buf, len);
+}
+
+int snd_pipe_transmit(snd_pipe_t *pp)
+{
+    stage_t *st = &pp->st[ST_TX];
+    lock_engine(pp, st);
+    tx_queue_t *q = &pp->q[pp->fill];
+    pp->fill = !pp->fill;
+    pthread_mutex_unlock(&pp->lock);
+    if (q->n == 0) return 0;
+    for (size_t i = 0; i < q->n; ++i) {
+        const tx_pkt_t *p = &q->pkt[i];
+        sendto_dbg(pp->sock, (const char*)p->data, (int)p->len, 0, (const struct sockaddr*)&p->to, (int)p->tolen);
+    }
+    int n = (int)q->n;
+    st->items += q->n;
+    st->batches++;
+    q->n = 0;
+    return n;
+}
+
+/* ---------------- ACK ---------------- */
+
+typedef struct {
+    uint8_t   buf[MAX_MESS_LEN];
+    size_t    len;
+    struct sockaddr_storage from;
+    socklen_t flen;
+} rx_pkt_t;
+
+static void *ack_main(void *arg)
+{
+    snd_pipe_t *pp = (snd_pipe_t*)arg;
+    stage_t *st = &pp->st[ST_ACK];
+    rx_pkt_t *b = (rx_pkt_t*)malloc(ACK_BATCH * sizeof(rx_pkt_t));
+    if (!b) die("malloc");
+    while (!atomic_load(&pp->stop)) {
+        // 第一个包阻塞等（带超时），之后把已经排着的一起取走
+        int n = 0;
+        while (n < ACK_BATCH) {
+            b[n].flen = sizeof(b[n].from);
+            ssize_t r = recvfrom(pp->sock, b[n].buf, sizeof(b[n].buf), n ? MSG_DONTWAIT : 0,
+                                 (struct sockaddr*)&b[n].from, &b[n].flen);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                die("recvfrom");
+            }
+            b[n++].len = (size_t)r;
+        }
+        if (n == 0) continue;
+        lock_engine(pp, st);
+        uint64_t now = now_us();      // 锁里取时间：两个线程交给引擎的时间不会倒退
+        for (int i = 0; i < n; ++i) ncp_sender_on_packet(pp->sn, b[i].buf, b[i].len, &b[i].from, b[i].flen, now);
+        pthread_mutex_unlock(&pp->lock);
+        st->items += (uint64_t)n;
+        st->batches++;
+        uint64_t one = 1;
+        if (write(pp->efd, &one, sizeof(one)) < 0 && errno != EAGAIN) die("write eventfd");
+    }
+    free(b);
+    st->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    return NULL;
+}
+
+/* ---------------- 生命周期 ---------------- */
+
+snd_pipe_t *snd_pipe_new(int sock, int fd, uint64_t size)
+{
+    snd_pipe_t *pp = (snd_pipe_t*)calloc(1, sizeof(*pp));
+    if (!pp) return NULL;
+    pp->sock = sock;
+    pp->fd   = fd;
+    pp->size = size;
+    pp->nsegs = (size + MAX_PAYLOAD - 1) / MAX_PAYLOAD;
+    for (int i = 0; i < STAGES; ++i) pp->cpus[i] = -1;
+    pthread_mutex_init(&pp->lock, NULL);
+    pthread_mutex_init(&pp->rd_lock, NULL);
+    pthread_cond_init(&pp->rd_cond, NULL);
+    pp->efd = eventfd(0, EFD_NONBLOCK);
+    if (pp->efd < 0) { free(pp); return NULL; }
+    if (fd >= 0 && pp->nsegs > 0) {
+        pp->slot = malloc((size_t)CACHE_SEGS * MAX_PAYLOAD);
+        pp->tag  = calloc(CACHE_SEGS, sizeof(*pp->tag));
+        if (!pp->slot || !pp->tag) { snd_pipe_free(pp); return NULL; }
+        if (pthread_create(&pp->reader, NULL, read_main, pp) != 0) { snd_pipe_free(pp); return NULL; }
+        pp->has_reader = 1;
+    }
+    return pp;
+}
+
+// 可用的核够三个时，各阶段绑一个：调用方（发送）、ACK、预读
+static void pin_stages(snd_pipe_t *pp)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    int cpus[STAGES], n = 0;
+    for (int c = 0; c < CPU_SETSIZE && n < STAGES; ++c) {
+        if (CPU_ISSET(c, &allowed)) cpus[n++] = c;
+    }
+    if (n < STAGES) return;
+    pthread_t th[STAGES] = { pp->reader, pp->acker, pthread_self() };
+    for (int i = 0; i < STAGES; ++i) {
+        if (i == ST_READ && !pp->has_reader) continue;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpus[i], &one);
+        if (pthread_setaffinity_np(th[i], sizeof(one), &one) == 0) pp->cpus[i] = cpus[i];
+    }
+}
+
+void snd_pipe_start(snd_pipe_t *pp, ncp_sender_t *sn)
+{
+    pp->sn = sn;
+    struct timeval tv = { 0, ACK_POLL_MS * 1000 };
+    if (setsockopt(pp->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) die("setsockopt SO_RCVTIMEO");
+    if (pthread_create(&pp->acker, NULL, ack_main, pp) != 0) die("pthread_create");
+    pp->has_acker = 1;
+    pin_stages(pp);
+    pp->tx_cpu0 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void snd_pipe_stop(snd_pipe_t *pp)
+{
+    if (atomic_exchange(&pp->stop, 1)) return;
+    pp->st[ST_TX].cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - pp->tx_cpu0;
+    pthread_mutex_lock(&pp->rd_lock);
+    pthread_cond_broadcast(&pp->rd_cond);
+    pthread_mutex_unlock(&pp->rd_lock);
+    if (pp->has_reader) pthread_join(pp->reader, NULL);
+    if (pp->has_acker) pthread_join(pp->acker, NULL);
+    pp->has_reader = pp->has_acker = 0;
+}
+
+void snd_pipe_free(snd_pipe_t *pp)
+{
+    if (!pp) return;
+    snd_pipe_stop(pp);
+    free(pp->q[0].pkt);
+    free(pp->q[1].pkt);
+    free(pp->slot);
+    free(pp->tag);
+    if (pp->efd >= 0) close(pp->efd);
+    pthread_mutex_destroy(&pp->lock);
+    pthread_mutex_destroy(&pp->rd_lock);
+    pthread_cond_destroy(&pp->rd_cond);
+    free(pp);
+}
+
+ncp_transport_t snd_pipe_transport(snd_pipe_t *pp)
+{
+    ncp_transport_t tp = { pp, queue_send };
+    return tp;
+}
+
+void snd_pipe_lock(snd_pipe_t *pp)   { lock_engine(pp, &pp->st[ST_TX]); }
+void snd_pipe_unlock(snd_pipe_t *pp) { pthread_mutex_unlock(&pp->lock); }
+int  snd_pipe_event_fd(const snd_pipe_t *pp) { return pp->efd; }
+int  snd_pipe_fd(const snd_pipe_t *pp) { return pp->fd; }
+
+void snd_pipe_report(const snd_pipe_t *pp, FILE *out, double elapsed_s)
+{
+    fprintf(out, "[SND] Pipeline:");
+    if (pp->cpus[ST_ACK] >= 0) {
+        fprintf(out, " stages pinned to CPUs");
+        for (int i = 0; i < STAGES; ++i) {
+            if (pp->cpus[i] >= 0) fprintf(out, " %s=%d", Stage_names[i], pp->cpus[i]);
+        }
+        fprintf(out, "\n");
+    } else {
+        fprintf(out, " fewer than %d CPUs available, stages not pinned\n", STAGES);
+    }
+    for (int i = 0; i < STAGES; ++i) {
+        const stage_t *st = &pp->st[i];
+        if (i == ST_READ && pp->fd < 0) continue;
+        fprintf(out, "[SND]   %-4s cpu %5.1f%%", Stage_names[i],
+                elapsed_s > 0 ? st->cpu_ns / 1e9 / elapsed_s * 100.0 : 0.0);
+        if (i == ST_READ) {
+            fprintf(out, ", %lu segments in %lu reads, waited for the engine %lu times; cache hits %lu, misses %lu\n",
+                    (unsigned long)st->items, (unsigned long)st->batches, (unsigned long)st->waits,
+                    (unsigned long)pp->hits, (unsigned long)pp->misses);
+        } else {
+            fprintf(out, ", %lu packets in %lu %s, lock wait %.2f ms\n",
+                    (unsigned long)st->items, (unsigned long)st->batches,
+                    i == ST_ACK ? "batches" : "flushes", st->lock_wait_ns / 1e6);
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef CS2520_SND_PIPE
+#define CS2520_SND_PIPE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "libncp.h"
+
+/*
+ * ncp -M：发送端拆成三个线程的流水线，各占一个核（可用 CPU 够时绑核）：
+ *   预读线程  把源文件按顺序读进分片缓存（固定大小的环），引擎取新分片时直接拷贝，
+ *             慢盘不再卡住 ACK 处理；缓存里没有（重传的旧分片、还没读到）就直接 pread
+ *   ACK 线程  阻塞收 socket，一批包一次加锁交给引擎（更新窗口、判丢）
+ *   发送线程  调用方自己的事件循环：按 pacing / 重传定时器驱动引擎，
+ *             把引擎排进发送队列的报文在锁外用 sendto 发出去
+ * libncp 的引擎本身是单线程的：所有引擎调用都要在 snd_pipe_lock / snd_pipe_unlock 之间，
+ * 锁里只有协议计算，系统调用（recvfrom、sendto、pread）都在锁外。
+ */
+typedef struct snd_pipe snd_pipe_t;
+
+// sock：UDP socket（ACK 线程收、发送线程发）。fd >= 0 时起预读线程读 [0, size)
+snd_pipe_t *snd_pipe_new(int sock, int fd, uint64_t size);
+// 引擎建好后起 ACK 线程；ACK 处理完会写 snd_pipe_event_fd 唤醒发送线程
+void snd_pipe_start(snd_pipe_t *pp, ncp_sender_t *sn);
+void snd_pipe_stop(snd_pipe_t *pp);       // 停线程（发送线程看到传输结束后调用）
+void snd_pipe_free(snd_pipe_t *pp);
+
+// 给引擎用：发送只进队列；读源文件先查分片缓存
+ncp_transport_t snd_pipe_transport(snd_pipe_t *pp);
+ssize_t snd_pipe_read_at(void *ctx, void *buf, size_t len, uint64_t off);
+
+void snd_pipe_lock(snd_pipe_t *pp);
+void snd_pipe_unlock(snd_pipe_t *pp);
+// 发送线程：取走队列（短暂加锁）并在锁外发出，返回发出的报文数
+int  snd_pipe_transmit(snd_pipe_t *pp);
+int  snd_pipe_event_fd(const snd_pipe_t *pp);
+int  snd_pipe_fd(const snd_pipe_t *pp);   // 源文件（找空洞用）
+
+// 各阶段的 CPU 占用（线程 CPU 时间 / 传输用时）、锁等待、缓存命中
+void snd_pipe_report(const snd_pipe_t *pp, FILE *out, double elapsed_s);
+
+#endif
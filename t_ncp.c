@@ -1,22 +1,29 @@
 // t_ncp.c - TCP sender baseline for Project 1
-// Usage: ./t_ncp <src_file> <dest_file>@<ip>:<port>
+// Usage: ./t_ncp [-b sndbuf_bytes] [-p conns] <src_file> <dest_file>@<ip>:<port>
+//
+// 文件体用 sendfile 直接从页缓存发出（不经用户态缓冲）。
+// -p N 时文件切成 N 段连续区间，每段一条 TCP 连接，单线程 poll 驱动。
 
 #define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-#define BUF_SIZE (1<<16) // 64KB
+#define MAX_CONNS 64
+#define SENDFILE_CHUNK (1<<20) // 每次 sendfile 最多 1MB，轮流照顾各连接
 
 static void die(const char* msg) { perror(msg); exit(1); }
 
@@ -62,14 +69,49 @@ static int parse_dst(const char* s, char* out_name, size_t on,
     return 0;
 }
 
+// 一条连接负责文件的 [off, end)
+typedef struct {
+    int   s;
+    off_t off, end;
+} stripe_t;
+
+static int connect_to(const char* host, const char* port, int sndbuf)
+{
+    struct addrinfo hints, *ai = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &ai) != 0) die("getaddrinfo");
+    int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (s < 0) die("socket");
+    // 缓冲区要在 connect 前设置，窗口扩大因子在握手时协商
+    if (sndbuf > 0 && setsockopt(s, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0) die("setsockopt SO_SNDBUF");
+    // 可选：关闭 Nagle 将更“及时”，但对吞吐影响不大
+    // int one = 1; setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(s, ai->ai_addr, ai->ai_addrlen) < 0) die("connect");
+    freeaddrinfo(ai);
+    return s;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-b sndbuf_bytes] [-p conns] <src_file> <dest_file>@<ip>:<port>\n", prog);
+    exit(2);
+}
+
 int main(int argc, char** argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <src_file> <dest_file>@<ip>:<port>\n", argv[0]);
-        return 2;
+    int sndbuf = 0, nconn = 1, opt;
+    while ((opt = getopt(argc, argv, "b:p:")) != -1) {
+        switch (opt) {
+        case 'b': sndbuf = atoi(optarg); break;
+        case 'p': nconn = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
     }
-    const char* src_path = argv[1];
+    if (argc - optind != 2 || sndbuf < 0 || nconn < 1 || nconn > MAX_CONNS) usage(argv[0]);
+    const char* src_path = argv[optind];
     char dst_name[1024], host[256], port[64];
-    if (parse_dst(argv[2], dst_name, sizeof(dst_name), host, sizeof(host), port, sizeof(port)) != 0) {
+    if (parse_dst(argv[optind + 1], dst_name, sizeof(dst_name), host, sizeof(host), port, sizeof(port)) != 0) {
         fprintf(stderr, "Bad destination format. Expect: <dest>@<ip>:<port>\n");
         return 2;
     }
@@ -77,53 +119,71 @@ int main(int argc, char** argv) {
     struct stat st;
     if (stat(src_path, &st) != 0) die("stat src");
     uint64_t file_size = (uint64_t)st.st_size;
+    if ((uint64_t)nconn > file_size) nconn = file_size ? (int)file_size : 1;
 
     printf("Successfully initialized with:\n");
     printf("\tSource filename = %s\n\tDestination filename = %s\n", src_path, dst_name);
     printf("\tHostname = %s\n\tPort = %s\n", host, port);
+    printf("\tConnections = %d\n", nconn);
+    if (sndbuf) printf("\tSO_SNDBUF = %d\n", sndbuf);
     fflush(stdout);
 
-    // connect
-    struct addrinfo hints, *ai = NULL;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    if (getaddrinfo(host, port, &hints, &ai) != 0) die("getaddrinfo");
-    int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-    if (s < 0) die("socket");
-    // 可选：关闭 Nagle 将更“及时”，但对吞吐影响不大
-    // int one = 1; setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
-    if (connect(s, ai->ai_addr, ai->ai_addrlen) < 0) die("connect");
-    freeaddrinfo(ai);
+    int fd = open(src_path, O_RDONLY);
+    if (fd < 0) die("open src");
 
-    // header: [name_len u16 net][file_size u64 net][name bytes]
+    // 每条连接一个头：
+    // [name_len u16][file_size u64][offset u64][length u64][nconn u16][name bytes]，全部网络字节序
+    stripe_t stripes[MAX_CONNS];
+    uint64_t per = file_size / (uint64_t)nconn;
     uint16_t name_len = (uint16_t)strlen(dst_name);
-    uint16_t name_len_net = htons(name_len);
-    uint64_t fsz_net = htonll(file_size);
-    if (writen(s, &name_len_net, sizeof(name_len_net)) < 0) die("send name_len");
-    if (writen(s, &fsz_net, sizeof(fsz_net)) < 0) die("send file_size");
-    if (writen(s, dst_name, name_len) < 0) die("send dest_name");
-
-    // send body
-    FILE* fp = fopen(src_path, "rb");
-    if (!fp) die("fopen src");
-    char* buf = (char*)malloc(BUF_SIZE);
-    if (!buf) die("malloc");
+    for (int i = 0; i < nconn; ++i) {
+        stripe_t* sp = &stripes[i];
+        sp->off = (off_t)(per * (uint64_t)i);
+        sp->end = (i == nconn - 1) ? (off_t)file_size : (off_t)(per * (uint64_t)(i + 1));
+        sp->s = connect_to(host, port, sndbuf);
+
+        uint8_t hdr[2 + 8 + 8 + 8 + 2];
+        uint16_t v16; uint64_t v64;
+        v16 = htons(name_len);                        memcpy(hdr, &v16, 2);
+        v64 = htonll(file_size);                      memcpy(hdr + 2, &v64, 8);
+        v64 = htonll((uint64_t)sp->off);              memcpy(hdr + 10, &v64, 8);
+        v64 = htonll((uint64_t)(sp->end - sp->off));  memcpy(hdr + 18, &v64, 8);
+        v16 = htons((uint16_t)nconn);                 memcpy(hdr + 26, &v16, 2);
+        if (writen(sp->s, hdr, sizeof(hdr)) < 0) die("send header");
+        if (writen(sp->s, dst_name, name_len) < 0) die("send dest_name");
+        if (fcntl(sp->s, F_SETFL, fcntl(sp->s, F_GETFL) | O_NONBLOCK) < 0) die("fcntl");
+    }
 
     uint64_t start_ms = now_ms();
     uint64_t bytes_sent = 0;
 
-    for (;;) {
-        size_t n = fread(buf, 1, BUF_SIZE, fp);
-        if (n == 0) { if (feof(fp)) break; die("fread"); }
-        if (writen(s, buf, n) < 0) die("send body");
-        bytes_sent += (uint64_t)n;
+    // send body：哪条连接可写就往哪条 sendfile
+    int left = nconn;
+    for (int i = 0; i < nconn; ++i) {
+        if (stripes[i].off == stripes[i].end) { close(stripes[i].s); stripes[i].s = -1; left--; }
+    }
+    while (left > 0) {
+        struct pollfd pfd[MAX_CONNS];
+        for (int i = 0; i < nconn; ++i) { pfd[i].fd = stripes[i].s; pfd[i].events = POLLOUT; pfd[i].revents = 0; }
+        if (poll(pfd, (nfds_t)nconn, -1) < 0) { if (errno == EINTR) continue; die("poll"); }
+        for (int i = 0; i < nconn; ++i) {
+            stripe_t* sp = &stripes[i];
+            if (sp->s < 0 || !(pfd[i].revents & (POLLOUT | POLLERR | POLLHUP))) continue;
+            size_t want = (size_t)(sp->end - sp->off);
+            if (want > SENDFILE_CHUNK) want = SENDFILE_CHUNK;
+            ssize_t w = sendfile(sp->s, fd, &sp->off, want);   // 推进 sp->off，不动文件偏移
+            if (w < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                die("sendfile");
+            }
+            if (w == 0) { fprintf(stderr, "source file shrank\n"); exit(1); }
+            bytes_sent += (uint64_t)w;
+            if (sp->off == sp->end) { close(sp->s); sp->s = -1; left--; }
+        }
     }
-    free(buf);
     uint64_t end_ms = now_ms();
 
-    fclose(fp);
-    close(s);
+    close(fd);
 
     // final stats (TCP baseline不需要“含重传”的总发送量)
     double elapsed_s = (end_ms - start_ms) / 1000.0;
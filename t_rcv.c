@@ -1,9 +1,14 @@
 // t_rcv.c - TCP receiver baseline for Project 1
-// Usage: ./t_rcv <port>
+// Usage: ./t_rcv [-b rcvbuf_bytes] <port>
+//
+// 文件体用 splice 经管道从 socket 搬进文件（不经用户态缓冲）。
+// 发送端用 -p N 时会来 N 条连接，各自带自己那段的偏移，按偏移写入同一个文件。
 
 #define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <stdint.h>
@@ -17,7 +22,8 @@
 #include <unistd.h>
 
 #define TEN_MB 10000000ULL
-#define BUF_SIZE (1<<16) // 64KB
+#define MAX_CONNS 64
+#define PIPE_SIZE (1<<20)   // 每条连接的管道容量，也是一次 splice 的上限
 
 static void die(const char* msg) { perror(msg); exit(1); }
 
@@ -48,12 +54,50 @@ static ssize_t readn(int fd, void* buf, size_t n) {
     return (ssize_t)n;
 }
 
+// 每条连接的头：[name_len u16][file_size u64][offset u64][length u64][nconn u16][name]
+typedef struct {
+    int      s;
+    int      pipefd[2];
+    off_t    off, end;          // 这条连接负责的文件区间，off 随写入推进
+    uint64_t file_size;
+    uint16_t nconn;
+} conn_t;
+
+static void read_header(conn_t* c, char* dst_name, size_t cap)
+{
+    uint8_t hdr[2 + 8 + 8 + 8 + 2];
+    if (readn(c->s, hdr, sizeof(hdr)) != sizeof(hdr)) die("read header");
+    uint16_t v16; uint64_t v64;
+    memcpy(&v16, hdr, 2);
+    uint16_t name_len = ntohs(v16);
+    memcpy(&v64, hdr + 2, 8);  c->file_size = ntohll(v64);
+    memcpy(&v64, hdr + 10, 8); c->off = (off_t)ntohll(v64);
+    memcpy(&v64, hdr + 18, 8); c->end = c->off + (off_t)ntohll(v64);
+    memcpy(&v16, hdr + 26, 2); c->nconn = ntohs(v16);
+    if (name_len == 0 || name_len >= cap) { fprintf(stderr, "bad name_len\n"); exit(1); }
+    if (c->nconn == 0 || c->nconn > MAX_CONNS || (uint64_t)c->end > c->file_size) {
+        fprintf(stderr, "bad stripe header\n"); exit(1);
+    }
+    if (readn(c->s, dst_name, name_len) != name_len) die("read dest_name");
+    dst_name[name_len] = '\0';
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-b rcvbuf_bytes] <port>\n", prog);
+    exit(2);
+}
+
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-        return 2;
+    int rcvbuf = 0, opt;
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        switch (opt) {
+        case 'b': rcvbuf = atoi(optarg); break;
+        default:  usage(argv[0]);
+        }
     }
-    const char* port = argv[1];
+    if (argc - optind != 1 || rcvbuf < 0) usage(argv[0]);
+    const char* port = argv[optind];
 
     // listen
     struct addrinfo hints, *ai = NULL;
@@ -65,64 +109,89 @@ int main(int argc, char** argv) {
     int ls = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
     if (ls < 0) die("socket");
     int yes = 1; setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    // 接收缓冲区要在 listen 前设置，accept 出来的连接继承它（窗口扩大因子在握手时定）
+    if (rcvbuf > 0 && setsockopt(ls, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) die("setsockopt SO_RCVBUF");
     if (bind(ls, ai->ai_addr, ai->ai_addrlen) < 0) die("bind");
-    if (listen(ls, 1) < 0) die("listen");
+    if (listen(ls, MAX_CONNS) < 0) die("listen");
 
     printf("Successfully initialized with:\n\tPort = %s\n", port);
+    if (rcvbuf) printf("\tSO_RCVBUF = %d\n", rcvbuf);
     fflush(stdout);
 
-    struct sockaddr_storage peer; socklen_t plen = sizeof(peer);
-    int s = accept(ls, (struct sockaddr*)&peer, &plen);
-    if (s < 0) die("accept");
-    freeaddrinfo(ai); close(ls);
-
-    // ---- read header ----
-    // [name_len: u16 net-order][file_size: u64 net-order][dest_name: name_len bytes]
-    uint16_t name_len_net;
-    uint64_t fsz_net;
-    if (readn(s, &name_len_net, sizeof(name_len_net)) != sizeof(name_len_net)) die("read name_len");
-    if (readn(s, &fsz_net, sizeof(fsz_net)) != sizeof(fsz_net)) die("read file_size");
-    uint16_t name_len = ntohs(name_len_net);
-    uint64_t file_size = ntohll(fsz_net);
-    if (name_len == 0 || name_len > 1024) { fprintf(stderr, "bad name_len\n"); exit(1); }
-
+    // 第一条连接的头里带了总连接数，其余的都到齐后才开始收
+    conn_t conns[MAX_CONNS];
     char dst_name[1100] = {0};
-    if (readn(s, dst_name, name_len) != name_len) die("read dest_name");
-    dst_name[name_len] = '\0';
+    int nconn = 1;
+    for (int i = 0; i < nconn; ++i) {
+        conn_t* c = &conns[i];
+        c->s = accept(ls, NULL, NULL);
+        if (c->s < 0) die("accept");
+        char name[1100];
+        read_header(c, name, sizeof(name));
+        if (i == 0) {
+            nconn = c->nconn;
+            strcpy(dst_name, name);
+        } else if (c->nconn != nconn || c->file_size != conns[0].file_size || strcmp(name, dst_name) != 0) {
+            fprintf(stderr, "stripe header does not match the first connection\n");
+            exit(1);
+        }
+        if (pipe(c->pipefd) < 0) die("pipe");
+        fcntl(c->pipefd[1], F_SETPIPE_SZ, PIPE_SIZE);   // 失败就用默认 64KB
+        if (fcntl(c->s, F_SETFL, fcntl(c->s, F_GETFL) | O_NONBLOCK) < 0) die("fcntl");
+    }
+    freeaddrinfo(ai); close(ls);
 
-    FILE* fp = fopen(dst_name, "wb");
-    if (!fp) die("fopen dst");
+    int fd = open(dst_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) die("open dst");
+    if (ftruncate(fd, (off_t)conns[0].file_size) < 0) die("ftruncate");
 
     uint64_t start_ms = now_ms();
     uint64_t last_mark_ms = start_ms;
     uint64_t last_mark_bytes = 0;
     uint64_t bytes_in_order = 0;
 
-    // ---- receive body ----
-    char* buf = (char*)malloc(BUF_SIZE);
-    if (!buf) die("malloc");
-    for (;;) {
-        ssize_t r = recv(s, buf, BUF_SIZE, 0);
-        if (r < 0) { if (errno == EINTR) continue; die("recv"); }
-        if (r == 0) break; // EOF
-        size_t w = fwrite(buf, 1, (size_t)r, fp);
-        if (w != (size_t)r) die("fwrite");
-        bytes_in_order += (uint64_t)r;
-
-        // 10 MB progress (decimal)
-        uint64_t delta_bytes = bytes_in_order - last_mark_bytes;
-        if (delta_bytes >= TEN_MB) {
-            uint64_t now = now_ms();
-            uint64_t delta_ms = (now - last_mark_ms) ? (now - last_mark_ms) : 1;
-            double recent_mbps = (delta_bytes * 8.0) / (double)delta_ms / 1000.0;
-            printf("[TCP-RCV] Progress: %.2f MB total, recent 10MB avg rate: %.2f Mb/s\n",
-                   bytes_in_order / 1e6, recent_mbps);
-            fflush(stdout);
-            last_mark_ms = now;
-            last_mark_bytes += TEN_MB; // step one bucket
+    // ---- receive body：socket → pipe → file（按本连接的偏移写）----
+    int left = nconn;
+    while (left > 0) {
+        struct pollfd pfd[MAX_CONNS];
+        for (int i = 0; i < nconn; ++i) { pfd[i].fd = conns[i].s; pfd[i].events = POLLIN; pfd[i].revents = 0; }
+        if (poll(pfd, (nfds_t)nconn, -1) < 0) { if (errno == EINTR) continue; die("poll"); }
+        for (int i = 0; i < nconn; ++i) {
+            conn_t* c = &conns[i];
+            if (c->s < 0 || !(pfd[i].revents & (POLLIN | POLLERR | POLLHUP))) continue;
+            ssize_t r = splice(c->s, NULL, c->pipefd[1], NULL, PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (r < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                die("splice socket");
+            }
+            if (r == 0) { // EOF
+                if (c->off != c->end) { fprintf(stderr, "connection %d closed early\n", i); exit(1); }
+                close(c->s); close(c->pipefd[0]); close(c->pipefd[1]);
+                c->s = -1; left--;
+                continue;
+            }
+            if (c->off + r > c->end) { fprintf(stderr, "connection %d sent past its stripe\n", i); exit(1); }
+            for (ssize_t moved = 0; moved < r; ) {
+                ssize_t w = splice(c->pipefd[0], NULL, fd, &c->off, (size_t)(r - moved), SPLICE_F_MOVE);
+                if (w < 0) { if (errno == EINTR) continue; die("splice file"); }
+                moved += w;
+            }
+            bytes_in_order += (uint64_t)r;
+
+            // 10 MB progress (decimal)
+            uint64_t delta_bytes = bytes_in_order - last_mark_bytes;
+            if (delta_bytes >= TEN_MB) {
+                uint64_t now = now_ms();
+                uint64_t delta_ms = (now - last_mark_ms) ? (now - last_mark_ms) : 1;
+                double recent_mbps = (delta_bytes * 8.0) / (double)delta_ms / 1000.0;
+                printf("[TCP-RCV] Progress: %.2f MB total, recent 10MB avg rate: %.2f Mb/s\n",
+                       bytes_in_order / 1e6, recent_mbps);
+                fflush(stdout);
+                last_mark_ms = now;
+                last_mark_bytes += TEN_MB; // step one bucket
+            }
         }
     }
-    free(buf);
 
     // done stats
     uint64_t end_ms = now_ms();
@@ -133,7 +202,6 @@ int main(int argc, char** argv) {
            bytes_in_order / 1e6, elapsed_s, avg_mbps);
     fflush(stdout);
 
-    fclose(fp);
-    close(s);
+    close(fd);
     return 0;
 }
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+int trace_on;
+
+#define TRACE_RING        (1u << 17)   // 每线程 128K 条（4 MB）
+#define TRACE_MAX_THREADS 16
+static const long FLUSH_PERIOD_NS = 5000000;   // 后台线程 5ms 写一次
+
+// 单生产者（所属线程）单消费者（后台写线程）：head 只由生产者推进，tail 只由消费者推进
+typedef struct {
+    _Atomic uint64_t head;
+    char pad0[64 - sizeof(uint64_t)];
+    _Atomic uint64_t tail;
+    char pad1[64 - sizeof(uint64_t)];
+    _Atomic uint64_t dropped;          // 环满丢掉的
+    trace_rec_t rec[TRACE_RING];
+} trace_ring_t;
+
+static trace_ring_t *Rings[TRACE_MAX_THREADS];
+static _Atomic int   Nrings;
+static pthread_mutex_t Reg_lock = PTHREAD_MUTEX_INITIALIZER;   // 只在线程第一次记录时用
+static _Thread_local trace_ring_t *My_ring;
+static _Thread_local int My_tid = -1;   // -1 = 还没注册，-2 = 注册失败（线程太多 / 内存不够）
+
+static FILE       *Out;
+static char        Who;
+static pthread_t   Flusher;
+static _Atomic int Stop;
+
+static trace_ring_t *ring_register(void)
+{
+    pthread_mutex_lock(&Reg_lock);
+    int n = atomic_load_explicit(&Nrings, memory_order_relaxed);
+    trace_ring_t *r = n < TRACE_MAX_THREADS ? (trace_ring_t*)calloc(1, sizeof(*r)) : NULL;
+    if (r) {
+        Rings[n] = r;
+        My_tid = n;
+        atomic_store_explicit(&Nrings, n + 1, memory_order_release);   // Rings[n] 先于计数可见
+    } else {
+        My_tid = -2;
+    }
+    pthread_mutex_unlock(&Reg_lock);
+    return r;
+}
+
+void trace_put(uint64_t t_us, uint8_t ev, uint8_t cause, uint64_t seq, uint32_t a, uint32_t b, uint32_t c)
+{
+    trace_ring_t *r = My_ring;
+    if (!r) {
+        if (My_tid == -2) return;
+        r = My_ring = ring_register();
+        if (!r) return;
+    }
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t t = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (h - t >= TRACE_RING) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    trace_rec_t *x = &r->rec[h & (TRACE_RING - 1)];
+    x->t_us  = t_us;
+    x->seq   = seq;
+    x->a     = a;
+    x->b     = b;
+    x->c     = c;
+    x->ev    = ev;
+    x->cause = cause;
+    x->who   = (uint8_t)Who;
+    x->tid   = (uint8_t)My_tid;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);   // 记录内容先于 head 可见
+}
+
+// 把各环里已提交的记录写出去（只在后台线程 / 它退出后调用）
+static void drain_all(void)
+{
+    int n = atomic_load_explicit(&Nrings, memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        trace_ring_t *r = Rings[i];
+        uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        uint64_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+        while (t < h) {
+            uint64_t at = t & (TRACE_RING - 1);
+            uint64_t k = h - t < TRACE_RING - at ? h - t : TRACE_RING - at;   // 到环尾为止一段
+            fwrite(&r->rec[at], sizeof(trace_rec_t), (size_t)k, Out);
+            t += k;
+        }
+        atomic_store_explicit(&r->tail, t, memory_order_release);
+    }
+    fflush(Out);
+}
+
+static void *flush_main(void *arg)
+{
+    (void)arg;
+    struct timespec ts = { 0, FLUSH_PERIOD_NS };
+    while (!atomic_load_explicit(&Stop, memory_order_acquire)) {
+        drain_all();
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+int trace_open(const char *path, char who)
+{
+    Out = fopen(path, "wb");
+    if (!Out) return -1;
+    trace_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version  = TRACE_VERSION;
+    hdr.rec_size = sizeof(trace_rec_t);
+    if (fwrite(&hdr, sizeof(hdr), 1, Out) != 1) {
+        fclose(Out);
+        Out = NULL;
+        return -1;
+    }
+    Who = who;
+    atomic_store(&Stop, 0);
+    int rc = pthread_create(&Flusher, NULL, flush_main, NULL);
+    if (rc != 0) {
+        fclose(Out);
+        Out = NULL;
+        errno = rc;
+        return -1;
+    }
+    trace_on = 1;
+    return 0;
+}
+
+uint64_t trace_close(void)
+{
+    if (!trace_on) return 0;
+    trace_on = 0;
+    atomic_store_explicit(&Stop, 1, memory_order_release);
+    pthread_join(Flusher, NULL);
+    drain_all();
+    fclose(Out);
+    Out = NULL;
+    uint64_t dropped = 0;
+    int n = atomic_load(&Nrings);
+    for (int i = 0; i < n; ++i) dropped += atomic_load(&Rings[i]->dropped);
+    return dropped;
+}
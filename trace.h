@@ -0,0 +1,67 @@
+#ifndef CS2520_TRACE
+#define CS2520_TRACE
+
+#include <stdint.h>
+
+/*
+ * 二进制报文事件跟踪（ncp/rcv 的 -T file）：每条记录定长 32 字节，
+ * 写进本线程自己的环形缓冲（单生产者单消费者，无锁），后台线程每几毫秒把各环写到文件。
+ * 环满时丢记录并计数，从不阻塞热路径。没开时 trace_rec 只是一次分支。
+ *
+ * 文件 = trace_hdr_t + 记录流（本机字节序），用 ncp_trace 解码。
+ * 同一台机器上 ncp 和 rcv 的时间戳都是 CLOCK_MONOTONIC 微秒，可以合在一起看。
+ */
+#define TRACE_MAGIC   "NCPTRACE"
+#define TRACE_VERSION 1
+
+// 事件；seq 和 a/b/c 的含义按事件
+enum {
+    TR_TX = 1,      // 发送端发出 DATA：seq，a = 长度，b = 份数；cause = TRC_*（0 = 新数据）
+    TR_TX_ZERO,     // 发送端发出 ZERO：[seq, seq+a)，b = 份数；cause 同上
+    TR_ACK_IN,      // 发送端收到 ACK：seq = 累积确认后的下一片，a = 通告窗口，b = SACK 长度，c = SACK 起点低 32 位
+    TR_NACK_IN,     // 发送端收到 NACK：seq = 第一个洞，a = 区间数，b = 缺的分片数
+    TR_STATE,       // 发送端处理完 ACK：seq = send_base，a = 拥塞窗口，b = RTO（微秒），c = 在途分片数
+    TR_RX,          // 接收端收到 DATA/ZERO：[seq, seq+a)，cause = TRR_*
+    TR_ACK_OUT,     // 接收端发出 ACK：seq = 累积确认后的下一片，a = 窗口，b = SACK 长度，c = SACK 起点低 32 位
+    TR_NACK_OUT,    // 接收端发出 NACK：seq = 第一个洞，a = 区间数，b = 缺的分片数
+    TR_DROP,        // sendto_dbg 模拟丢包：seq = 报文第 1..4 字节（DATA/ACK/NACK 的线上序号），a = 长度，b = 包类型
+    TR_EVENTS
+};
+
+// TR_TX / TR_TX_ZERO 的 cause：为什么重传
+enum { TRC_NEW, TRC_NACK, TRC_RACK, TRC_DUPACK, TRC_TLP, TRC_RTO, TRC_CAUSES };
+
+// TR_RX 的 cause
+enum { TRR_IN_ORDER, TRR_BUFFERED, TRR_DUP, TRR_OUTSIDE };
+
+typedef struct {
+    uint64_t t_us;
+    uint64_t seq;
+    uint32_t a, b, c;
+    uint8_t  ev;
+    uint8_t  cause;
+    uint8_t  who;       // 'S' = ncp，'R' = rcv
+    uint8_t  tid;       // 进程内线程编号
+} trace_rec_t;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t rec_size;
+} trace_hdr_t;
+
+extern int trace_on;
+
+// 打开输出文件并启动后台写线程；who 记进每条记录。失败返回 -1（errno）
+int  trace_open(const char *path, char who);
+// 停后台线程，写出剩下的记录，关文件。返回因环满丢掉的记录数
+uint64_t trace_close(void);
+void trace_put(uint64_t t_us, uint8_t ev, uint8_t cause, uint64_t seq, uint32_t a, uint32_t b, uint32_t c);
+
+static inline void trace_rec(uint64_t t_us, uint8_t ev, uint8_t cause, uint64_t seq,
+                             uint32_t a, uint32_t b, uint32_t c)
+{
+    if (trace_on) trace_put(t_us, ev, cause, seq, a, b, c);
+}
+
+#endif
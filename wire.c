@@ -0,0 +1,200 @@
+#include <string.h>
+
+#include "net_include.h"
+#include "wire.h"
+
+static void put_u16(uint8_t *b, uint16_t v) { b[0] = (uint8_t)(v >> 8); b[1] = (uint8_t)v; }
+static void put_u32(uint8_t *b, uint32_t v)
+{
+    b[0] = (uint8_t)(v >> 24); b[1] = (uint8_t)(v >> 16); b[2] = (uint8_t)(v >> 8); b[3] = (uint8_t)v;
+}
+static void put_u64(uint8_t *b, uint64_t v) { put_u32(b, (uint32_t)(v >> 32)); put_u32(b + 4, (uint32_t)v); }
+
+static uint16_t get_u16(const uint8_t *b) { return (uint16_t)((b[0] << 8) | b[1]); }
+static uint32_t get_u32(const uint8_t *b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+static uint64_t get_u64(const uint8_t *b) { return ((uint64_t)get_u32(b) << 32) | get_u32(b + 4); }
+
+size_t wire_hdr_len(uint8_t type)
+{
+    switch (type) {
+    case PKT_DATA:     return DATA_HDR_LEN;
+    case PKT_START:    return 1 + 1 + 2 + 8 + 1;
+    case PKT_START_OK: return 1 + 1 + 2 + 4;
+    case PKT_FIN:      return 1 + 4 + 8;
+    case PKT_FIN_ACK:  return 1 + 4 + 8 + 4;
+    case PKT_PROBE:    return 1 + 4 + 2 + 2;
+    case PKT_PROBE_REPORT: return 1 + 4 + 2 + 2 + 2 + 4 + 4;
+    case PKT_ACK:      return 1 + 4 + 4;
+    case PKT_NACK:     return 1 + 4 + 1;
+    case PKT_ZERO:     return 1 + 4 + 2 + 2;
+    case PKT_BUSY:
+    case PKT_WND_PROBE: return 1 + 4;
+    default:           return 0;
+    }
+}
+
+size_t wire_encode(uint8_t *out, size_t cap, const pkt_t *p)
+{
+    size_t hl = wire_hdr_len(p->type);
+    if (hl == 0) return 0;
+    size_t body = (p->type == PKT_DATA || p->type == PKT_START || p->type == PKT_PROBE) ? p->len : 0;
+    if (p->type == PKT_START && body > 255) return 0;
+    if (p->type == PKT_NACK) {
+        if (p->nblk > WIRE_MAX_BLOCKS) return 0;
+        body = (size_t)p->nblk * 4;
+    }
+    if (p->type == PKT_ACK && (p->flags & WIRE_ACK_SACK)) body = 4 + 2;
+    if (hl + body > cap) return 0;
+
+    out[0] = (uint8_t)((p->type & WIRE_TYPE_MASK) | (p->flags << WIRE_FLAG_SHIFT));
+    switch (p->type) {
+    case PKT_START:
+        out[1] = WIRE_VERSION;
+        put_u16(out + 2, p->caps);
+        put_u64(out + 4, p->file_size);
+        out[12] = (uint8_t)body;
+        break;
+    case PKT_START_OK:
+        out[1] = WIRE_VERSION;
+        put_u16(out + 2, p->caps);
+        put_u32(out + 4, p->wnd);
+        break;
+    case PKT_FIN:
+        put_u32(out + 1, p->seq);
+        put_u64(out + 5, p->file_size);
+        break;
+    case PKT_FIN_ACK:
+        put_u32(out + 1, p->seq);
+        put_u64(out + 5, p->file_size);
+        put_u32(out + 13, p->ms);
+        break;
+    case PKT_PROBE:
+        put_u32(out + 1, p->seq);
+        put_u16(out + 5, p->idx);
+        put_u16(out + 7, p->nseg);
+        break;
+    case PKT_PROBE_REPORT:
+        put_u32(out + 1, p->seq);
+        put_u16(out + 5, p->nseg);
+        put_u16(out + 7, p->first);
+        put_u16(out + 9, p->idx);
+        put_u32(out + 11, p->disp_us);
+        put_u32(out + 15, p->hold_us);
+        break;
+    case PKT_ACK:
+        put_u32(out + 1, p->seq);
+        put_u32(out + 5, p->wnd);
+        if (p->flags & WIRE_ACK_SACK) {
+            put_u32(out + hl, p->sack);
+            put_u16(out + hl + 4, p->nseg);
+        }
+        return hl + body;
+    case PKT_NACK:
+        put_u32(out + 1, p->seq);
+        out[5] = p->nblk;
+        for (int i = 0; i < p->nblk; ++i) {
+            put_u16(out + hl + 4 * i, p->blk[i].off);
+            put_u16(out + hl + 4 * i + 2, p->blk[i].len);
+        }
+        return hl + body;
+    case PKT_ZERO:
+        if (p->nseg == 0 || p->len > MAX_PAYLOAD) return 0;
+        put_u32(out + 1, p->seq);
+        put_u16(out + 5, p->nseg);
+        put_u16(out + 7, (uint16_t)p->len);
+        break;
+    default:    // DATA/BUSY/WND_PROBE
+        put_u32(out + 1, p->seq);
+        break;
+    }
+    if (body && p->payload) memcpy(out + hl, p->payload, body);
+    return hl + body;
+}
+
+int wire_decode(const uint8_t *buf, size_t n, pkt_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    if (n < 1) return -1;
+    p->type  = buf[0] & WIRE_TYPE_MASK;
+    p->flags = buf[0] >> WIRE_FLAG_SHIFT;
+    size_t hl = wire_hdr_len(p->type);
+    if (hl == 0 || n < hl) return -1;
+
+    switch (p->type) {
+    case PKT_START:
+        p->version   = buf[1];
+        p->caps      = get_u16(buf + 2);
+        p->file_size = get_u64(buf + 4);
+        p->len       = buf[12];
+        if (hl + p->len > n) return -1;
+        p->payload   = buf + hl;
+        break;
+    case PKT_START_OK:
+        p->version = buf[1];
+        p->caps    = get_u16(buf + 2);
+        p->wnd     = get_u32(buf + 4);
+        break;
+    case PKT_FIN:
+        p->seq       = get_u32(buf + 1);
+        p->file_size = get_u64(buf + 5);
+        break;
+    case PKT_FIN_ACK:
+        p->seq       = get_u32(buf + 1);
+        p->file_size = get_u64(buf + 5);
+        p->ms        = get_u32(buf + 13);
+        break;
+    case PKT_PROBE:
+        p->seq  = get_u32(buf + 1);
+        p->idx  = get_u16(buf + 5);
+        p->nseg = get_u16(buf + 7);
+        p->len  = (uint32_t)(n - hl);
+        if (p->idx >= p->nseg) return -1;
+        break;
+    case PKT_PROBE_REPORT:
+        p->seq     = get_u32(buf + 1);
+        p->nseg    = get_u16(buf + 5);
+        p->first   = get_u16(buf + 7);
+        p->idx     = get_u16(buf + 9);
+        p->disp_us = get_u32(buf + 11);
+        p->hold_us = get_u32(buf + 15);
+        break;
+    case PKT_DATA:
+        p->seq     = get_u32(buf + 1);
+        p->payload = buf + hl;
+        p->len     = (uint32_t)(n - hl);
+        if (p->len > MAX_PAYLOAD) return -1;
+        break;
+    case PKT_ACK:
+        p->seq = get_u32(buf + 1);
+        p->wnd = get_u32(buf + 5);
+        if (p->flags & WIRE_ACK_SACK) {
+            if (hl + 4 + 2 > n) return -1;
+            p->sack = get_u32(buf + hl);
+            p->nseg = get_u16(buf + hl + 4);
+        }
+        break;
+    case PKT_NACK:
+        p->seq  = get_u32(buf + 1);
+        p->nblk = buf[5];
+        if (p->nblk > WIRE_MAX_BLOCKS || hl + (size_t)p->nblk * 4 > n) return -1;
+        for (int i = 0; i < p->nblk; ++i) {
+            p->blk[i].off = get_u16(buf + hl + 4 * i);
+            p->blk[i].len = get_u16(buf + hl + 4 * i + 2);
+        }
+        break;
+    case PKT_ZERO:
+        p->seq  = get_u32(buf + 1);
+        p->nseg = get_u16(buf + 5);
+        p->len  = get_u16(buf + 7);
+        if (p->nseg == 0 || p->len > MAX_PAYLOAD) return -1;
+        break;
+    default:    // BUSY/WND_PROBE
+        p->seq = get_u32(buf + 1);
+        break;
+    }
+    if ((p->type == PKT_START || p->type == PKT_START_OK) && p->version != WIRE_VERSION) return -1;
+    return 0;
+}
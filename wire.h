@@ -0,0 +1,88 @@
+#ifndef CS2520_WIRE
+#define CS2520_WIRE
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 线上格式（version 2）：所有多字节字段都是网络字节序，按字节拼装，与主机端序无关。
+ *
+ * 第 1 字节 = type/flags：低 5 位是包类型 PKT_*，高 3 位是各类型自己的标志位。
+ * 之后按类型各有布局，DATA 只带序号，file_size 只出现在 START/FIN：
+ *
+ *   DATA      tf | seq:4 | payload...             （负载长度 = 报文长度 - DATA_HDR_LEN）
+ *   START     tf | ver:1 | caps:2 | file_size:8 | name_len:1 | name...
+ *   START_OK  tf | ver:1 | caps:2 | wnd:4
+ *   FIN       tf | seq:4 | file_size:8
+ *   ACK       tf | seq:4 | wnd:4 [| sack:4 | n:2]  （wnd = 接收端还能收的分片数，从 seq+1 算起；
+ *                                                  标志 WIRE_ACK_SACK 时带 SACK：刚收进缓冲的乱序区间 [sack, sack+n)）
+ *   NACK      tf | seq:4 | n:1 | (off:2 | len:2) * n
+ *                                             （洞列表：缺 [seq+off, seq+off+len)，seq = 第一个缺的分片）
+ *   BUSY      tf | seq:4                          （seq = 排队位置）
+ *   WND_PROBE tf | seq:4                          （零窗口探测，接收端回一个 ACK）
+ *   ZERO      tf | seq:4 | n:2 | last_len:2       （[seq, seq+n) 全是零：代替 DATA，不带负载；
+ *                                                  除最后一片长 last_len 外都是满片）
+ *   FIN_ACK   tf | seq:4 | file_size:8 | ms:4     （seq 回显 FIN.seq；file_size = 写出的字节数，
+ *                                                  ms = 接收端从 START 到收齐的用时）
+ *   PROBE     tf | seq:4 | idx:2 | n:2 | pad...   （第 seq 串 n 个包里的第 idx 个，补齐到满长度）
+ *   PROBE_REPORT tf | seq:4 | n:2 | first:2 | last:2 | disp_us:4 | hold_us:4
+ *                                             （第 seq 串收到 n 个，序号从 first 到 last；
+ *                                               disp_us = 首末两个的到达间隔，hold_us = 末个到达后多久才报告）
+ *
+ * 版本号和能力位只在 START/START_OK 里协商一次；START_OK 回的是双方能力的交集。
+ */
+#define WIRE_VERSION      2
+
+#define WIRE_TYPE_MASK    0x1f
+#define WIRE_FLAG_SHIFT   5
+
+// 能力位（START / START_OK 的 caps）
+#define CAP_STREAM        0x0001   // 接受 size 未知的 START（流式输入）
+#define CAP_EARLY_DATA    0x0002   // 缓存先于 START 到达的 0-RTT 数据
+#define CAP_ZERO          0x0004   // 认识 ZERO（全零分片不发负载）
+#define CAP_FIN_ACK       0x0008   // 收齐后用 FIN_ACK 确认 FIN（发送端据此重发 FIN）
+#define CAP_PROBE         0x0010   // 握手后回应 PROBE 包串（PROBE_REPORT）
+
+#define WIRE_MAX_BLOCKS   32       // NACK 一次最多报告的区间数
+
+// ACK 的标志位：带 SACK 区间。不认识的发送端按定长解码，忽略多出的字节
+#define WIRE_ACK_SACK     0x1
+
+// 相对 seq 的分片区间
+typedef struct {
+    uint16_t off;
+    uint16_t len;
+} wire_blk_t;
+
+typedef struct {
+    uint8_t        type;        // PKT_*
+    uint8_t        flags;       // 0..7
+    uint32_t       seq;         // DATA/FIN/ACK/NACK/BUSY/FIN_ACK
+    uint64_t       file_size;   // START/FIN/FIN_ACK
+    uint8_t        version;     // START/START_OK
+    uint16_t       caps;        // START/START_OK
+    uint32_t       wnd;         // START_OK/ACK：接收端通告窗口（分片数）
+    uint8_t        nblk;        // NACK：区间数
+    uint16_t       nseg;        // ZERO：连续全零分片数（len = 最后一片长度）；ACK：SACK 区间长度
+    uint32_t       sack;        // ACK（WIRE_ACK_SACK）：SACK 区间起点
+    uint32_t       ms;          // FIN_ACK：接收端会话用时（毫秒）
+    uint16_t       idx;         // PROBE：串内序号；PROBE_REPORT：收到的最后一个序号（nseg = 串长 / 收到个数）
+    uint16_t       first;       // PROBE_REPORT：收到的第一个序号
+    uint32_t       disp_us;     // PROBE_REPORT
+    uint32_t       hold_us;     // PROBE_REPORT
+    wire_blk_t     blk[WIRE_MAX_BLOCKS];
+    const uint8_t *payload;     // DATA 负载 / START 文件名
+    uint32_t       len;         // payload 长度（PROBE：填充长度）
+} pkt_t;
+
+// 头部长度（DATA 为固定头，START 不含文件名）
+size_t wire_hdr_len(uint8_t type);
+
+// 编码到 out（容量 cap），返回报文总长，失败返回 0。
+// payload 为 NULL 而 len > 0 时只写头并把长度算进去：调用方自己把负载填到 out + wire_hdr_len()。
+size_t wire_encode(uint8_t *out, size_t cap, const pkt_t *p);
+
+// 解码；长度不足、未知类型或版本不符返回 -1。payload 指向 buf 内部。
+int wire_decode(const uint8_t *buf, size_t n, pkt_t *p);
+
+#endif